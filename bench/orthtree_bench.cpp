@@ -0,0 +1,1183 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "glade/glade.h"
+
+// Benchmarks for the Orthtree class. Each benchmark case is run for a sequence
+// of increasing sizes, and reports the time taken per operation so that the
+// scaling with size can be read off directly. A single case and size can be
+// chosen from the command line:
+//
+//     OrthtreeBench [case [size]]
+
+using namespace glade;
+
+static std::size_t const Dimension = 3;
+using Scalar = double;
+using Point = std::array<Scalar, Dimension>;
+using Octree = Orthtree<Dimension, Point, std::size_t, char>;
+using GappedOctree = Orthtree<
+	Dimension, Point, std::size_t, char,
+	OrthtreeInternalDetailsGapped>;
+
+// A leaf value that takes up two cache lines, for measuring the cost of loading
+// leaf values that aren't needed.
+struct Payload {
+	std::size_t id;
+	std::array<Scalar, 15> data;
+	Payload(std::size_t id = 0) : id(id), data() {
+	}
+	operator std::size_t() const {
+		return id;
+	}
+};
+using SplitOctree = Orthtree<
+	Dimension, Point, std::size_t, char,
+	OrthtreeInternalDetailsSplit>;
+using PayloadOctree = Orthtree<Dimension, Point, Payload, char>;
+using SplitPayloadOctree = Orthtree<
+	Dimension, Point, Payload, char,
+	OrthtreeInternalDetailsSplit>;
+using CompactOctree = Orthtree<
+	Dimension, Point, std::size_t, char,
+	OrthtreeInternalDetailsCompact>;
+using ImplicitOctree = Orthtree<
+	Dimension, Point, std::size_t, char,
+	OrthtreeInternalDetailsImplicit>;
+using NarrowOctree = Orthtree<
+	Dimension, Point, std::size_t, char,
+	OrthtreeInternalDetailsNarrow>;
+using ArenaOctree = Orthtree<
+	Dimension, Point, std::size_t, char,
+	OrthtreeInternalDetailsArena>;
+using LooseOctree = Orthtree<
+	Dimension, Point, std::size_t, char,
+	OrthtreeInternalDetailsLoose>;
+
+// The total mass and centre of mass of the leafs below a node, as used for
+// Barnes-Hut.
+struct Mass {
+	Scalar mass;
+	Point centre;
+	Mass() : mass(0.0), centre() {
+	}
+	Mass(Scalar mass, Point centre) : mass(mass), centre(centre) {
+	}
+	friend Mass operator+(Mass const& lhs, Mass const& rhs) {
+		Mass result(lhs.mass + rhs.mass, Point());
+		if (result.mass != 0.0) {
+			for (std::size_t dim = 0; dim < Dimension; ++dim) {
+				result.centre[dim] =
+					(lhs.mass * lhs.centre[dim] + rhs.mass * rhs.centre[dim]) /
+					result.mass;
+			}
+		}
+		return result;
+	}
+};
+using MassOctree = Orthtree<Dimension, Point, std::size_t, Mass>;
+
+// Softened gravity between leafs of unit mass, for Orthtree::barnesHut.
+struct Gravity {
+	using Result = Point;
+	static constexpr Scalar Softening = 1e-4;
+	static void add(Point& result, Point const& position, Point const& source) {
+		Point delta;
+		Scalar distanceSquared = Softening * Softening;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			delta[dim] = source[dim] - position[dim];
+			distanceSquared += delta[dim] * delta[dim];
+		}
+		Scalar scale = 1.0 / (distanceSquared * std::sqrt(distanceSquared));
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			result[dim] += scale * delta[dim];
+		}
+	}
+	void node(Point& result, Point const& position, Mass const& mass) const {
+		Point acceleration = {};
+		add(acceleration, position, mass.centre);
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			result[dim] += mass.mass * acceleration[dim];
+		}
+	}
+	void leaf(
+			Point& result,
+			Point const& position,
+			Point const& otherPosition,
+			std::size_t) const {
+		add(result, position, otherPosition);
+	}
+};
+
+static std::size_t const NodeCapacity = 16;
+static std::size_t const OperationCount = 4096;
+
+struct BenchCase {
+	std::string name;
+	std::function<double(std::size_t)> run;
+};
+
+static std::vector<Point> randomPoints(std::size_t count, unsigned seed) {
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<Scalar> distribution(0.0, 1.0);
+	std::vector<Point> points(count);
+	for (Point& point : points) {
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			point[dim] = distribution(generator);
+		}
+	}
+	return points;
+}
+
+template<typename Orthtree>
+static Orthtree buildOrthtree(
+		std::vector<Point> const& points,
+		bool autoAdjust,
+		std::size_t threadCount = 1) {
+	std::vector<std::size_t> values(points.size());
+	for (std::size_t index = 0; index < points.size(); ++index) {
+		values[index] = index;
+	}
+	return Orthtree(
+		{0.0, 0.0, 0.0}, {1.0, 1.0, 1.0},
+		values.begin(), values.end(),
+		points.begin(), points.end(),
+		NodeCapacity, 16, autoAdjust, threadCount);
+}
+
+template<typename Orthtree>
+static Orthtree buildOrthtree(std::size_t size, bool autoAdjust) {
+	return buildOrthtree<Orthtree>(randomPoints(size, 1), autoAdjust);
+}
+
+template<typename Clock = std::chrono::steady_clock>
+static double secondsSince(typename Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Constructs an Orthtree from a range of `size` leafs, and returns the time per
+// leaf.
+template<typename Orthtree>
+static double benchBuild(std::size_t size, std::size_t threadCount = 1) {
+	std::vector<Point> points = randomPoints(size, 1);
+	auto start = std::chrono::steady_clock::now();
+	Orthtree orthtree = buildOrthtree<Orthtree>(points, true, threadCount);
+	return secondsSince(start) / orthtree.leafs().size();
+}
+
+// Inserts leafs one at a time into an Orthtree that already holds `size` leafs,
+// and returns the time per insert.
+template<typename Orthtree>
+static double benchInsert(std::size_t size, bool autoAdjust) {
+	Orthtree orthtree = buildOrthtree<Orthtree>(size, autoAdjust);
+	std::vector<Point> points = randomPoints(OperationCount, 2);
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t index = 0; index < OperationCount; ++index) {
+		orthtree.insert(size + index, points[index]);
+	}
+	return secondsSince(start) / OperationCount;
+}
+
+// Inserts `count` leafs in batches of `batchSize` into an Orthtree that already
+// holds `size` leafs, and returns the time per leaf.
+static std::size_t const BatchSize = 64;
+
+template<typename Orthtree>
+static double benchInsertBatch(
+		std::size_t size,
+		std::size_t count,
+		std::size_t batchSize) {
+	Orthtree orthtree = buildOrthtree<Orthtree>(size, true);
+	std::vector<Point> points = randomPoints(count, 2);
+	std::vector<std::size_t> values(count);
+	for (std::size_t index = 0; index < count; ++index) {
+		values[index] = size + index;
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t index = 0; index < count; index += batchSize) {
+		std::size_t end = std::min(index + batchSize, count);
+		orthtree.insert(
+			values.begin() + index, values.begin() + end,
+			points.begin() + index, points.begin() + end);
+	}
+	return secondsSince(start) / count;
+}
+
+// Inserts `OperationCount` leafs into an Orthtree that holds `size` leafs and
+// doesn't adjust itself, then erases as many, and returns the time taken to
+// adjust it afterwards per leaf.
+template<typename Orthtree>
+static double benchAdjust(std::size_t size) {
+	Orthtree orthtree = buildOrthtree<Orthtree>(size, false);
+	std::vector<Point> points = randomPoints(OperationCount, 2);
+	std::vector<Point> erasePoints = randomPoints(OperationCount, 3);
+	for (std::size_t index = 0; index < OperationCount; ++index) {
+		Point point = points[index];
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			point[dim] /= 2;
+		}
+		orthtree.insert(size + index, point);
+		auto node = orthtree.find(erasePoints[index]);
+		if (!node->leafs.empty()) {
+			orthtree.erase(node->leafs.begin());
+		}
+	}
+	auto start = std::chrono::steady_clock::now();
+	orthtree.adjust();
+	return secondsSince(start) / orthtree.leafs().size();
+}
+
+// Erases leafs one at a time from an Orthtree that holds `size` leafs, and
+// returns the time per erase. The leafs are chosen by looking up the node that
+// contains a random point.
+template<typename Orthtree>
+static double benchErase(std::size_t size, bool autoAdjust) {
+	Orthtree orthtree = buildOrthtree<Orthtree>(size, autoAdjust);
+	std::vector<Point> points = randomPoints(OperationCount, 3);
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t index = 0; index < OperationCount; ++index) {
+		auto node = orthtree.find(points[index]);
+		if (!node->leafs.empty()) {
+			orthtree.erase(node->leafs.begin());
+		}
+	}
+	return secondsSince(start) / OperationCount;
+}
+
+// Inserts a leaf into an Orthtree that holds `size` leafs and erases it again,
+// several times over at each of `OperationCount` random points, and returns
+// the time per insert and erase. Whenever the leaf lands in a node that is
+// already full, the node is split, and unless the Orthtree has a lower merge
+// capacity, it is merged back together right away by the erase.
+template<typename Orthtree>
+static double benchThrash(std::size_t size, std::size_t mergeCapacity) {
+	std::size_t const repeatCount = 4;
+	Orthtree orthtree = buildOrthtree<Orthtree>(size, true);
+	orthtree.mergeCapacity(mergeCapacity);
+	std::vector<Point> points = randomPoints(OperationCount, 3);
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t index = 0; index < OperationCount; ++index) {
+		for (std::size_t repeat = 0; repeat < repeatCount; ++repeat) {
+			auto leaf = std::get<1>(orthtree.insert(size, points[index]));
+			orthtree.erase(leaf);
+		}
+	}
+	return secondsSince(start) / (repeatCount * OperationCount);
+}
+
+// Erases a tenth of the leafs from an Orthtree that holds `size` leafs, and
+// returns the time per erased leaf. The leafs are either all erased at once
+// with a predicate, or one at a time.
+template<typename Orthtree>
+static double benchExpire(std::size_t size, bool batch) {
+	Orthtree orthtree = buildOrthtree<Orthtree>(size, true);
+	auto isExpired = [](std::size_t value) {
+		return value % 10 == 0;
+	};
+	auto start = std::chrono::steady_clock::now();
+	if (batch) {
+		orthtree.eraseIf([&](typename Orthtree::ConstLeafReferenceProxy leaf) {
+			return isExpired(leaf.value);
+		});
+	}
+	else {
+		auto leaf = orthtree.leafs().begin();
+		while (leaf != orthtree.leafs().end()) {
+			if (isExpired(leaf->value)) {
+				leaf = std::get<1>(orthtree.erase(leaf));
+			}
+			else {
+				++leaf;
+			}
+		}
+	}
+	return secondsSince(start) / (size / 10);
+}
+
+// Moves every leaf of an Orthtree that holds `size` leafs a random distance of
+// up to `jitter` along each axis, over several steps, like a particle
+// simulation would. The leafs are moved with Orthtree::rebin if `threadCount`
+// is zero, and otherwise with Orthtree::update, which may rebuild the Orthtree
+// instead using that many threads. Returns the time per leaf per step.
+template<typename Orthtree>
+static double benchRebin(
+		std::size_t size,
+		Scalar jitter,
+		std::size_t threadCount) {
+	std::size_t const stepCount = 4;
+	Orthtree orthtree = buildOrthtree<Orthtree>(size, true);
+	std::mt19937 generator(4);
+	std::uniform_real_distribution<Scalar> distribution(-jitter, jitter);
+	std::vector<Point> positions;
+	double seconds = 0.0;
+	for (std::size_t step = 0; step < stepCount; ++step) {
+		positions.clear();
+		for (auto leaf : orthtree.leafs()) {
+			Point point = leaf.position;
+			for (std::size_t dim = 0; dim < Dimension; ++dim) {
+				point[dim] += distribution(generator);
+				point[dim] -= std::floor(point[dim]);
+			}
+			positions.push_back(point);
+		}
+		auto start = std::chrono::steady_clock::now();
+		if (threadCount != 0) {
+			orthtree.update(positions.begin(), positions.end(), threadCount);
+		}
+		else {
+			orthtree.rebin(positions.begin(), positions.end());
+		}
+		seconds += secondsSince(start);
+	}
+	return seconds / (stepCount * size);
+}
+
+// Shakes every leaf of an Orthtree that holds `size` leafs back and forth by
+// up to `jitter` along each axis around where it started, over several steps,
+// and moves the leafs with Orthtree::rebin. Returns the time per leaf per step.
+template<typename Orthtree>
+static double benchJitter(std::size_t size, Scalar jitter) {
+	std::size_t const stepCount = 8;
+	std::vector<Point> points = randomPoints(size, 1);
+	Orthtree orthtree = buildOrthtree<Orthtree>(points, true);
+	std::mt19937 generator(5);
+	std::uniform_real_distribution<Scalar> distribution(-jitter, jitter);
+	std::vector<Point> positions;
+	double seconds = 0.0;
+	for (std::size_t step = 0; step < stepCount; ++step) {
+		positions.clear();
+		for (auto leaf : orthtree.leafs()) {
+			Point point = points[leaf.value];
+			for (std::size_t dim = 0; dim < Dimension; ++dim) {
+				point[dim] += distribution(generator);
+				point[dim] = std::min(std::max(point[dim], 0.0), 0.999999);
+			}
+			positions.push_back(point);
+		}
+		auto start = std::chrono::steady_clock::now();
+		orthtree.rebin(positions.begin(), positions.end());
+		seconds += secondsSince(start);
+	}
+	return seconds / (stepCount * size);
+}
+
+static bool inBox(Point const& point, Point const& position, Scalar size) {
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		if (!(point[dim] >= position[dim] && point[dim] - position[dim] < size)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Finds the leafs inside of a box by walking through the nodes with iterators,
+// which is how box queries had to be written before Orthtree::query.
+template<typename Orthtree>
+static std::size_t queryIterators(
+		typename Orthtree::ConstNodeIterator node,
+		Point const& position,
+		Scalar size) {
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		if (
+				node->position[dim] + node->dimensions[dim] <= position[dim] ||
+				node->position[dim] >= position[dim] + size) {
+			return 0;
+		}
+	}
+	std::size_t sum = 0;
+	if (node->hasChildren) {
+		for (std::size_t index = 0; index < (1 << Dimension); ++index) {
+			sum += queryIterators<Orthtree>(node->children[index], position, size);
+		}
+	}
+	else {
+		for (auto leaf = node->leafs.begin(); leaf != node->leafs.end(); ++leaf) {
+			if (inBox(leaf->position, position, size)) {
+				sum += leaf->value;
+			}
+		}
+	}
+	return sum;
+}
+
+// Searches for the leafs inside of random boxes in an Orthtree that holds
+// `size` leafs, and returns the time per search. Each box covers about a
+// thousandth of the Orthtree.
+template<typename Orthtree>
+static double benchQuery(std::size_t size, bool useIterators) {
+	Orthtree const orthtree = buildOrthtree<Orthtree>(size, true);
+	Scalar const boxSize = 0.1;
+	std::vector<Point> positions = randomPoints(OperationCount, 4);
+	std::size_t sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (Point const& position : positions) {
+		if (useIterators) {
+			sum += queryIterators<Orthtree>(orthtree.root(), position, boxSize);
+		}
+		else {
+			Point dimensions;
+			dimensions.fill(boxSize);
+			orthtree.query(position, dimensions, [&](
+					typename Orthtree::ConstLeafRange range) {
+				for (auto leaf = range.begin(); leaf != range.end(); ++leaf) {
+					sum += leaf->value;
+				}
+			});
+		}
+	}
+	double seconds = secondsSince(start);
+	// Use the result so that the searches can't be optimized away.
+	if (sum == 1) {
+		std::cout << sum << std::endl;
+	}
+	return seconds / OperationCount;
+}
+
+// Counts the leafs inside of random boxes in an Orthtree that holds `size`
+// leafs, and returns the time per search. Only the positions of the leafs are
+// looked at. Each box covers about a thousandth of the Orthtree.
+template<typename Orthtree>
+static double benchCount(std::size_t size) {
+	Orthtree const orthtree = buildOrthtree<Orthtree>(size, true);
+	Point dimensions;
+	dimensions.fill(0.1);
+	std::vector<Point> positions = randomPoints(OperationCount, 4);
+	std::size_t sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (Point const& position : positions) {
+		orthtree.query(position, dimensions, [&](
+				typename Orthtree::ConstLeafRange range) {
+			sum += range.size();
+		});
+	}
+	double seconds = secondsSince(start);
+	if (sum == 1) {
+		std::cout << sum << std::endl;
+	}
+	return seconds / OperationCount;
+}
+
+// Visits every node of an Orthtree that holds `size` leafs, adding up their
+// depths, leaf counts, and positions, and returns the time per node. The nodes
+// are either looked at through NodeHandle%s, or by dereferencing the
+// NodeIterator%s.
+template<typename Orthtree>
+static double benchNodes(std::size_t size, bool useHandles) {
+	Orthtree const orthtree = buildOrthtree<Orthtree>(size, true);
+	std::size_t const repeatCount = 16;
+	Scalar sum = 0.0;
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t repeat = 0; repeat < repeatCount; ++repeat) {
+		auto nodes = orthtree.nodes();
+		for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+			if (useHandles) {
+				typename Orthtree::NodeHandle node = it.handle();
+				sum += node.depth() + node.leafs().size() + node.position()[0];
+			}
+			else {
+				sum += it->depth + it->leafs.size() + it->position[0];
+			}
+		}
+	}
+	double seconds = secondsSince(start);
+	if (sum == 1.0) {
+		std::cout << sum << std::endl;
+	}
+	return seconds / (repeatCount * orthtree.nodes().size());
+}
+
+// Fills in the mass of every node of an Orthtree that holds `size` leafs, and
+// returns the time per leaf. This is either done with Orthtree::reduce, or by
+// recursing through the NodeIterator%s.
+template<typename Orthtree, typename NodeIt>
+static Mass massIterators(NodeIt node) {
+	Mass mass;
+	if (node->hasChildren) {
+		for (std::size_t index = 0; index < (1 << Dimension); ++index) {
+			mass = mass + massIterators<Orthtree>(node->children[index]);
+		}
+	}
+	else {
+		auto leafs = node->leafs;
+		for (auto leaf = leafs.begin(); leaf != leafs.end(); ++leaf) {
+			mass = mass + Mass(1.0, leaf->position);
+		}
+	}
+	node->value = mass;
+	return mass;
+}
+
+template<typename Orthtree>
+static double benchReduce(std::size_t size, std::size_t threadCount) {
+	Orthtree orthtree = buildOrthtree<Orthtree>(size, true);
+	auto start = std::chrono::steady_clock::now();
+	if (threadCount == 0) {
+		massIterators<Orthtree>(orthtree.root());
+	}
+	else {
+		orthtree.reduce(
+			[](typename Orthtree::ConstLeafReferenceProxy leaf) {
+				return Mass(1.0, leaf.position);
+			},
+			[](Mass const& lhs, Mass const& rhs) {
+				return lhs + rhs;
+			},
+			threadCount);
+	}
+	double seconds = secondsSince(start);
+	if (orthtree.root()->value.mass != size) {
+		std::cout << orthtree.root()->value.mass << std::endl;
+	}
+	return seconds / size;
+}
+
+// Moves `BatchSize` random leafs of an Orthtree that holds `size` leafs, and
+// then fills in the masses of the nodes again, over several steps. Returns the
+// time taken to fill in the masses per step. Either only the changed nodes are
+// filled in, or all of them are.
+template<typename Orthtree>
+static double benchReduceChanged(std::size_t size, bool changedOnly) {
+	std::size_t const stepCount = 16;
+	Orthtree orthtree = buildOrthtree<Orthtree>(size, true);
+	auto leafMass = [](typename Orthtree::ConstLeafReferenceProxy leaf) {
+		return Mass(1.0, leaf.position);
+	};
+	auto combine = [](Mass const& lhs, Mass const& rhs) {
+		return lhs + rhs;
+	};
+	orthtree.reduce(leafMass, combine);
+	std::vector<Point> points = randomPoints(stepCount * BatchSize, 5);
+	std::mt19937 generator(6);
+	std::uniform_int_distribution<std::size_t> distribution(0, size - 1);
+	double seconds = 0.0;
+	for (std::size_t step = 0; step < stepCount; ++step) {
+		for (std::size_t index = 0; index < BatchSize; ++index) {
+			orthtree.move(
+				orthtree.leafs().begin() + distribution(generator),
+				points[step * BatchSize + index]);
+		}
+		auto start = std::chrono::steady_clock::now();
+		if (changedOnly) {
+			orthtree.reduceChanged(leafMass, combine);
+		}
+		else {
+			orthtree.reduce(leafMass, combine);
+		}
+		seconds += secondsSince(start);
+	}
+	if (orthtree.root()->value.mass != size) {
+		std::cout << orthtree.root()->value.mass << std::endl;
+	}
+	return seconds / stepCount;
+}
+
+// Sums the gravity from every other leaf on one leaf.
+static Point directGravity(
+		std::vector<Point> const& points,
+		std::size_t index) {
+	Point acceleration = {};
+	for (std::size_t other = 0; other < points.size(); ++other) {
+		if (other != index) {
+			Gravity::add(acceleration, points[index], points[other]);
+		}
+	}
+	return acceleration;
+}
+
+// Finds the gravitational acceleration of every leaf of an Orthtree that holds
+// `size` leafs, and returns the time per leaf. This is done either with
+// Orthtree::barnesHut, after filling in the masses of the nodes, or by summing
+// over every pair of leafs for a few of the leafs. For Barnes-Hut, the error
+// relative to the direct sum is printed as well.
+static std::size_t const DirectCount = 64;
+
+template<typename Orthtree>
+static double benchBarnesHut(
+		std::size_t size,
+		Scalar theta,
+		std::size_t threadCount) {
+	std::vector<Point> points = randomPoints(size, 1);
+	Orthtree orthtree = buildOrthtree<Orthtree>(points, true);
+	std::vector<Point> accelerations(size);
+	if (theta < 0) {
+		auto start = std::chrono::steady_clock::now();
+		for (std::size_t index = 0; index < DirectCount; ++index) {
+			accelerations[index] = directGravity(points, index);
+		}
+		double seconds = secondsSince(start);
+		if (accelerations[0][0] == 1.0) {
+			std::cout << accelerations[0][0] << std::endl;
+		}
+		return seconds / DirectCount;
+	}
+	auto start = std::chrono::steady_clock::now();
+	orthtree.reduce(
+		[](typename Orthtree::ConstLeafReferenceProxy leaf) {
+			return Mass(1.0, leaf.position);
+		},
+		[](Mass const& lhs, Mass const& rhs) {
+			return lhs + rhs;
+		},
+		threadCount);
+	orthtree.barnesHut(
+		Gravity(),
+		typename Orthtree::OpeningAngle { theta },
+		[&](typename Orthtree::LeafIterator leaf, Point const& acceleration) {
+			accelerations[leaf->value] = acceleration;
+		},
+		threadCount);
+	double seconds = secondsSince(start);
+	
+	// Compare a few of the leafs against the direct sum.
+	Scalar error = 0.0;
+	for (std::size_t index = 0; index < DirectCount; ++index) {
+		Point exact = directGravity(points, index);
+		Scalar difference = 0.0;
+		Scalar magnitude = 0.0;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			Scalar delta = accelerations[index][dim] - exact[dim];
+			difference += delta * delta;
+			magnitude += exact[dim] * exact[dim];
+		}
+		error += std::sqrt(difference / magnitude);
+	}
+	std::cout
+		<< "# theta " << theta << ", size " << size << ": "
+		<< "mean relative error " << error / DirectCount << std::endl;
+	return seconds / size;
+}
+
+// Searches for the `NearestCount` closest leafs to random points in an Orthtree
+// that holds `size` leafs, and returns the time per search. The brute force
+// version checks every leaf, and is only run a few times.
+static std::size_t const NearestCount = 8;
+
+template<typename Orthtree>
+static double benchNearest(std::size_t size, bool bruteForce) {
+	std::vector<Point> points = randomPoints(size, 1);
+	Orthtree const orthtree = buildOrthtree<Orthtree>(points, true);
+	std::size_t const searchCount = bruteForce ? 16 : OperationCount;
+	std::vector<Point> searchPoints = randomPoints(searchCount, 5);
+	typename Orthtree::NearestBuffer buffer;
+	std::vector<typename Orthtree::ConstLeafIterator> leafs;
+	std::vector<std::pair<Scalar, std::size_t> > distances(size);
+	leafs.reserve(NearestCount);
+	std::size_t sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (Point const& searchPoint : searchPoints) {
+		if (bruteForce) {
+			for (std::size_t index = 0; index < size; ++index) {
+				Scalar distance = 0;
+				for (std::size_t dim = 0; dim < Dimension; ++dim) {
+					Scalar delta = points[index][dim] - searchPoint[dim];
+					distance += delta * delta;
+				}
+				distances[index] = std::make_pair(distance, index);
+			}
+			std::partial_sort(
+				distances.begin(),
+				distances.begin() + NearestCount,
+				distances.end());
+			for (std::size_t index = 0; index < NearestCount; ++index) {
+				sum += distances[index].second;
+			}
+		}
+		else {
+			leafs.clear();
+			orthtree.nearest(
+				searchPoint,
+				NearestCount,
+				std::back_inserter(leafs),
+				buffer);
+			for (auto leaf : leafs) {
+				sum += leaf->value;
+			}
+		}
+	}
+	double seconds = secondsSince(start);
+	if (sum == 1) {
+		std::cout << sum << std::endl;
+	}
+	return seconds / searchCount;
+}
+
+// Finds every pair of leafs within a distance of each other in an Orthtree that
+// holds `size` leafs, and returns the time per leaf. The radius is chosen so
+// that each leaf has about `PairNeighbourCount` neighbours. The other version
+// does a separate radius search around every leaf.
+static std::size_t const PairNeighbourCount = 32;
+
+template<typename Orthtree>
+static double benchPairs(std::size_t size, bool separateSearches) {
+	std::vector<Point> points = randomPoints(size, 1);
+	Orthtree const orthtree = buildOrthtree<Orthtree>(points, true);
+	Scalar const radius = std::cbrt(
+		3.0 * PairNeighbourCount / (4.0 * 3.14159265358979 * size));
+	std::size_t sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	if (separateSearches) {
+		for (auto leaf : orthtree.leafs()) {
+			orthtree.withinRadius(leaf.position, radius, [&](
+					typename Orthtree::ConstLeafRange range) {
+				for (auto other = range.begin(); other != range.end(); ++other) {
+					if (other->value > leaf.value) {
+						sum += other->value;
+					}
+				}
+			});
+		}
+	}
+	else {
+		orthtree.forEachPairWithin(radius, [&](
+				typename Orthtree::ConstLeafIterator leaf,
+				typename Orthtree::ConstLeafIterator other) {
+			sum += leaf->value < other->value ? other->value : leaf->value;
+		});
+	}
+	double seconds = secondsSince(start);
+	if (sum == 1) {
+		std::cout << sum << std::endl;
+	}
+	return seconds / size;
+}
+
+// A dual-tree rule that adds up the values of the pairs of leafs within a
+// radius of each other, one from each Orthtree.
+template<typename Orthtree>
+struct RadiusRule {
+	Scalar radius;
+	std::vector<std::size_t> sums;
+	Scalar score(
+			typename Orthtree::NodeHandle node,
+			typename Orthtree::NodeHandle otherNode) const {
+		Scalar distanceSquared = 0.0;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			Scalar lower = node.position()[dim];
+			Scalar otherLower = otherNode.position()[dim];
+			Scalar delta = std::max({
+				0.0,
+				otherLower - (lower + node.dimensions()[dim]),
+				lower - (otherLower + otherNode.dimensions()[dim]) });
+			distanceSquared += delta * delta;
+		}
+		return distanceSquared > radius * radius ?
+			std::numeric_limits<Scalar>::infinity() :
+			distanceSquared;
+	}
+	void baseCase(
+			typename Orthtree::ConstLeafIterator leaf,
+			typename Orthtree::ConstLeafIterator otherLeaf) {
+		Scalar distanceSquared = 0.0;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			Scalar delta = leaf->position[dim] - otherLeaf->position[dim];
+			distanceSquared += delta * delta;
+		}
+		if (distanceSquared <= radius * radius) {
+			sums[leaf->value] += otherLeaf->value;
+		}
+	}
+};
+
+// Finds the pairs of leafs within a radius of each other between two Orthtrees
+// that each hold `size` leafs, and returns the time per leaf. The radius is the
+// same as for benchPairs. With no threads, a separate radius search is done
+// around every leaf instead.
+template<typename Orthtree>
+static double benchDualTree(std::size_t size, std::size_t threadCount) {
+	Orthtree const orthtree = buildOrthtree<Orthtree>(
+		randomPoints(size, 1),
+		true);
+	Orthtree const other = buildOrthtree<Orthtree>(randomPoints(size, 2), true);
+	RadiusRule<Orthtree> rule;
+	rule.radius = std::cbrt(
+		3.0 * PairNeighbourCount / (4.0 * 3.14159265358979 * size));
+	rule.sums.assign(size, 0);
+	auto start = std::chrono::steady_clock::now();
+	if (threadCount == 0) {
+		for (auto leaf : orthtree.leafs()) {
+			other.withinRadius(leaf.position, rule.radius, [&](
+					typename Orthtree::ConstLeafRange range) {
+				for (auto it = range.begin(); it != range.end(); ++it) {
+					rule.sums[leaf.value] += it->value;
+				}
+			});
+		}
+	}
+	else {
+		orthtree.dualTree(other, rule, threadCount);
+	}
+	double seconds = secondsSince(start);
+	std::size_t sum = std::accumulate(
+		rule.sums.begin(),
+		rule.sums.end(),
+		std::size_t(0));
+	if (sum == 1) {
+		std::cout << sum << std::endl;
+	}
+	return seconds / size;
+}
+
+// Traces line segments between random pairs of points through an Orthtree that
+// holds `size` leafs, and returns the time per segment. The segments are
+// either traced all the way to their end, or stopped at the first node.
+template<typename Orthtree>
+static double benchTrace(std::size_t size, bool stopEarly) {
+	Orthtree const orthtree = buildOrthtree<Orthtree>(size, true);
+	std::vector<Point> starts = randomPoints(OperationCount, 6);
+	std::vector<Point> ends = randomPoints(OperationCount, 7);
+	std::size_t sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t index = 0; index < OperationCount; ++index) {
+		orthtree.traceSegment(starts[index], ends[index], [&](
+				typename Orthtree::ConstLeafRange range,
+				Scalar,
+				Scalar) {
+			sum += range.size();
+			return !stopEarly;
+		});
+	}
+	double seconds = secondsSince(start);
+	if (sum == 1) {
+		std::cout << sum << std::endl;
+	}
+	return seconds / OperationCount;
+}
+
+// Tests `size` random points against a box or a ball, using the leaf filtering
+// kernels directly with a chosen instruction set, and returns the time per
+// point. The box and ball each hold about a quarter of the points.
+template<std::size_t Dim, typename FilterScalar>
+static double benchFilter(
+		std::size_t size,
+		bool ball,
+		internal::SimdLevel level) {
+	std::mt19937 generator(8);
+	std::uniform_real_distribution<FilterScalar> distribution(0.0, 1.0);
+	std::array<std::vector<FilterScalar>, Dim> coordinates;
+	for (std::vector<FilterScalar>& coordinate : coordinates) {
+		coordinate.resize(size);
+		for (FilterScalar& value : coordinate) {
+			value = distribution(generator);
+		}
+	}
+	std::array<FilterScalar, Dim> lower;
+	std::array<FilterScalar, Dim> dimensions;
+	std::array<FilterScalar, Dim> center;
+	lower.fill(0.5 - 0.5 * std::pow(0.25, 1.0 / Dim));
+	dimensions.fill(std::pow(0.25, 1.0 / Dim));
+	center.fill(0.5);
+	FilterScalar radiusSquared = Dim == 2 ? 0.08 : 0.15;
+	std::size_t sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (
+			std::size_t index = 0;
+			index < size;
+			index += internal::MaskWidth) {
+		std::size_t count = std::min(size - index, internal::MaskWidth);
+		std::array<FilterScalar const*, Dim> block;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			block[dim] = coordinates[dim].data() + index;
+		}
+		std::uint64_t mask = ball ?
+			internal::ballMask<Dim>(
+				block.data(), count, center.data(), radiusSquared, level) :
+			internal::boxMask<Dim>(
+				block.data(), count, lower.data(), dimensions.data(), level);
+		sum += mask & 1;
+	}
+	double seconds = secondsSince(start);
+	if (sum == 1) {
+		std::cout << sum << std::endl;
+	}
+	return seconds / size;
+}
+
+static std::vector<BenchCase> const benchCases = {
+	{ "build", [](std::size_t size) {
+		return benchBuild<Octree>(size); } },
+	{ "build-gapped", [](std::size_t size) {
+		return benchBuild<GappedOctree>(size); } },
+	{ "build-parallel", [](std::size_t size) {
+		return benchBuild<Octree>(size, std::thread::hardware_concurrency()); } },
+	// With auto-adjust turned off, only the leaf storage is measured.
+	{ "insert-fixed", [](std::size_t size) {
+		return benchInsert<Octree>(size, false); } },
+	{ "insert-fixed-gapped", [](std::size_t size) {
+		return benchInsert<GappedOctree>(size, false); } },
+	{ "insert", [](std::size_t size) {
+		return benchInsert<Octree>(size, true); } },
+	{ "insert-gapped", [](std::size_t size) {
+		return benchInsert<GappedOctree>(size, true); } },
+	// Doubles the number of leafs with a single range insert.
+	{ "insert-range", [](std::size_t size) {
+		return benchInsertBatch<Octree>(size, size, size); } },
+	{ "insert-range-gapped", [](std::size_t size) {
+		return benchInsertBatch<GappedOctree>(size, size, size); } },
+	{ "adjust", [](std::size_t size) {
+		return benchAdjust<Octree>(size); } },
+	{ "adjust-gapped", [](std::size_t size) {
+		return benchAdjust<GappedOctree>(size); } },
+	{ "erase-fixed", [](std::size_t size) {
+		return benchErase<Octree>(size, false); } },
+	{ "erase-fixed-gapped", [](std::size_t size) {
+		return benchErase<GappedOctree>(size, false); } },
+	// Inserting and erasing a leaf at the same place, with and without a gap
+	// between the node capacity and the merge capacity. With gaps in the leaf
+	// list, the leafs don't have to be shifted, so most of the time goes into
+	// splitting and merging nodes.
+	{ "thrash", [](std::size_t size) {
+		return benchThrash<GappedOctree>(size, NodeCapacity); } },
+	{ "thrash-hysteresis", [](std::size_t size) {
+		return benchThrash<GappedOctree>(size, NodeCapacity / 2); } },
+	// Erasing a tenth of the leafs, as when old leafs expire.
+	{ "expire", [](std::size_t size) {
+		return benchExpire<Octree>(size, true); } },
+	{ "expire-single", [](std::size_t size) {
+		return benchExpire<Octree>(size, false); } },
+	{ "expire-gapped", [](std::size_t size) {
+		return benchExpire<GappedOctree>(size, true); } },
+	// Moving every leaf a little bit, once per time step.
+	{ "rebin", [](std::size_t size) {
+		return benchRebin<Octree>(size, 0.005, 0); } },
+	{ "rebin-gapped", [](std::size_t size) {
+		return benchRebin<GappedOctree>(size, 0.005, 0); } },
+	// Moving most of the leafs to another node, where rebuilding is faster.
+	{ "rebin-far", [](std::size_t size) {
+		return benchRebin<Octree>(size, 0.1, 0); } },
+	{ "update", [](std::size_t size) {
+		return benchRebin<Octree>(size, 0.005, 1); } },
+	{ "update-far", [](std::size_t size) {
+		return benchRebin<Octree>(size, 0.1, 1); } },
+	{ "update-far-parallel", [](std::size_t size) {
+		return benchRebin<Octree>(
+			size,
+			0.1,
+			std::thread::hardware_concurrency()); } },
+	// Shaking the leafs in place, where loose nodes keep most of them from
+	// moving at all.
+	{ "jitter", [](std::size_t size) {
+		return benchJitter<Octree>(size, 0.005); } },
+	{ "jitter-loose", [](std::size_t size) {
+		return benchJitter<LooseOctree>(size, 0.005); } },
+	{ "query", [](std::size_t size) {
+		return benchQuery<Octree>(size, false); } },
+	{ "query-gapped", [](std::size_t size) {
+		return benchQuery<GappedOctree>(size, false); } },
+	{ "query-iterators", [](std::size_t size) {
+		return benchQuery<Octree>(size, true); } },
+	// Looking at every node, through a NodeHandle or by dereferencing the
+	// NodeIterator.
+	{ "nodes", [](std::size_t size) {
+		return benchNodes<Octree>(size, true); } },
+	{ "nodes-iterators", [](std::size_t size) {
+		return benchNodes<Octree>(size, false); } },
+	// Filling in the mass of each node.
+	{ "reduce", [](std::size_t size) {
+		return benchReduce<MassOctree>(size, 1); } },
+	{ "reduce-parallel", [](std::size_t size) {
+		return benchReduce<MassOctree>(
+			size,
+			std::thread::hardware_concurrency()); } },
+	{ "reduce-iterators", [](std::size_t size) {
+		return benchReduce<MassOctree>(size, 0); } },
+	// Filling in the masses again after moving a few leafs.
+	{ "reduce-changed", [](std::size_t size) {
+		return benchReduceChanged<MassOctree>(size, true); } },
+	{ "reduce-changed-all", [](std::size_t size) {
+		return benchReduceChanged<MassOctree>(size, false); } },
+	// Gravity between every pair of leafs, with direct summation for
+	// comparison.
+	{ "barnes-hut", [](std::size_t size) {
+		return benchBarnesHut<MassOctree>(size, 0.5, 1); } },
+	{ "barnes-hut-accurate", [](std::size_t size) {
+		return benchBarnesHut<MassOctree>(size, 0.25, 1); } },
+	{ "barnes-hut-parallel", [](std::size_t size) {
+		return benchBarnesHut<MassOctree>(
+			size,
+			0.5,
+			std::thread::hardware_concurrency()); } },
+	{ "barnes-hut-direct", [](std::size_t size) {
+		return benchBarnesHut<MassOctree>(size, -1.0, 1); } },
+	{ "nearest", [](std::size_t size) {
+		return benchNearest<Octree>(size, false); } },
+	{ "nearest-brute", [](std::size_t size) {
+		return benchNearest<Octree>(size, true); } },
+	// With large leaf values, storing the positions separately means that the
+	// values don't have to be loaded during the search.
+	{ "count-payload", [](std::size_t size) {
+		return benchCount<PayloadOctree>(size); } },
+	{ "count-payload-split", [](std::size_t size) {
+		return benchCount<SplitPayloadOctree>(size); } },
+	{ "nearest-payload", [](std::size_t size) {
+		return benchNearest<PayloadOctree>(size, false); } },
+	{ "nearest-payload-split", [](std::size_t size) {
+		return benchNearest<SplitPayloadOctree>(size, false); } },
+	{ "pairs", [](std::size_t size) {
+		return benchPairs<Octree>(size, false); } },
+	{ "pairs-searches", [](std::size_t size) {
+		return benchPairs<Octree>(size, true); } },
+	// Pairs of leafs within a radius between two Orthtrees.
+	{ "dual-tree", [](std::size_t size) {
+		return benchDualTree<Octree>(size, 1); } },
+	{ "dual-tree-parallel", [](std::size_t size) {
+		return benchDualTree<Octree>(
+			size,
+			std::thread::hardware_concurrency()); } },
+	{ "dual-tree-searches", [](std::size_t size) {
+		return benchDualTree<Octree>(size, 0); } },
+	{ "trace", [](std::size_t size) {
+		return benchTrace<Octree>(size, false); } },
+	{ "trace-first", [](std::size_t size) {
+		return benchTrace<Octree>(size, true); } },
+	// The leaf filtering kernels on their own, with and without vectorization.
+	{ "filter-box-2f", [](std::size_t size) {
+		return benchFilter<2, float>(
+			size, false, internal::simdLevel()); } },
+	{ "filter-box-2f-scalar", [](std::size_t size) {
+		return benchFilter<2, float>(
+			size, false, internal::SimdLevel::Scalar); } },
+	{ "filter-box-2d", [](std::size_t size) {
+		return benchFilter<2, double>(
+			size, false, internal::simdLevel()); } },
+	{ "filter-box-2d-scalar", [](std::size_t size) {
+		return benchFilter<2, double>(
+			size, false, internal::SimdLevel::Scalar); } },
+	{ "filter-box-3f", [](std::size_t size) {
+		return benchFilter<3, float>(
+			size, false, internal::simdLevel()); } },
+	{ "filter-box-3f-scalar", [](std::size_t size) {
+		return benchFilter<3, float>(
+			size, false, internal::SimdLevel::Scalar); } },
+	{ "filter-box-3d", [](std::size_t size) {
+		return benchFilter<3, double>(
+			size, false, internal::simdLevel()); } },
+	{ "filter-box-3d-scalar", [](std::size_t size) {
+		return benchFilter<3, double>(
+			size, false, internal::SimdLevel::Scalar); } },
+	{ "filter-ball-2f", [](std::size_t size) {
+		return benchFilter<2, float>(
+			size, true, internal::simdLevel()); } },
+	{ "filter-ball-2f-scalar", [](std::size_t size) {
+		return benchFilter<2, float>(
+			size, true, internal::SimdLevel::Scalar); } },
+	{ "filter-ball-2d", [](std::size_t size) {
+		return benchFilter<2, double>(
+			size, true, internal::simdLevel()); } },
+	{ "filter-ball-2d-scalar", [](std::size_t size) {
+		return benchFilter<2, double>(
+			size, true, internal::SimdLevel::Scalar); } },
+	{ "filter-ball-3f", [](std::size_t size) {
+		return benchFilter<3, float>(
+			size, true, internal::simdLevel()); } },
+	{ "filter-ball-3f-scalar", [](std::size_t size) {
+		return benchFilter<3, float>(
+			size, true, internal::SimdLevel::Scalar); } },
+	{ "filter-ball-3d", [](std::size_t size) {
+		return benchFilter<3, double>(
+			size, true, internal::simdLevel()); } },
+	{ "filter-ball-3d-scalar", [](std::size_t size) {
+		return benchFilter<3, double>(
+			size, true, internal::SimdLevel::Scalar); } },
+	// The same kernels, inside of searches through the Orthtree.
+	{ "query-split", [](std::size_t size) {
+		return benchCount<SplitOctree>(size); } },
+	{ "within-radius-split", [](std::size_t size) {
+		return benchPairs<SplitOctree>(size, true); } },
+	{ "pairs-split", [](std::size_t size) {
+		return benchPairs<SplitOctree>(size, false); } },
+	// Nodes that only store the size of their subtree, so that the child
+	// indices have to be found by walking through the siblings.
+	{ "build-compact", [](std::size_t size) {
+		return benchBuild<CompactOctree>(size); } },
+	{ "insert-compact", [](std::size_t size) {
+		return benchInsert<CompactOctree>(size, true); } },
+	{ "query-compact", [](std::size_t size) {
+		return benchQuery<CompactOctree>(size, false); } },
+	{ "nearest-compact", [](std::size_t size) {
+		return benchNearest<CompactOctree>(size, false); } },
+	{ "pairs-compact", [](std::size_t size) {
+		return benchPairs<CompactOctree>(size, false); } },
+	{ "trace-compact", [](std::size_t size) {
+		return benchTrace<CompactOctree>(size, false); } },
+	// Nodes that don't store their position and dimensions, so that they have
+	// to be worked out from the depth and cell of the node.
+	{ "build-implicit", [](std::size_t size) {
+		return benchBuild<ImplicitOctree>(size); } },
+	{ "query-implicit", [](std::size_t size) {
+		return benchQuery<ImplicitOctree>(size, false); } },
+	{ "nearest-implicit", [](std::size_t size) {
+		return benchNearest<ImplicitOctree>(size, false); } },
+	{ "pairs-implicit", [](std::size_t size) {
+		return benchPairs<ImplicitOctree>(size, false); } },
+	{ "trace-implicit", [](std::size_t size) {
+		return benchTrace<ImplicitOctree>(size, false); } },
+	// Nodes with 32 bit indices.
+	{ "build-narrow", [](std::size_t size) {
+		return benchBuild<NarrowOctree>(size); } },
+	{ "insert-narrow", [](std::size_t size) {
+		return benchInsert<NarrowOctree>(size, true); } },
+	{ "query-narrow", [](std::size_t size) {
+		return benchQuery<NarrowOctree>(size, false); } },
+	{ "nearest-narrow", [](std::size_t size) {
+		return benchNearest<NarrowOctree>(size, false); } },
+	{ "pairs-narrow", [](std::size_t size) {
+		return benchPairs<NarrowOctree>(size, false); } },
+	{ "trace-narrow", [](std::size_t size) {
+		return benchTrace<NarrowOctree>(size, false); } },
+	// Temporary buffers taken from an arena that is kept between operations.
+	{ "build-arena", [](std::size_t size) {
+		return benchBuild<ArenaOctree>(size); } },
+	{ "insert-arena", [](std::size_t size) {
+		return benchInsert<ArenaOctree>(size, true); } },
+	{ "insert-batch", [](std::size_t size) {
+		return benchInsertBatch<Octree>(size, OperationCount, BatchSize); } },
+	{ "insert-batch-arena", [](std::size_t size) {
+		return benchInsertBatch<ArenaOctree>(
+			size, OperationCount, BatchSize); } },
+};
+
+int main(int argc, char** argv) {
+	std::string caseName = argc > 1 ? argv[1] : "";
+	std::vector<std::size_t> sizes;
+	if (argc > 2) {
+		sizes.push_back(std::strtoul(argv[2], nullptr, 10));
+	} else {
+		for (std::size_t size = 1 << 12; size <= (1 << 18); size <<= 2) {
+			sizes.push_back(size);
+		}
+	}
+	bool found = false;
+	for (BenchCase const& benchCase : benchCases) {
+		if (!caseName.empty() && benchCase.name != caseName) {
+			continue;
+		}
+		found = true;
+		for (std::size_t size : sizes) {
+			double seconds = benchCase.run(size);
+			std::cout
+				<< benchCase.name << "\t"
+				<< size << "\t"
+				<< seconds * 1e9 << " ns/op" << std::endl;
+		}
+	}
+	if (!found) {
+		std::cerr << "Unknown benchmark case '" << caseName << "'." << std::endl;
+		return 1;
+	}
+	return 0;
+}
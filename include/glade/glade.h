@@ -2,6 +2,13 @@
 #define __GLADE_H_
 
 #include "orthtree.h"
+#include "orthtree_internal_details_arena.h"
+#include "orthtree_internal_details_compact.h"
+#include "orthtree_internal_details_gapped.h"
+#include "orthtree_internal_details_implicit.h"
+#include "orthtree_internal_details_loose.h"
+#include "orthtree_internal_details_narrow.h"
+#include "orthtree_internal_details_split.h"
 
 #include "orthtree_iterator.h"
 #include "orthtree_range.h"
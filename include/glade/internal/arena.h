@@ -0,0 +1,231 @@
+#ifndef __GLADE_INTERNAL_ARENA_H_
+#define __GLADE_INTERNAL_ARENA_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace glade {
+namespace internal {
+
+/**
+ * \brief A monotonic arena for temporary buffers.
+ * 
+ * Memory is handed out from large blocks by bumping an offset, and is never
+ * freed on its own. Instead, the arena is rewound to an earlier mark once the
+ * buffers allocated since then are no longer needed. The blocks are kept when
+ * the arena is rewound, so once the arena has grown large enough, allocating
+ * from it no longer goes through `operator new` at all. When the arena is
+ * rewound to empty, all of the blocks are merged into one.
+ * 
+ * Copying an arena gives an empty arena, since the buffers in it belong to
+ * whatever is using the original.
+ */
+class MonotonicArena final {
+	
+public:
+	
+	// A position within the arena that it can be rewound to.
+	struct Mark {
+		std::size_t block;
+		std::size_t offset;
+	};
+	
+private:
+	
+	struct Block {
+		std::unique_ptr<unsigned char[]> data;
+		std::size_t size;
+	};
+	
+	static constexpr std::size_t MinBlockSize = 4096;
+	
+	std::vector<Block> _blocks;
+	// The block that memory is currently being taken from, and how much of it
+	// has been used.
+	std::size_t _block;
+	std::size_t _offset;
+	
+	void addBlock(std::size_t size) {
+		Block block;
+		block.data.reset(new unsigned char[size]);
+		block.size = size;
+		_blocks.push_back(std::move(block));
+	}
+	
+public:
+	
+	MonotonicArena() : _blocks(), _block(0), _offset(0) {
+	}
+	MonotonicArena(MonotonicArena const&) : MonotonicArena() {
+	}
+	MonotonicArena(MonotonicArena&& other) noexcept :
+			_blocks(std::move(other._blocks)),
+			_block(other._block),
+			_offset(other._offset) {
+		other._blocks.clear();
+		other._block = 0;
+		other._offset = 0;
+	}
+	MonotonicArena& operator=(MonotonicArena const&) {
+		return *this;
+	}
+	MonotonicArena& operator=(MonotonicArena&& other) noexcept {
+		if (this != &other) {
+			_blocks = std::move(other._blocks);
+			_block = other._block;
+			_offset = other._offset;
+			other._blocks.clear();
+			other._block = 0;
+			other._offset = 0;
+		}
+		return *this;
+	}
+	
+	void* allocate(std::size_t size, std::size_t alignment) {
+		while (true) {
+			if (_block < _blocks.size()) {
+				Block& block = _blocks[_block];
+				std::uintptr_t begin =
+					reinterpret_cast<std::uintptr_t>(block.data.get());
+				std::uintptr_t address = begin + _offset;
+				address = (address + alignment - 1) / alignment * alignment;
+				std::size_t offset = address - begin;
+				if (offset + size <= block.size) {
+					_offset = offset + size;
+					return block.data.get() + offset;
+				}
+				// Move on to the next block, if there is one left over from
+				// before the arena was last rewound.
+				if (_block + 1 < _blocks.size()) {
+					++_block;
+					_offset = 0;
+					continue;
+				}
+			}
+			std::size_t blockSize = MinBlockSize;
+			if (!_blocks.empty()) {
+				blockSize = 2 * _blocks.back().size;
+			}
+			addBlock(std::max(blockSize, size + alignment));
+			_block = _blocks.size() - 1;
+			_offset = 0;
+		}
+	}
+	
+	Mark mark() const {
+		return Mark { _block, _offset };
+	}
+	
+	void rewind(Mark mark) {
+		_block = mark.block;
+		_offset = mark.offset;
+		if (_block == 0 && _offset == 0 && _blocks.size() > 1) {
+			std::size_t size = 0;
+			for (Block const& block : _blocks) {
+				size += block.size;
+			}
+			_blocks.clear();
+			addBlock(size);
+		}
+	}
+	
+	// The total size of the blocks owned by the arena.
+	std::size_t capacity() const {
+		std::size_t size = 0;
+		for (Block const& block : _blocks) {
+			size += block.size;
+		}
+		return size;
+	}
+	
+};
+
+/**
+ * \brief Rewinds an arena to where it was when the scope was entered.
+ * 
+ * Anything allocated from the arena during the scope has to be destroyed
+ * before the scope is left, so the scope should be declared before the
+ * buffers that use it.
+ */
+class ArenaScope final {
+	
+	MonotonicArena& _arena;
+	MonotonicArena::Mark _mark;
+	
+public:
+	
+	explicit ArenaScope(MonotonicArena& arena) :
+			_arena(arena),
+			_mark(arena.mark()) {
+	}
+	ArenaScope(ArenaScope const&) = delete;
+	ArenaScope& operator=(ArenaScope const&) = delete;
+	~ArenaScope() {
+		_arena.rewind(_mark);
+	}
+	
+};
+
+/**
+ * \brief An allocator that takes its memory from a MonotonicArena.
+ * 
+ * Deallocating does nothing, since the memory is given back when the arena is
+ * rewound. If the allocator isn't given an arena, then it uses `operator new`
+ * and `operator delete` like `std::allocator` does.
+ */
+template<typename T>
+class ArenaAllocator {
+	
+	template<typename U>
+	friend class ArenaAllocator;
+	
+	MonotonicArena* _arena;
+	
+public:
+	
+	using value_type = T;
+	
+	ArenaAllocator(MonotonicArena* arena = nullptr) noexcept : _arena(arena) {
+	}
+	template<typename U>
+	ArenaAllocator(ArenaAllocator<U> const& other) noexcept :
+			_arena(other._arena) {
+	}
+	
+	T* allocate(std::size_t n) {
+		if (_arena == nullptr) {
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+		}
+		return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+	}
+	void deallocate(T* pointer, std::size_t) noexcept {
+		if (_arena == nullptr) {
+			::operator delete(pointer);
+		}
+	}
+	
+	MonotonicArena* arena() const noexcept {
+		return _arena;
+	}
+	
+	template<typename U>
+	bool operator==(ArenaAllocator<U> const& other) const noexcept {
+		return _arena == other._arena;
+	}
+	template<typename U>
+	bool operator!=(ArenaAllocator<U> const& other) const noexcept {
+		return _arena != other._arena;
+	}
+	
+};
+
+}
+}
+
+#endif
+
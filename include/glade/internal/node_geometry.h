@@ -0,0 +1,53 @@
+#ifndef __GLADE_INTERNAL_NODE_GEOMETRY_H_
+#define __GLADE_INTERNAL_NODE_GEOMETRY_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace glade {
+namespace internal {
+
+/**
+ * \brief Stores the section of space that a node of an Orthtree encompasses.
+ * 
+ * If the geometry is implicit, then only the cell that the node covers is
+ * stored. At depth `d`, the root is divided into `2^d` cells along each
+ * dimension, and the node covers the cell with the index stored in `cell`.
+ * The position and dimensions of the node can then be found from the position
+ * and dimensions of the root.
+ * 
+ * \tparam Implicit whether the geometry is stored as a cell instead of as
+ * vectors
+ */
+template<std::size_t Dim, typename Vector, bool Implicit>
+struct NodeGeometry;
+
+template<std::size_t Dim, typename Vector>
+struct NodeGeometry<Dim, Vector, false> {
+	
+	Vector position;
+	Vector dimensions;
+	
+	NodeGeometry(Vector position, Vector dimensions) :
+			position(position),
+			dimensions(dimensions) {
+	}
+	
+};
+
+template<std::size_t Dim, typename Vector>
+struct NodeGeometry<Dim, Vector, true> {
+	
+	std::array<std::uint32_t, Dim> cell;
+	
+	NodeGeometry(Vector, Vector) : cell() {
+	}
+	
+};
+
+}
+}
+
+#endif
+
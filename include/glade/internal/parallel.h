@@ -0,0 +1,60 @@
+#ifndef __GLADE_INTERNAL_PARALLEL_H_
+#define __GLADE_INTERNAL_PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace glade {
+namespace internal {
+
+/**
+ * \brief Calls a function on chunks of the index range `[0, count)`, using up
+ * to `threadCount` threads.
+ * 
+ * The function is called as `f(begin, end)` for each chunk, where every chunk
+ * (except possibly the last) has `chunkSize` indices. Chunks are handed out to
+ * the threads as they finish their previous chunks, so the work is balanced
+ * even if some chunks take longer than others. The calling thread is used as
+ * one of the threads. If only one thread is requested, then `f(0, count)` is
+ * called directly.
+ */
+template<typename F>
+void parallelFor(
+		std::size_t threadCount,
+		std::size_t count,
+		std::size_t chunkSize,
+		F const& f) {
+	chunkSize = std::max<std::size_t>(chunkSize, 1);
+	std::size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+	threadCount = std::min(threadCount, chunkCount);
+	if (threadCount <= 1) {
+		f(std::size_t(0), count);
+		return;
+	}
+	std::atomic<std::size_t> nextChunk(0);
+	auto work = [&]() {
+		std::size_t chunk;
+		while ((chunk = nextChunk.fetch_add(1)) < chunkCount) {
+			std::size_t begin = chunk * chunkSize;
+			f(begin, std::min(begin + chunkSize, count));
+		}
+	};
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount - 1);
+	for (std::size_t index = 1; index < threadCount; ++index) {
+		threads.emplace_back(work);
+	}
+	work();
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+}
+}
+
+#endif
+
@@ -0,0 +1,106 @@
+#ifndef __GLADE_INTERNAL_RADIX_SORT_H_
+#define __GLADE_INTERNAL_RADIX_SORT_H_
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "parallel.h"
+
+namespace glade {
+namespace internal {
+
+/**
+ * \brief Sorts a list of unsigned integer keys, and applies the same
+ * permutation to a second list of values.
+ * 
+ * This is a stable least-significant-digit radix sort. Only the lowest
+ * `keyBits` bits of each key are looked at, so the sort takes time
+ * proportional to `keyBits` times the number of keys. Digits that are the same
+ * for every key are skipped.
+ * 
+ * If more than one thread is used, then the keys are split into one block per
+ * thread. Each thread counts the digits in its own block, and then moves its
+ * keys to the offsets reserved for that block, which keeps the sort stable.
+ * 
+ * The buffers used by the sort are allocated with the allocators of the lists.
+ */
+template<typename KeyList, typename ValueList>
+void radixSort(
+		KeyList& keys,
+		ValueList& values,
+		std::size_t keyBits = sizeof(typename KeyList::value_type) * CHAR_BIT,
+		std::size_t threadCount = 1) {
+	std::size_t const DigitBits = 8;
+	std::size_t const Radix = 1 << DigitBits;
+	std::size_t const size = keys.size();
+	threadCount = std::max<std::size_t>(threadCount, 1);
+	std::size_t const blockSize = (size + threadCount - 1) / threadCount;
+	using Offsets = std::array<std::size_t, Radix>;
+	using OffsetsAllocator = typename std::allocator_traits<
+		typename KeyList::allocator_type>::template rebind_alloc<Offsets>;
+	KeyList keysBuffer(size, keys.get_allocator());
+	ValueList valuesBuffer(size, values.get_allocator());
+	std::vector<Offsets, OffsetsAllocator> blockOffsets(
+		threadCount,
+		Offsets(),
+		OffsetsAllocator(keys.get_allocator()));
+	for (std::size_t shift = 0; shift < keyBits; shift += DigitBits) {
+		// Count the digits in each block.
+		parallelFor(threadCount, threadCount, 1, [&](
+				std::size_t blockBegin,
+				std::size_t blockEnd) {
+			for (std::size_t block = blockBegin; block < blockEnd; ++block) {
+				std::array<std::size_t, Radix>& counts = blockOffsets[block];
+				counts.fill(0);
+				std::size_t end = std::min(size, (block + 1) * blockSize);
+				for (std::size_t index = block * blockSize; index < end; ++index) {
+					++counts[(keys[index] >> shift) & (Radix - 1)];
+				}
+			}
+		});
+		// Turn the counts into offsets. If every key has the same digit, then
+		// this pass can be skipped.
+		std::size_t offset = 0;
+		bool sameDigit = false;
+		for (std::size_t digit = 0; digit < Radix; ++digit) {
+			std::size_t digitCount = 0;
+			for (std::array<std::size_t, Radix>& counts : blockOffsets) {
+				std::size_t count = counts[digit];
+				counts[digit] = offset;
+				offset += count;
+				digitCount += count;
+			}
+			sameDigit = sameDigit || digitCount == size;
+		}
+		if (sameDigit) {
+			continue;
+		}
+		// Move the keys into their sorted positions.
+		parallelFor(threadCount, threadCount, 1, [&](
+				std::size_t blockBegin,
+				std::size_t blockEnd) {
+			for (std::size_t block = blockBegin; block < blockEnd; ++block) {
+				std::array<std::size_t, Radix>& offsets = blockOffsets[block];
+				std::size_t end = std::min(size, (block + 1) * blockSize);
+				for (std::size_t index = block * blockSize; index < end; ++index) {
+					std::size_t digit = (keys[index] >> shift) & (Radix - 1);
+					std::size_t newIndex = offsets[digit]++;
+					keysBuffer[newIndex] = keys[index];
+					valuesBuffer[newIndex] = values[index];
+				}
+			}
+		});
+		keys.swap(keysBuffer);
+		values.swap(valuesBuffer);
+	}
+}
+
+}
+}
+
+#endif
+
@@ -0,0 +1,678 @@
+#ifndef __GLADE_INTERNAL_SIMD_H_
+#define __GLADE_INTERNAL_SIMD_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// The vectorized kernels are only available on x86 under GCC and Clang, where
+// the instruction set can be chosen separately for each function and checked
+// for at runtime. Defining `GLADE_NO_SIMD` turns them off.
+#if !defined(GLADE_NO_SIMD) && defined(__GNUC__) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define GLADE_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace glade {
+namespace internal {
+
+// The most leafs that a kernel can test at once, one for each bit of the mask
+// that it returns.
+constexpr std::size_t MaskWidth = 64;
+
+// Returns a mask with the lowest `count` bits set.
+inline std::uint64_t lowMask(std::size_t count) {
+	return count >= MaskWidth ?
+		~static_cast<std::uint64_t>(0) :
+		(static_cast<std::uint64_t>(1) << count) - 1;
+}
+
+// Finds the index of the lowest set bit of a mask, which must not be zero.
+// Masks are read this way instead of bit by bit to avoid a branch for every
+// leaf.
+inline std::size_t lowestBit(std::uint64_t mask) {
+#ifdef __GNUC__
+	return __builtin_ctzll(mask);
+#else
+	std::size_t index = 0;
+	while (((mask >> index) & 1) == 0) {
+		++index;
+	}
+	return index;
+#endif
+}
+
+// The instruction sets that the kernels can be run with, from worst to best.
+enum class SimdLevel {
+	Scalar,
+	Sse2,
+	Avx,
+	Avx512
+};
+
+// Finds the best instruction set that the processor supports.
+inline SimdLevel detectSimdLevel() {
+#ifdef GLADE_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return SimdLevel::Avx512;
+	}
+	else if (__builtin_cpu_supports("avx")) {
+		return SimdLevel::Avx;
+	}
+	else if (__builtin_cpu_supports("sse2")) {
+		return SimdLevel::Sse2;
+	}
+#endif
+	return SimdLevel::Scalar;
+}
+
+// Same as detectSimdLevel, but the processor is only checked once.
+inline SimdLevel simdLevel() {
+	static SimdLevel const level = detectSimdLevel();
+	return level;
+}
+
+// The kernels take the coordinates of the leafs as `Dim` separate arrays, and
+// return a mask with bit `i` set if leaf `i` passes the test. The scalar
+// kernels are also used for the leafs left over at the end of the vectorized
+// kernels, so they start from an index.
+
+template<std::size_t Dim, typename Scalar>
+std::uint64_t boxMaskScalar(
+		Scalar const* const* coordinates,
+		std::size_t begin,
+		std::size_t end,
+		Scalar const* lower,
+		Scalar const* dimensions) {
+	std::uint64_t result = 0;
+	for (std::size_t index = begin; index < end; ++index) {
+		bool inside = true;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			Scalar coordinate = coordinates[dim][index];
+			// Avoid short-circuiting, which would add unpredictable branches.
+			inside = inside &
+				(coordinate >= lower[dim]) &
+				(coordinate - lower[dim] < dimensions[dim]);
+		}
+		result |= static_cast<std::uint64_t>(inside) << index;
+	}
+	return result;
+}
+
+template<std::size_t Dim, typename Scalar>
+std::uint64_t ballMaskScalar(
+		Scalar const* const* coordinates,
+		std::size_t begin,
+		std::size_t end,
+		Scalar const* center,
+		Scalar radiusSquared) {
+	std::uint64_t result = 0;
+	for (std::size_t index = begin; index < end; ++index) {
+		Scalar distance = 0;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			Scalar delta = coordinates[dim][index] - center[dim];
+			distance += delta * delta;
+		}
+		bool inside = distance <= radiusSquared;
+		result |= static_cast<std::uint64_t>(inside) << index;
+	}
+	return result;
+}
+
+#ifdef GLADE_SIMD_X86
+
+// Each instruction set gets thin wrappers around its intrinsics, overloaded on
+// `float` and `double`, so that the kernels only have to be written once for
+// both.
+
+namespace sse2 {
+
+__attribute__((target("sse2")))
+inline __m128 load(float const* pointer) {
+	return _mm_loadu_ps(pointer);
+}
+__attribute__((target("sse2")))
+inline __m128d load(double const* pointer) {
+	return _mm_loadu_pd(pointer);
+}
+__attribute__((target("sse2")))
+inline __m128 broadcast(float value) {
+	return _mm_set1_ps(value);
+}
+__attribute__((target("sse2")))
+inline __m128d broadcast(double value) {
+	return _mm_set1_pd(value);
+}
+__attribute__((target("sse2")))
+inline __m128 sub(__m128 lhs, __m128 rhs) {
+	return _mm_sub_ps(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128d sub(__m128d lhs, __m128d rhs) {
+	return _mm_sub_pd(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128 mul(__m128 lhs, __m128 rhs) {
+	return _mm_mul_ps(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128d mul(__m128d lhs, __m128d rhs) {
+	return _mm_mul_pd(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128 add(__m128 lhs, __m128 rhs) {
+	return _mm_add_ps(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128d add(__m128d lhs, __m128d rhs) {
+	return _mm_add_pd(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128 greaterEqual(__m128 lhs, __m128 rhs) {
+	return _mm_cmpge_ps(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128d greaterEqual(__m128d lhs, __m128d rhs) {
+	return _mm_cmpge_pd(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128 less(__m128 lhs, __m128 rhs) {
+	return _mm_cmplt_ps(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128d less(__m128d lhs, __m128d rhs) {
+	return _mm_cmplt_pd(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128 lessEqual(__m128 lhs, __m128 rhs) {
+	return _mm_cmple_ps(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128d lessEqual(__m128d lhs, __m128d rhs) {
+	return _mm_cmple_pd(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128 both(__m128 lhs, __m128 rhs) {
+	return _mm_and_ps(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline __m128d both(__m128d lhs, __m128d rhs) {
+	return _mm_and_pd(lhs, rhs);
+}
+__attribute__((target("sse2")))
+inline std::uint64_t bits(__m128 mask) {
+	return static_cast<unsigned>(_mm_movemask_ps(mask));
+}
+__attribute__((target("sse2")))
+inline std::uint64_t bits(__m128d mask) {
+	return static_cast<unsigned>(_mm_movemask_pd(mask));
+}
+
+}
+
+namespace avx {
+
+__attribute__((target("avx")))
+inline __m256 load(float const* pointer) {
+	return _mm256_loadu_ps(pointer);
+}
+__attribute__((target("avx")))
+inline __m256d load(double const* pointer) {
+	return _mm256_loadu_pd(pointer);
+}
+__attribute__((target("avx")))
+inline __m256 broadcast(float value) {
+	return _mm256_set1_ps(value);
+}
+__attribute__((target("avx")))
+inline __m256d broadcast(double value) {
+	return _mm256_set1_pd(value);
+}
+__attribute__((target("avx")))
+inline __m256 sub(__m256 lhs, __m256 rhs) {
+	return _mm256_sub_ps(lhs, rhs);
+}
+__attribute__((target("avx")))
+inline __m256d sub(__m256d lhs, __m256d rhs) {
+	return _mm256_sub_pd(lhs, rhs);
+}
+__attribute__((target("avx")))
+inline __m256 mul(__m256 lhs, __m256 rhs) {
+	return _mm256_mul_ps(lhs, rhs);
+}
+__attribute__((target("avx")))
+inline __m256d mul(__m256d lhs, __m256d rhs) {
+	return _mm256_mul_pd(lhs, rhs);
+}
+__attribute__((target("avx")))
+inline __m256 add(__m256 lhs, __m256 rhs) {
+	return _mm256_add_ps(lhs, rhs);
+}
+__attribute__((target("avx")))
+inline __m256d add(__m256d lhs, __m256d rhs) {
+	return _mm256_add_pd(lhs, rhs);
+}
+__attribute__((target("avx")))
+inline __m256 greaterEqual(__m256 lhs, __m256 rhs) {
+	return _mm256_cmp_ps(lhs, rhs, _CMP_GE_OQ);
+}
+__attribute__((target("avx")))
+inline __m256d greaterEqual(__m256d lhs, __m256d rhs) {
+	return _mm256_cmp_pd(lhs, rhs, _CMP_GE_OQ);
+}
+__attribute__((target("avx")))
+inline __m256 less(__m256 lhs, __m256 rhs) {
+	return _mm256_cmp_ps(lhs, rhs, _CMP_LT_OQ);
+}
+__attribute__((target("avx")))
+inline __m256d less(__m256d lhs, __m256d rhs) {
+	return _mm256_cmp_pd(lhs, rhs, _CMP_LT_OQ);
+}
+__attribute__((target("avx")))
+inline __m256 lessEqual(__m256 lhs, __m256 rhs) {
+	return _mm256_cmp_ps(lhs, rhs, _CMP_LE_OQ);
+}
+__attribute__((target("avx")))
+inline __m256d lessEqual(__m256d lhs, __m256d rhs) {
+	return _mm256_cmp_pd(lhs, rhs, _CMP_LE_OQ);
+}
+__attribute__((target("avx")))
+inline __m256 both(__m256 lhs, __m256 rhs) {
+	return _mm256_and_ps(lhs, rhs);
+}
+__attribute__((target("avx")))
+inline __m256d both(__m256d lhs, __m256d rhs) {
+	return _mm256_and_pd(lhs, rhs);
+}
+__attribute__((target("avx")))
+inline std::uint64_t bits(__m256 mask) {
+	return static_cast<unsigned>(_mm256_movemask_ps(mask));
+}
+__attribute__((target("avx")))
+inline std::uint64_t bits(__m256d mask) {
+	return static_cast<unsigned>(_mm256_movemask_pd(mask));
+}
+
+}
+
+// AVX-512 comparisons produce mask registers instead of vectors, which are
+// plain integers that can be combined directly.
+namespace avx512 {
+
+__attribute__((target("avx512f")))
+inline __m512 load(float const* pointer) {
+	return _mm512_loadu_ps(pointer);
+}
+__attribute__((target("avx512f")))
+inline __m512d load(double const* pointer) {
+	return _mm512_loadu_pd(pointer);
+}
+__attribute__((target("avx512f")))
+inline __m512 loadMasked(float const* pointer, std::uint64_t lanes) {
+	return _mm512_maskz_loadu_ps(static_cast<__mmask16>(lanes), pointer);
+}
+__attribute__((target("avx512f")))
+inline __m512d loadMasked(double const* pointer, std::uint64_t lanes) {
+	return _mm512_maskz_loadu_pd(static_cast<__mmask8>(lanes), pointer);
+}
+__attribute__((target("avx512f")))
+inline __m512 broadcast(float value) {
+	return _mm512_set1_ps(value);
+}
+__attribute__((target("avx512f")))
+inline __m512d broadcast(double value) {
+	return _mm512_set1_pd(value);
+}
+__attribute__((target("avx512f")))
+inline __m512 sub(__m512 lhs, __m512 rhs) {
+	return _mm512_sub_ps(lhs, rhs);
+}
+__attribute__((target("avx512f")))
+inline __m512d sub(__m512d lhs, __m512d rhs) {
+	return _mm512_sub_pd(lhs, rhs);
+}
+__attribute__((target("avx512f")))
+inline __m512 mul(__m512 lhs, __m512 rhs) {
+	return _mm512_mul_ps(lhs, rhs);
+}
+__attribute__((target("avx512f")))
+inline __m512d mul(__m512d lhs, __m512d rhs) {
+	return _mm512_mul_pd(lhs, rhs);
+}
+__attribute__((target("avx512f")))
+inline __m512 add(__m512 lhs, __m512 rhs) {
+	return _mm512_add_ps(lhs, rhs);
+}
+__attribute__((target("avx512f")))
+inline __m512d add(__m512d lhs, __m512d rhs) {
+	return _mm512_add_pd(lhs, rhs);
+}
+__attribute__((target("avx512f")))
+inline std::uint64_t greaterEqual(__m512 lhs, __m512 rhs) {
+	return _mm512_cmp_ps_mask(lhs, rhs, _CMP_GE_OQ);
+}
+__attribute__((target("avx512f")))
+inline std::uint64_t greaterEqual(__m512d lhs, __m512d rhs) {
+	return _mm512_cmp_pd_mask(lhs, rhs, _CMP_GE_OQ);
+}
+__attribute__((target("avx512f")))
+inline std::uint64_t less(__m512 lhs, __m512 rhs) {
+	return _mm512_cmp_ps_mask(lhs, rhs, _CMP_LT_OQ);
+}
+__attribute__((target("avx512f")))
+inline std::uint64_t less(__m512d lhs, __m512d rhs) {
+	return _mm512_cmp_pd_mask(lhs, rhs, _CMP_LT_OQ);
+}
+__attribute__((target("avx512f")))
+inline std::uint64_t lessEqual(__m512 lhs, __m512 rhs) {
+	return _mm512_cmp_ps_mask(lhs, rhs, _CMP_LE_OQ);
+}
+__attribute__((target("avx512f")))
+inline std::uint64_t lessEqual(__m512d lhs, __m512d rhs) {
+	return _mm512_cmp_pd_mask(lhs, rhs, _CMP_LE_OQ);
+}
+__attribute__((target("avx512f")))
+inline std::uint64_t both(std::uint64_t lhs, std::uint64_t rhs) {
+	return lhs & rhs;
+}
+__attribute__((target("avx512f")))
+inline std::uint64_t bits(std::uint64_t mask) {
+	return mask;
+}
+
+}
+
+// The vectorized kernels. They are the same for each instruction set except for
+// the namespace that the wrappers come from, and the target attribute, which
+// has to be written out for each function.
+
+template<std::size_t Dim, typename Scalar>
+__attribute__((target("sse2")))
+std::uint64_t boxMaskSse2(
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* lower,
+		Scalar const* dimensions) {
+	using namespace sse2;
+	std::size_t const width = sizeof(load(lower)) / sizeof(Scalar);
+	std::uint64_t result = 0;
+	std::size_t index = 0;
+	for (; index + width <= count; index += width) {
+		// Start with every lane set.
+		auto inside = lessEqual(broadcast(Scalar(0)), broadcast(Scalar(0)));
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			auto coordinate = load(coordinates[dim] + index);
+			auto lowerBound = broadcast(lower[dim]);
+			inside = both(inside, both(
+				greaterEqual(coordinate, lowerBound),
+				less(sub(coordinate, lowerBound), broadcast(dimensions[dim]))));
+		}
+		result |= bits(inside) << index;
+	}
+	return result | boxMaskScalar<Dim>(
+		coordinates, index, count, lower, dimensions);
+}
+
+template<std::size_t Dim, typename Scalar>
+__attribute__((target("sse2")))
+std::uint64_t ballMaskSse2(
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* center,
+		Scalar radiusSquared) {
+	using namespace sse2;
+	std::size_t const width = sizeof(load(center)) / sizeof(Scalar);
+	std::uint64_t result = 0;
+	std::size_t index = 0;
+	for (; index + width <= count; index += width) {
+		auto distance = broadcast(Scalar(0));
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			auto delta = sub(
+				load(coordinates[dim] + index),
+				broadcast(center[dim]));
+			distance = add(distance, mul(delta, delta));
+		}
+		result |= bits(lessEqual(distance, broadcast(radiusSquared))) << index;
+	}
+	return result | ballMaskScalar<Dim>(
+		coordinates, index, count, center, radiusSquared);
+}
+
+template<std::size_t Dim, typename Scalar>
+__attribute__((target("avx")))
+std::uint64_t boxMaskAvx(
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* lower,
+		Scalar const* dimensions) {
+	using namespace avx;
+	std::size_t const width = sizeof(load(lower)) / sizeof(Scalar);
+	std::uint64_t result = 0;
+	std::size_t index = 0;
+	for (; index + width <= count; index += width) {
+		// Start with every lane set.
+		auto inside = lessEqual(broadcast(Scalar(0)), broadcast(Scalar(0)));
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			auto coordinate = load(coordinates[dim] + index);
+			auto lowerBound = broadcast(lower[dim]);
+			inside = both(inside, both(
+				greaterEqual(coordinate, lowerBound),
+				less(sub(coordinate, lowerBound), broadcast(dimensions[dim]))));
+		}
+		result |= bits(inside) << index;
+	}
+	return result | boxMaskScalar<Dim>(
+		coordinates, index, count, lower, dimensions);
+}
+
+template<std::size_t Dim, typename Scalar>
+__attribute__((target("avx")))
+std::uint64_t ballMaskAvx(
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* center,
+		Scalar radiusSquared) {
+	using namespace avx;
+	std::size_t const width = sizeof(load(center)) / sizeof(Scalar);
+	std::uint64_t result = 0;
+	std::size_t index = 0;
+	for (; index + width <= count; index += width) {
+		auto distance = broadcast(Scalar(0));
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			auto delta = sub(
+				load(coordinates[dim] + index),
+				broadcast(center[dim]));
+			distance = add(distance, mul(delta, delta));
+		}
+		result |= bits(lessEqual(distance, broadcast(radiusSquared))) << index;
+	}
+	return result | ballMaskScalar<Dim>(
+		coordinates, index, count, center, radiusSquared);
+}
+
+// With AVX-512, the leafs left over at the end are loaded with a mask instead of
+// being tested one at a time, since blocks of leafs are often short.
+template<std::size_t Dim, typename Scalar>
+__attribute__((target("avx512f")))
+std::uint64_t boxMaskAvx512(
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* lower,
+		Scalar const* dimensions) {
+	using namespace avx512;
+	std::size_t const width = sizeof(load(lower)) / sizeof(Scalar);
+	std::uint64_t result = 0;
+	for (std::size_t index = 0; index < count; index += width) {
+		std::uint64_t lanes = lowMask(count - index);
+		auto inside = lanes;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			auto coordinate = loadMasked(coordinates[dim] + index, lanes);
+			auto lowerBound = broadcast(lower[dim]);
+			inside = both(inside, both(
+				greaterEqual(coordinate, lowerBound),
+				less(sub(coordinate, lowerBound), broadcast(dimensions[dim]))));
+		}
+		result |= bits(inside) << index;
+	}
+	return result;
+}
+
+template<std::size_t Dim, typename Scalar>
+__attribute__((target("avx512f")))
+std::uint64_t ballMaskAvx512(
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* center,
+		Scalar radiusSquared) {
+	using namespace avx512;
+	std::size_t const width = sizeof(load(center)) / sizeof(Scalar);
+	std::uint64_t result = 0;
+	for (std::size_t index = 0; index < count; index += width) {
+		std::uint64_t lanes = lowMask(count - index);
+		auto distance = broadcast(Scalar(0));
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			auto delta = sub(
+				loadMasked(coordinates[dim] + index, lanes),
+				broadcast(center[dim]));
+			distance = add(distance, mul(delta, delta));
+		}
+		auto inside = lessEqual(distance, broadcast(radiusSquared));
+		result |= bits(both(inside, lanes)) << index;
+	}
+	return result;
+}
+
+#endif
+
+// Chooses a kernel for the instruction set. Only `float` and `double` have
+// vectorized kernels.
+template<std::size_t Dim, typename Scalar>
+std::uint64_t boxMask(
+		SimdLevel level,
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* lower,
+		Scalar const* dimensions,
+		std::false_type) {
+	static_cast<void>(level);
+	return boxMaskScalar<Dim>(coordinates, 0, count, lower, dimensions);
+}
+
+template<std::size_t Dim, typename Scalar>
+std::uint64_t boxMask(
+		SimdLevel level,
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* lower,
+		Scalar const* dimensions,
+		std::true_type) {
+	switch (level) {
+#ifdef GLADE_SIMD_X86
+	case SimdLevel::Avx512:
+		return boxMaskAvx512<Dim>(coordinates, count, lower, dimensions);
+	case SimdLevel::Avx:
+		return boxMaskAvx<Dim>(coordinates, count, lower, dimensions);
+	case SimdLevel::Sse2:
+		return boxMaskSse2<Dim>(coordinates, count, lower, dimensions);
+#endif
+	default:
+		return boxMaskScalar<Dim>(coordinates, 0, count, lower, dimensions);
+	}
+}
+
+template<std::size_t Dim, typename Scalar>
+std::uint64_t ballMask(
+		SimdLevel level,
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* center,
+		Scalar radiusSquared,
+		std::false_type) {
+	static_cast<void>(level);
+	return ballMaskScalar<Dim>(coordinates, 0, count, center, radiusSquared);
+}
+
+template<std::size_t Dim, typename Scalar>
+std::uint64_t ballMask(
+		SimdLevel level,
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* center,
+		Scalar radiusSquared,
+		std::true_type) {
+	switch (level) {
+#ifdef GLADE_SIMD_X86
+	case SimdLevel::Avx512:
+		return ballMaskAvx512<Dim>(coordinates, count, center, radiusSquared);
+	case SimdLevel::Avx:
+		return ballMaskAvx<Dim>(coordinates, count, center, radiusSquared);
+	case SimdLevel::Sse2:
+		return ballMaskSse2<Dim>(coordinates, count, center, radiusSquared);
+#endif
+	default:
+		return ballMaskScalar<Dim>(
+			coordinates, 0, count, center, radiusSquared);
+	}
+}
+
+template<typename Scalar>
+using HasSimdKernels = std::integral_constant<
+	bool,
+	std::is_same<Scalar, float>::value || std::is_same<Scalar, double>::value>;
+
+/**
+ * \brief Tests which of a list of points lie inside of a box.
+ * 
+ * The points are given as `Dim` arrays of `count` coordinates each, where
+ * `count` is at most MaskWidth. Bit `i` of the result is set if point `i` lies
+ * inside of the box, with the same half-open bounds as used by the Orthtree.
+ * For `float` and `double` coordinates, the test is vectorized using the best
+ * instruction set available when the program is run.
+ */
+template<std::size_t Dim, typename Scalar>
+std::uint64_t boxMask(
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* lower,
+		Scalar const* dimensions,
+		SimdLevel level = simdLevel()) {
+	return boxMask<Dim>(
+		level,
+		coordinates,
+		count,
+		lower,
+		dimensions,
+		HasSimdKernels<Scalar>());
+}
+
+/**
+ * \brief Tests which of a list of points lie within a certain distance of a
+ * center point.
+ * 
+ * The points are given in the same way as for boxMask. Bit `i` of the result
+ * is set if the squared distance from point `i` to the center is at most
+ * `radiusSquared`.
+ */
+template<std::size_t Dim, typename Scalar>
+std::uint64_t ballMask(
+		Scalar const* const* coordinates,
+		std::size_t count,
+		Scalar const* center,
+		Scalar radiusSquared,
+		SimdLevel level = simdLevel()) {
+	return ballMask<Dim>(
+		level,
+		coordinates,
+		count,
+		center,
+		radiusSquared,
+		HasSimdKernels<Scalar>());
+}
+
+}
+}
+
+#endif
+
@@ -0,0 +1,500 @@
+#ifndef __GLADE_INTERNAL_SPLIT_LEAF_LIST_H_
+#define __GLADE_INTERNAL_SPLIT_LEAF_LIST_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+namespace glade {
+namespace internal {
+
+template<
+	std::size_t Dim,
+	typename Scalar,
+	typename Vector,
+	typename Value,
+	typename Element,
+	typename Details>
+class SplitLeafList;
+
+template<typename List, bool Const>
+class SplitLeafIteratorBase;
+
+/**
+ * \brief A proxy type that acts as a reference to an element of a
+ * SplitLeafList.
+ * 
+ * The position is copied out of the list when the reference is created, while
+ * the value is referred to directly. Assigning to the reference writes a whole
+ * element into the list.
+ */
+template<typename List, bool Const>
+class SplitLeafReferenceBase final {
+	
+private:
+	
+	friend List;
+	
+	template<typename, bool>
+	friend class SplitLeafReferenceBase;
+	template<typename, bool>
+	friend class SplitLeafIteratorBase;
+	
+	using ListPointer = std::conditional_t<Const, List const*, List*>;
+	using ValueReference = std::conditional_t<
+		Const,
+		typename List::ValueType const&,
+		typename List::ValueType&>;
+	
+	ListPointer _list;
+	typename List::size_type _index;
+	
+	SplitLeafReferenceBase(ListPointer list, typename List::size_type index) :
+			_list(list),
+			_index(index),
+			position(list->position(index)),
+			value(list->_values[index]) {
+	}
+	
+public:
+	
+	typename List::PositionType const position;
+	ValueReference value;
+	
+	SplitLeafReferenceBase(SplitLeafReferenceBase const& other) = default;
+	
+	operator typename List::value_type() const {
+		return typename List::value_type(position, value);
+	}
+	
+	operator SplitLeafReferenceBase<List, true>() const {
+		return SplitLeafReferenceBase<List, true>(_list, _index);
+	}
+	
+	SplitLeafReferenceBase const& operator=(
+			typename List::value_type const& element) const {
+		static_assert(!Const, "cannot assign through a const reference");
+		_list->assign(_index, element.position, element.value);
+		return *this;
+	}
+	
+	template<bool OtherConst>
+	SplitLeafReferenceBase const& operator=(
+			SplitLeafReferenceBase<List, OtherConst> const& other) const {
+		static_assert(!Const, "cannot assign through a const reference");
+		for (std::size_t dim = 0; dim < List::Dimension; ++dim) {
+			_list->_coordinates[dim][_index] =
+				other._list->_coordinates[dim][other._index];
+		}
+		_list->_values[_index] = other._list->_values[other._index];
+		return *this;
+	}
+	SplitLeafReferenceBase const& operator=(
+			SplitLeafReferenceBase const& other) const {
+		return operator=<Const>(other);
+	}
+	
+};
+
+/**
+ * \brief A random access iterator over the elements of a SplitLeafList.
+ * 
+ * Dereferencing the iterator gives a SplitLeafReferenceBase, so it can be used
+ * with standard algorithms that copy or move elements (`std::move`,
+ * `std::copy`, and so on), but not with algorithms that need a true reference.
+ */
+template<typename List, bool Const>
+class SplitLeafIteratorBase final {
+	
+private:
+	
+	friend List;
+	
+	template<typename, bool>
+	friend class SplitLeafIteratorBase;
+	
+	using ListPointer = std::conditional_t<Const, List const*, List*>;
+	
+	ListPointer _list;
+	typename List::difference_type _index;
+	
+	SplitLeafIteratorBase(
+			ListPointer list,
+			typename List::difference_type index) :
+			_list(list),
+			_index(index) {
+	}
+	
+public:
+	
+	// Iterator typedefs.
+	using value_type = typename List::value_type;
+	using reference = SplitLeafReferenceBase<List, Const>;
+	using pointer = void;
+	using size_type = typename List::size_type;
+	using difference_type = typename List::difference_type;
+	using iterator_category = std::random_access_iterator_tag;
+	
+	SplitLeafIteratorBase() :
+			_list(nullptr),
+			_index(0) {
+	}
+	
+	operator SplitLeafIteratorBase<List, true>() const {
+		return SplitLeafIteratorBase<List, true>(_list, _index);
+	}
+	
+	reference operator*() const {
+		return reference(_list, _index);
+	}
+	reference operator[](difference_type n) const {
+		return reference(_list, _index + n);
+	}
+	
+	SplitLeafIteratorBase& operator++() {
+		++_index;
+		return *this;
+	}
+	SplitLeafIteratorBase operator++(int) {
+		SplitLeafIteratorBase result = *this;
+		++_index;
+		return result;
+	}
+	SplitLeafIteratorBase& operator--() {
+		--_index;
+		return *this;
+	}
+	SplitLeafIteratorBase operator--(int) {
+		SplitLeafIteratorBase result = *this;
+		--_index;
+		return result;
+	}
+	
+	SplitLeafIteratorBase& operator+=(difference_type n) {
+		_index += n;
+		return *this;
+	}
+	SplitLeafIteratorBase& operator-=(difference_type n) {
+		_index -= n;
+		return *this;
+	}
+	
+	friend SplitLeafIteratorBase operator+(
+			SplitLeafIteratorBase it,
+			difference_type n) {
+		return it += n;
+	}
+	friend SplitLeafIteratorBase operator+(
+			difference_type n,
+			SplitLeafIteratorBase it) {
+		return it += n;
+	}
+	friend SplitLeafIteratorBase operator-(
+			SplitLeafIteratorBase it,
+			difference_type n) {
+		return it -= n;
+	}
+	friend difference_type operator-(
+			SplitLeafIteratorBase lhs,
+			SplitLeafIteratorBase rhs) {
+		return lhs._index - rhs._index;
+	}
+	
+	friend bool operator==(
+			SplitLeafIteratorBase lhs,
+			SplitLeafIteratorBase rhs) {
+		return lhs._index == rhs._index;
+	}
+	friend bool operator!=(
+			SplitLeafIteratorBase lhs,
+			SplitLeafIteratorBase rhs) {
+		return lhs._index != rhs._index;
+	}
+	friend bool operator<(SplitLeafIteratorBase lhs, SplitLeafIteratorBase rhs) {
+		return lhs._index < rhs._index;
+	}
+	friend bool operator<=(
+			SplitLeafIteratorBase lhs,
+			SplitLeafIteratorBase rhs) {
+		return lhs._index <= rhs._index;
+	}
+	friend bool operator>(SplitLeafIteratorBase lhs, SplitLeafIteratorBase rhs) {
+		return lhs._index > rhs._index;
+	}
+	friend bool operator>=(
+			SplitLeafIteratorBase lhs,
+			SplitLeafIteratorBase rhs) {
+		return lhs._index >= rhs._index;
+	}
+	
+};
+
+/**
+ * \brief A list of leafs that stores each coordinate of the leaf positions in
+ * its own array, and the leaf values in another array.
+ * 
+ * This class provides the parts of the `std::vector` interface that Orthtree
+ * uses for its leaf list, with `Element` (a type with `position` and `value`
+ * members) as the value type. Elements are accessed through proxy references.
+ * The arrays themselves can be accessed with SplitLeafList::coordinates and
+ * SplitLeafList::values, which is useful for code that only needs to look at
+ * one or two coordinates of many leafs at once.
+ * 
+ * \tparam Details the Orthtree details, whose `VectorType` is used to store
+ * each of the arrays
+ */
+template<
+	std::size_t Dim,
+	typename Scalar,
+	typename Vector,
+	typename Value,
+	typename Element,
+	typename Details>
+class SplitLeafList final {
+	
+private:
+	
+	template<typename, bool>
+	friend class SplitLeafReferenceBase;
+	
+	using CoordinateList = typename Details::template VectorType<Scalar>;
+	using ValueList = typename Details::template VectorType<Value>;
+	
+	using PositionType = Vector;
+	using ValueType = Value;
+	
+	static constexpr std::size_t Dimension = Dim;
+	
+	std::array<CoordinateList, Dim> _coordinates;
+	ValueList _values;
+	
+	Vector position(std::size_t index) const {
+		Vector result;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			result[dim] = _coordinates[dim][index];
+		}
+		return result;
+	}
+	
+	void assign(
+			std::size_t index,
+			Vector const& position,
+			Value const& value) {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			_coordinates[dim][index] = position[dim];
+		}
+		_values[index] = value;
+	}
+	
+	// Inserts elements from another SplitLeafList one array at a time.
+	void insertRange(
+			std::size_t index,
+			SplitLeafIteratorBase<SplitLeafList, true> first,
+			SplitLeafIteratorBase<SplitLeafList, true> last,
+			std::true_type) {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			CoordinateList const& source = first._list->_coordinates[dim];
+			_coordinates[dim].insert(
+				_coordinates[dim].begin() + index,
+				source.begin() + first._index,
+				source.begin() + last._index);
+		}
+		_values.insert(
+			_values.begin() + index,
+			first._list->_values.begin() + first._index,
+			first._list->_values.begin() + last._index);
+	}
+	// Inserts elements from any other range by appending them to the end of
+	// each array, and then rotating them into place. The values are moved if
+	// the iterator gives rvalues.
+	template<typename InputIt>
+	void insertRange(
+			std::size_t index,
+			InputIt first,
+			InputIt last,
+			std::false_type) {
+		std::size_t oldSize = size();
+		for (; first != last; ++first) {
+			auto&& element = *first;
+			for (std::size_t dim = 0; dim < Dim; ++dim) {
+				_coordinates[dim].push_back(element.position[dim]);
+			}
+			_values.push_back(std::forward<decltype(element)>(element).value);
+		}
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			std::rotate(
+				_coordinates[dim].begin() + index,
+				_coordinates[dim].begin() + oldSize,
+				_coordinates[dim].end());
+		}
+		std::rotate(
+			_values.begin() + index,
+			_values.begin() + oldSize,
+			_values.end());
+	}
+	
+public:
+	
+	// Container typedefs.
+	using value_type = Element;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using reference = SplitLeafReferenceBase<SplitLeafList, false>;
+	using const_reference = SplitLeafReferenceBase<SplitLeafList, true>;
+	using iterator = SplitLeafIteratorBase<SplitLeafList, false>;
+	using const_iterator = SplitLeafIteratorBase<SplitLeafList, true>;
+	
+	SplitLeafList() = default;
+	SplitLeafList(size_type count, value_type const& element) :
+			_values(count, element.value) {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			_coordinates[dim].assign(count, element.position[dim]);
+		}
+	}
+	
+	// Container iteration range methods.
+	iterator begin() {
+		return iterator(this, 0);
+	}
+	const_iterator begin() const {
+		return const_iterator(this, 0);
+	}
+	const_iterator cbegin() const {
+		return const_iterator(this, 0);
+	}
+	
+	iterator end() {
+		return iterator(this, size());
+	}
+	const_iterator end() const {
+		return const_iterator(this, size());
+	}
+	const_iterator cend() const {
+		return const_iterator(this, size());
+	}
+	
+	// Element access methods.
+	reference operator[](size_type index) {
+		return reference(this, index);
+	}
+	const_reference operator[](size_type index) const {
+		return const_reference(this, index);
+	}
+	reference front() {
+		return reference(this, 0);
+	}
+	const_reference front() const {
+		return const_reference(this, 0);
+	}
+	
+	/**
+	 * \brief Changes the position of an element without changing its value.
+	 */
+	void setPosition(size_type index, Vector const& position) {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			_coordinates[dim][index] = position[dim];
+		}
+	}
+	
+	/**
+	 * \brief Gives the contiguous array holding one coordinate of the position
+	 * of every leaf.
+	 */
+	Scalar const* coordinates(std::size_t dim) const {
+		return _coordinates[dim].data();
+	}
+	
+	/**
+	 * \brief Gives the contiguous array holding the value of every leaf.
+	 */
+	Value const* values() const {
+		return _values.data();
+	}
+	
+	// Container size methods.
+	size_type size() const {
+		return _values.size();
+	}
+	bool empty() const {
+		return _values.empty();
+	}
+	void reserve(size_type capacity) {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			_coordinates[dim].reserve(capacity);
+		}
+		_values.reserve(capacity);
+	}
+	
+	// Container modifier methods.
+	void clear() {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			_coordinates[dim].clear();
+		}
+		_values.clear();
+	}
+	void push_back(value_type const& element) {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			_coordinates[dim].push_back(element.position[dim]);
+		}
+		_values.push_back(element.value);
+	}
+	iterator insert(const_iterator pos, value_type const& element) {
+		return insert(pos, 1, element);
+	}
+	iterator insert(
+			const_iterator pos,
+			size_type count,
+			value_type const& element) {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			_coordinates[dim].insert(
+				_coordinates[dim].begin() + pos._index,
+				count,
+				element.position[dim]);
+		}
+		_values.insert(_values.begin() + pos._index, count, element.value);
+		return iterator(this, pos._index);
+	}
+	template<typename InputIt>
+	iterator insert(const_iterator pos, InputIt first, InputIt last) {
+		insertRange(
+			pos._index,
+			first,
+			last,
+			std::is_convertible<InputIt, const_iterator>());
+		return iterator(this, pos._index);
+	}
+	iterator erase(const_iterator pos) {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			_coordinates[dim].erase(_coordinates[dim].begin() + pos._index);
+		}
+		_values.erase(_values.begin() + pos._index);
+		return iterator(this, pos._index);
+	}
+	iterator erase(const_iterator first, const_iterator last) {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			_coordinates[dim].erase(
+				_coordinates[dim].begin() + first._index,
+				_coordinates[dim].begin() + last._index);
+		}
+		_values.erase(
+			_values.begin() + first._index,
+			_values.begin() + last._index);
+		return iterator(this, first._index);
+	}
+	void swap(SplitLeafList& other) {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			_coordinates[dim].swap(other._coordinates[dim]);
+		}
+		_values.swap(other._values);
+	}
+	
+};
+
+}
+}
+
+#endif
+
@@ -5,7 +5,11 @@
 #include <array>
 #include <climits>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -13,8 +17,14 @@
 
 #include "orthtree_internal_details_default.h"
 
+#include "internal/arena.h"
 #include "internal/functional.h"
+#include "internal/node_geometry.h"
+#include "internal/parallel.h"
+#include "internal/radix_sort.h"
 #include "internal/repeat_range.h"
+#include "internal/simd.h"
+#include "internal/split_leaf_list.h"
 #include "internal/type_traits.h"
 
 namespace glade {
@@ -66,6 +76,10 @@ public:
 	static_assert(
 		Dim > 0,
 		"template parameter Dim must be larger than 0");
+	static_assert(
+		(std::uintmax_t(1) << Dim) - 1 <=
+			std::numeric_limits<typename Details::DepthType>::max(),
+		"Details::DepthType must be able to hold the index of every child");
 	
 	static_assert(
 		std::is_default_constructible<NodeValue>::value,
@@ -238,10 +252,21 @@ public:
 	using ConstNodeRange = NodeRangeBase<true>;
 	///@}
 	
+	class NodeHandle;
+	
 	struct LeafInternal;
 	struct NodeInternal;
 	
-	using LeafList = typename Details::template VectorType<LeafInternal>;
+	using LeafList = std::conditional_t<
+		Details::SplitLeafs,
+		internal::SplitLeafList<
+			Dim,
+			Scalar,
+			Vector,
+			LeafValue,
+			LeafInternal,
+			Details>,
+		typename Details::template VectorType<LeafInternal> >;
 	using NodeList = typename Details::template VectorType<NodeInternal>;
 	using LeafListSizeType = typename Details::template SizeType<LeafInternal>;
 	using NodeListSizeType = typename Details::template SizeType<NodeInternal>;
@@ -249,6 +274,7 @@ public:
 		typename Details::template DifferenceType<LeafInternal>;
 	using NodeListDifferenceType =
 		typename Details::template DifferenceType<NodeInternal>;
+	using DepthType = typename Details::DepthType;
 	
 	/**
 	 * \brief Packages together a position with leaf data.
@@ -264,7 +290,7 @@ public:
 		
 		LeafInternal(Vector position, LeafValue value = LeafValue()) :
 				position(position),
-				value(value) {
+				value(std::move(value)) {
 		}
 		
 	};
@@ -276,26 +302,31 @@ public:
 	 * normally. Use Orthtree::NodeIterator%s instead. It is exposed for cases
 	 * in which direct access to the memory of the Orthtree is necessary.
 	 */
-	struct NodeInternal final {
+	struct NodeInternal final : public internal::NodeGeometry<
+			Dim,
+			Vector,
+			Details::ImplicitGeometry> {
 		
-		// The section of space that this node encompasses.
-		Vector position;
-		Vector dimensions;
+		// The section of space that this node encompasses is stored in the
+		// base class, either directly or as a cell.
+		using Geometry = internal::NodeGeometry<
+			Dim,
+			Vector,
+			Details::ImplicitGeometry>;
 		
-		// The depth of this node within the orthtree (0 for root, and so on).
-		NodeListSizeType depth;
+		// The number of entries in `childIndices`. Compact nodes only store the
+		// last one.
+		static constexpr std::size_t ChildIndexCount =
+			Details::CompactNodes ? 1 : (1 << Dim) + 1;
 		
 		// The indices of the children of this node, stored relative to the
 		// index of this node. The last entry points to the next sibling of this
 		// node, and is used to determine the total size of all of this node's
 		// children.
-		NodeListSizeType childIndices[(1 << Dim) + 1];
+		NodeListSizeType childIndices[ChildIndexCount];
 		
 		// The relative index of the parent of this node.
 		NodeListDifferenceType parentIndex;
-		// Which child # of its parent this node is. (0th child, 1st child,
-		// etc).
-		NodeListSizeType siblingIndex;
 		
 		// The number of leaves that this node contains. This includes leaves
 		// stored by all descendants of this node.
@@ -304,8 +335,20 @@ public:
 		// are located at.
 		LeafListSizeType leafIndex;
 		
+		// The depth of this node within the orthtree (0 for root, and so on).
+		// This is stored next to the other small members, so that no space is
+		// lost to padding when DepthType is narrow.
+		DepthType depth;
+		// Which child # of its parent this node is. (0th child, 1st child,
+		// etc).
+		DepthType siblingIndex;
+		
 		// Whether this node has any children.
 		bool hasChildren;
+		// Whether the leafs or children of this node have changed since its
+		// value was last filled in by Orthtree::reduce. If a node has changed,
+		// then so have all of its ancestors.
+		bool changed;
 		
 		// The data stored at the node itself.
 		NodeValue value;
@@ -315,17 +358,17 @@ public:
 				Vector position,
 				Vector dimensions,
 				NodeValue value = NodeValue()) :
-				position(position),
-				dimensions(dimensions),
-				depth(0),
+				Geometry(position, dimensions),
 				childIndices(),
 				parentIndex(),
-				siblingIndex(),
 				leafCount(0),
 				leafIndex(0),
+				depth(0),
+				siblingIndex(),
 				hasChildren(false),
-				value(value) {
-			std::fill(childIndices, childIndices + (1 << Dim) + 1, 1);
+				changed(true),
+				value(std::move(value)) {
+			std::fill(childIndices, childIndices + ChildIndexCount, 1);
 		}
 		
 	};
@@ -338,9 +381,19 @@ private:
 	// A list storing all of the nodes of the orthtree.
 	NodeList _nodes;
 	
+	// The section of space that the whole orthtree encompasses.
+	Vector _position;
+	Vector _dimensions;
+	
 	// The number of leaves to store at a single node of the orthtree.
 	LeafListSizeType _nodeCapacity;
 	
+	// The number of leaves that a node with children must drop to before its
+	// children are merged back into it. This is at most the node capacity, and
+	// the gap between the two keeps a node that holds about as many leafs as
+	// the node capacity from being split and merged over and over.
+	LeafListSizeType _mergeCapacity;
+	
 	// The maximum depth of the orthtree.
 	NodeListSizeType _maxDepth;
 	
@@ -350,6 +403,46 @@ private:
 	// be called to force an adjustment.
 	bool _autoAdjust;
 	
+	// Whether the leaf list is allowed to contain gaps. See
+	// OrthtreeInternalDetailsDefault::LeafGapSize.
+	static constexpr bool LeafGaps = Details::LeafGapSize != 0;
+	
+	// One flag for each entry in the leaf list which marks whether that entry
+	// is a gap. This list is left empty if gaps aren't allowed.
+	typename Details::template VectorType<bool> _leafGaps;
+	
+	// Whether leafs may be outside of their nodes by a small margin. See
+	// OrthtreeInternalDetailsDefault::Looseness.
+	static constexpr bool Loose = Details::Looseness != 0;
+	
+	// Memory for temporary buffers, which is kept between operations so that
+	// it can be reused. It is only used if Details::ScratchArena is true. The
+	// node list is where `adjust` builds the new layout of part of the
+	// orthtree, and is always left empty.
+	internal::MonotonicArena _scratch;
+	NodeList _scratchNodes;
+	
+	// A list that only lives as long as the operation that created it. Its
+	// memory is taken from `_scratch`.
+	template<typename T>
+	using ScratchVector = std::vector<T, internal::ArenaAllocator<T> >;
+	
+	template<typename T>
+	internal::ArenaAllocator<T> scratchAllocator() {
+		return internal::ArenaAllocator<T>(
+			Details::ScratchArena ? &_scratch : nullptr);
+	}
+	
+	// Morton keys are used to sort the leafs when constructing an orthtree from
+	// a range of leafs. Each level of the orthtree takes up Dim bits of the key.
+	using MortonKey = std::uint64_t;
+	static constexpr std::size_t MortonLevels =
+		sizeof(MortonKey) * CHAR_BIT / Dim;
+	
+	// With implicit geometry, the cell of a node is stored with 32 bits along
+	// each dimension, which limits how deep the orthtree can go.
+	static constexpr std::size_t MaxCellDepth = sizeof(std::uint32_t) * CHAR_BIT;
+	
 	
 	
 	// Determines whether a node can store a certain number of additional (or
@@ -357,9 +450,60 @@ private:
 	bool canHoldLeafs(
 			ConstNodeIterator node,
 			LeafListDifferenceType n) const {
+		return canHoldLeafs(NodeHandle(this, node._index), n);
+	}
+	bool canHoldLeafs(NodeHandle node, LeafListDifferenceType n) const {
 		return
-			node->leafs.size() + n <= _nodeCapacity ||
-			node->depth >= _maxDepth;
+			node.leafCount() + n <= _nodeCapacity ||
+			node.depth() >= _maxDepth;
+	}
+	bool canHoldLeafs(NodeInternal const& node) const {
+		return node.leafCount <= _nodeCapacity || node.depth >= _maxDepth;
+	}
+	
+	// Determines whether the children of a node should be merged together once
+	// it stores a certain number of additional (or fewer) leafs.
+	bool canMergeLeafs(
+			ConstNodeIterator node,
+			LeafListDifferenceType n) const {
+		return canMergeLeafs(NodeHandle(this, node._index), n);
+	}
+	bool canMergeLeafs(NodeHandle node, LeafListDifferenceType n) const {
+		return node.leafCount() + n <= _mergeCapacity;
+	}
+	bool canMergeLeafs(NodeInternal const& node) const {
+		return node.leafCount <= _mergeCapacity;
+	}
+	
+	// The distance along a dimension that a leaf may be outside of its node in
+	// a loose orthtree.
+	Scalar looseMargin(std::size_t dim) const {
+		return static_cast<Scalar>(Details::Looseness) * _dimensions[dim];
+	}
+	
+	// Determines whether a point is inside of a node once the node has been
+	// enlarged by the loose margin.
+	bool containsLoosely(NodeInternal const& node, Vector const& point) const;
+	
+	// Throws `std::length_error` if the leaf or node list would grow to a size
+	// that can't be indexed with the size types from the Details. This is only
+	// checked if Details::CheckOverflow is true.
+	static void checkLeafListSize(std::size_t size) {
+		checkListSize<LeafListDifferenceType>(
+			size,
+			"Orthtree has too many leafs for Details::SizeType");
+	}
+	static void checkNodeListSize(std::size_t size) {
+		checkListSize<NodeListDifferenceType>(
+			size,
+			"Orthtree has too many nodes for Details::SizeType");
+	}
+	template<typename DifferenceType>
+	static void checkListSize(std::size_t size, char const* message) {
+		std::uintmax_t maxSize = std::numeric_limits<DifferenceType>::max();
+		if (Details::CheckOverflow && size > maxSize) {
+			throw std::length_error(message);
+		}
 	}
 	
 	// Divides a node into a set of subnodes and partitions its leaves between
@@ -396,6 +540,16 @@ private:
 	// Distributes the leafs of a node to its children.
 	void distributeLeafs(NodeIterator node);
 	
+	// Appends all of the descendants that a node without children needs, in
+	// depth-first order, so that none of them hold too many leafs. The node has
+	// to be the last one in the node list, which doesn't have to be the node
+	// list of the orthtree. The leafs of the node are sorted between its
+	// descendants using `buffer`. This is only used without gaps.
+	void splitNode(
+			NodeList& nodes,
+			NodeListSizeType nodeIndex,
+			ScratchVector<LeafInternal>& buffer);
+	
 	// Adds a leaf to a specific node.
 	LeafIterator insertAt(
 			NodeIterator node,
@@ -407,12 +561,583 @@ private:
 			NodeIterator node,
 			LeafIterator leaf);
 	
+	// Removes every marked leaf at once. The marks have one more entry than
+	// the leaf list, with a one at index `i + 1` if leaf `i` should be removed
+	// and a zero otherwise. They are replaced by their running sums.
+	void eraseMarked(ScratchVector<LeafListSizeType>& marks);
+	
+	// Works out which leafs in a range leave their nodes. A leaf that stays
+	// within its node only has its position changed. The others are marked as
+	// for `eraseMarked`, and are listed in order at their new positions, along
+	// with the nodes that they are leaving. Leafs that would be moved out of
+	// the orthtree stay where they are.
+	template<typename PositionIt>
+	void markMoves(
+			ConstNodeIterator hint,
+			LeafIterator leafBegin, LeafIterator leafEnd,
+			PositionIt positionBegin,
+			ScratchVector<LeafListSizeType>& marks,
+			ScratchVector<LeafInternal>& movedLeafs,
+			ScratchVector<NodeListSizeType>& nodeIndices);
+	
+	// Moves the leafs found by `markMoves` to their new nodes. They are all
+	// taken out of the leaf list in one pass and put back in at their new
+	// nodes in another, and then the orthtree is adjusted. The node indices
+	// are replaced by the new nodes of the leafs.
+	void moveMarked(
+			ScratchVector<LeafListSizeType>& marks,
+			ScratchVector<LeafInternal>& movedLeafs,
+			ScratchVector<NodeListSizeType>& nodeIndices);
+	
+	// Merges new leafs into the leaf list in a single pass. Each new leaf goes
+	// at the end of the node given by `nodeIndices`, which must not have
+	// children, and the new leafs of a node keep their relative order. The
+	// node indices are sorted along the way. This is only used without gaps,
+	// and doesn't adjust the orthtree.
+	void mergeLeafs(
+			ScratchVector<LeafInternal>& newLeafs,
+			ScratchVector<NodeListSizeType>& nodeIndices);
+	
 	// Moves a leaf from this node to another one.
 	LeafIterator moveAt(
 			NodeIterator sourceNode,
 			NodeIterator destNode,
 			LeafIterator sourceLeaf);
 	
+	// Adds to the leaf count of a node and all of its ancestors.
+	void updateLeafCounts(
+			NodeListSizeType nodeIndex,
+			LeafListDifferenceType change);
+	
+	// Determines which child of a node a point belongs to.
+	NodeListSizeType findChildIndex(
+			NodeInternal const& node,
+			Vector const& point) const;
+	
+	// Nodes with implicit geometry don't store their position and dimensions,
+	// so they have to be returned by value.
+	using GeometryReference = std::conditional_t<
+		Details::ImplicitGeometry,
+		Vector,
+		Vector const&>;
+	
+	// The section of space that a node encompasses. For implicit geometry,
+	// this is worked out from the cell of the node and the root geometry.
+	GeometryReference nodePosition(NodeInternal const& node) const {
+		return nodePosition(
+			node,
+			std::integral_constant<bool, Details::ImplicitGeometry>());
+	}
+	Vector const& nodePosition(
+			NodeInternal const& node,
+			std::false_type) const {
+		return node.position;
+	}
+	Vector nodePosition(NodeInternal const& node, std::true_type) const {
+		Scalar scale = cellScale(node.depth);
+		Vector result = _position;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			result[dim] = cellLower(dim, node.cell[dim], scale);
+		}
+		return result;
+	}
+	GeometryReference nodeDimensions(NodeInternal const& node) const {
+		return nodeDimensions(
+			node,
+			std::integral_constant<bool, Details::ImplicitGeometry>());
+	}
+	Vector const& nodeDimensions(
+			NodeInternal const& node,
+			std::false_type) const {
+		return node.dimensions;
+	}
+	Vector nodeDimensions(NodeInternal const& node, std::true_type) const {
+		Scalar scale = cellScale(node.depth);
+		Vector result = _dimensions;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			result[dim] = cellSize(dim, scale);
+		}
+		return result;
+	}
+	
+	// The size of a cell at a certain depth relative to the root, and the size
+	// and lower bound of a cell along one dimension. Everything that works
+	// with implicit geometry goes through these, so that the bounds of a node
+	// always come out exactly the same.
+	static Scalar cellScale(NodeListSizeType depth) {
+		return Scalar(1) / Scalar(std::uint64_t(1) << depth);
+	}
+	Scalar cellSize(std::size_t dim, Scalar scale) const {
+		return _dimensions[dim] * scale;
+	}
+	Scalar cellLower(
+			std::size_t dim,
+			std::uint32_t cell,
+			Scalar scale) const {
+		return _position[dim] + Scalar(cell) * cellSize(dim, scale);
+	}
+	
+	// Sets the section of space for the child of a node with a certain index.
+	static void setChildGeometry(
+			NodeInternal const& node,
+			std::size_t index,
+			NodeInternal& child) {
+		setChildGeometry(
+			node,
+			index,
+			child,
+			std::integral_constant<bool, Details::ImplicitGeometry>());
+	}
+	static void setChildGeometry(
+			NodeInternal const& node,
+			std::size_t index,
+			NodeInternal& child,
+			std::false_type) {
+		child.position = node.position;
+		child.dimensions = node.dimensions;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			child.dimensions[dim] = node.dimensions[dim] / 2;
+			if ((1 << dim) & index) {
+				child.position[dim] =
+					node.position[dim] + node.dimensions[dim] / 2;
+			}
+		}
+	}
+	static void setChildGeometry(
+			NodeInternal const& node,
+			std::size_t index,
+			NodeInternal& child,
+			std::true_type) {
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			child.cell[dim] = 2 * node.cell[dim] + (((1 << dim) & index) != 0);
+		}
+	}
+	
+	// The number of nodes in the subtree starting at a node, including the
+	// node itself. The node right after the subtree is the next sibling.
+	NodeListSizeType subtreeSize(NodeListSizeType nodeIndex) const {
+		return _nodes[nodeIndex].childIndices[
+			NodeInternal::ChildIndexCount - 1];
+	}
+	
+	// Finds the indices of all of the children of a node. For a node without
+	// children, each entry is the index of the next node. Compact nodes don't
+	// store the child indices, so they are found by skipping over the subtree
+	// of each child in turn. The last parameter is used to choose between the
+	// versions for normal and compact nodes.
+	void childIndices(
+			NodeListSizeType nodeIndex,
+			NodeListSizeType (&result)[1 << Dim]) const {
+		childIndices(
+			nodeIndex,
+			result,
+			std::integral_constant<bool, Details::CompactNodes>());
+	}
+	void childIndices(
+			NodeListSizeType nodeIndex,
+			NodeListSizeType (&result)[1 << Dim],
+			std::false_type) const {
+		NodeInternal const& node = _nodes[nodeIndex];
+		for (std::size_t index = 0; index < (1 << Dim); ++index) {
+			result[index] = nodeIndex + node.childIndices[index];
+		}
+	}
+	void childIndices(
+			NodeListSizeType nodeIndex,
+			NodeListSizeType (&result)[1 << Dim],
+			std::true_type) const {
+		bool hasChildren = _nodes[nodeIndex].hasChildren;
+		NodeListSizeType childIndex = nodeIndex + 1;
+		for (std::size_t index = 0; index < (1 << Dim); ++index) {
+			result[index] = childIndex;
+			if (hasChildren) {
+				childIndex += subtreeSize(childIndex);
+			}
+		}
+	}
+	
+	// Finds the index of a single child of a node, in the same way as
+	// childIndices.
+	NodeListSizeType childIndex(
+			NodeListSizeType nodeIndex,
+			std::size_t child) const {
+		return childIndex(
+			nodeIndex,
+			child,
+			std::integral_constant<bool, Details::CompactNodes>());
+	}
+	NodeListSizeType childIndex(
+			NodeListSizeType nodeIndex,
+			std::size_t child,
+			std::false_type) const {
+		return nodeIndex + _nodes[nodeIndex].childIndices[child];
+	}
+	NodeListSizeType childIndex(
+			NodeListSizeType nodeIndex,
+			std::size_t child,
+			std::true_type) const {
+		NodeListSizeType childIndex = nodeIndex + 1;
+		if (_nodes[nodeIndex].hasChildren) {
+			for (std::size_t index = 0; index < child; ++index) {
+				childIndex += subtreeSize(childIndex);
+			}
+		}
+		return childIndex;
+	}
+	
+	// Changes the relative index of a child that is stored in a node, either
+	// by setting it or by shifting it. Compact nodes don't store these, so
+	// nothing is done for them.
+	static void setChildOffset(
+			NodeInternal& node,
+			std::size_t child,
+			NodeListSizeType offset) {
+		setChildOffset(
+			node,
+			child,
+			offset,
+			std::integral_constant<bool, Details::CompactNodes>());
+	}
+	static void setChildOffset(
+			NodeInternal& node,
+			std::size_t child,
+			NodeListSizeType offset,
+			std::false_type) {
+		node.childIndices[child] = offset;
+	}
+	static void setChildOffset(
+			NodeInternal&,
+			std::size_t,
+			NodeListSizeType,
+			std::true_type) {
+	}
+	static void shiftChildOffset(
+			NodeInternal& node,
+			std::size_t child,
+			NodeListDifferenceType change) {
+		shiftChildOffset(
+			node,
+			child,
+			change,
+			std::integral_constant<bool, Details::CompactNodes>());
+	}
+	static void shiftChildOffset(
+			NodeInternal& node,
+			std::size_t child,
+			NodeListDifferenceType change,
+			std::false_type) {
+		node.childIndices[child] += change;
+	}
+	static void shiftChildOffset(
+			NodeInternal&,
+			std::size_t,
+			NodeListDifferenceType,
+			std::true_type) {
+	}
+	
+	// Returns the index just past the end of a node's section of the leaf list.
+	// This includes any gaps at the end of the section.
+	LeafListSizeType leafEndIndex(NodeListSizeType nodeIndex) const;
+	
+	// Marks a node and its ancestors as changed. Since the ancestors of a
+	// changed node are always marked too, this stops at the first ancestor
+	// that was already marked.
+	void markChanged(NodeListSizeType nodeIndex) {
+		_nodes[nodeIndex].changed = true;
+		while (nodeIndex != 0) {
+			nodeIndex += _nodes[nodeIndex].parentIndex;
+			if (_nodes[nodeIndex].changed) {
+				break;
+			}
+			_nodes[nodeIndex].changed = true;
+		}
+	}
+	
+	// Changes the position stored in an entry of the leaf list. The last
+	// parameter is used to choose between the versions for split and unsplit
+	// leaf lists.
+	void setLeafPosition(LeafListSizeType leafIndex, Vector const& position) {
+		setLeafPosition(
+			leafIndex,
+			position,
+			std::integral_constant<bool, Details::SplitLeafs>());
+	}
+	void setLeafPosition(
+			LeafListSizeType leafIndex,
+			Vector const& position,
+			std::false_type) {
+		_leafs[leafIndex].position = position;
+	}
+	void setLeafPosition(
+			LeafListSizeType leafIndex,
+			Vector const& position,
+			std::true_type) {
+		_leafs.setPosition(leafIndex, position);
+	}
+	
+	// Returns a mask with bit `i` set if the leaf at `leafIndex + i` lies
+	// inside of a box, for `count` leafs (at most `internal::MaskWidth`). When
+	// the leaf coordinates are stored in separate arrays, the test is done
+	// with the vectorized kernels.
+	std::uint64_t boxLeafMask(
+			LeafListSizeType leafIndex,
+			std::size_t count,
+			std::array<Scalar, Dim> const& lower,
+			std::array<Scalar, Dim> const& dimensions) const {
+		return boxLeafMask(
+			leafIndex,
+			count,
+			lower,
+			dimensions,
+			std::integral_constant<bool, Details::SplitLeafs>());
+	}
+	std::uint64_t boxLeafMask(
+			LeafListSizeType leafIndex,
+			std::size_t count,
+			std::array<Scalar, Dim> const& lower,
+			std::array<Scalar, Dim> const& dimensions,
+			std::false_type) const;
+	std::uint64_t boxLeafMask(
+			LeafListSizeType leafIndex,
+			std::size_t count,
+			std::array<Scalar, Dim> const& lower,
+			std::array<Scalar, Dim> const& dimensions,
+			std::true_type) const;
+	
+	// Same as boxLeafMask, but for a ball.
+	std::uint64_t ballLeafMask(
+			LeafListSizeType leafIndex,
+			std::size_t count,
+			std::array<Scalar, Dim> const& center,
+			Scalar radiusSquared) const {
+		return ballLeafMask(
+			leafIndex,
+			count,
+			center,
+			radiusSquared,
+			std::integral_constant<bool, Details::SplitLeafs>());
+	}
+	std::uint64_t ballLeafMask(
+			LeafListSizeType leafIndex,
+			std::size_t count,
+			std::array<Scalar, Dim> const& center,
+			Scalar radiusSquared,
+			std::false_type) const;
+	std::uint64_t ballLeafMask(
+			LeafListSizeType leafIndex,
+			std::size_t count,
+			std::array<Scalar, Dim> const& center,
+			Scalar radiusSquared,
+			std::true_type) const;
+	
+	// Finds the closest entry in the leaf list at or after (or at or before) an
+	// index that is not a gap.
+	LeafListDifferenceType nextLeafIndex(LeafListDifferenceType index) const;
+	LeafListDifferenceType prevLeafIndex(LeafListDifferenceType index) const;
+	
+	// Counts the number of leafs (not including gaps) between two indices in the
+	// leaf list. The result is negative if the upper index is below the lower.
+	LeafListDifferenceType leafDistance(
+			LeafListDifferenceType lowerIndex,
+			LeafListDifferenceType upperIndex) const;
+	
+	// Counts the leafs (not including gaps) that come before an index in the
+	// leaf list, and finds the index of the leaf with a certain count before
+	// it. Both walk down from the root using the leaf counts of the nodes, so
+	// they take time proportional to the depth of the orthtree instead of the
+	// length of the leaf list. An index of -1 has a count of -1, and a count
+	// past the last leaf gives the size of the leaf list.
+	LeafListDifferenceType leafRank(LeafListDifferenceType index) const;
+	LeafListDifferenceType leafAtRank(LeafListDifferenceType rank) const;
+	
+	// Rebuilds the leaf list so that every node without children that holds
+	// leafs is followed by a certain number of gaps. Empty nodes are left without
+	// gaps (so that iterating over the leafs doesn't have to skip past them),
+	// except for the node at `nodeIndex`.
+	void spreadLeafs(LeafListSizeType gapSize, NodeListSizeType nodeIndex = 0);
+	
+	// Makes room for one more leaf at the end of a node without children, either
+	// by taking a gap from a nearby node or by spreading out the leaf list.
+	void growLeafs(NodeListSizeType nodeIndex);
+	
+	// The Morton (Z-order) key of a point within a node. The child index that
+	// the point would belong to at each level below the node is stored in the
+	// key, with the highest level in the highest bits. Only the first few
+	// levels are included.
+	MortonKey mortonKey(
+			Vector const& point,
+			NodeInternal const& node,
+			NodeListSizeType levels) const;
+	MortonKey mortonKey(
+			Vector const& point,
+			NodeInternal const& node,
+			NodeListSizeType levels,
+			std::false_type) const;
+	MortonKey mortonKey(
+			Vector const& point,
+			NodeInternal const& node,
+			NodeListSizeType levels,
+			std::true_type) const;
+	
+	// Puts a section of the leaf list starting at `leafIndex` in a new order,
+	// where `order[index]` is the position within the section of the leaf that
+	// goes at `index`. The leafs are moved in place, and `order` is left as
+	// the identity.
+	void permuteLeafs(
+			LeafListSizeType leafIndex,
+			ScratchVector<LeafListSizeType>& order);
+	
+	// Creates all of the descendants of the last node in a node list, given
+	// that the leafs have been sorted by their Morton keys. The keys hold the
+	// levels of the orthtree down to the depth `levels`. The descendants are
+	// appended to the node list in depth-first order. Nodes at `depthLimit` are
+	// not given children. This function only reads from the orthtree, so it can
+	// be called from multiple threads at once.
+	void buildChildren(
+			NodeList& nodes,
+			NodeListSizeType nodeIndex,
+			ScratchVector<MortonKey> const& keys,
+			NodeListSizeType levels,
+			NodeListSizeType depthLimit) const;
+	
+	// How much of a node lies inside of a region of space.
+	enum class Overlap {
+		Outside,
+		Partial,
+		Inside
+	};
+	
+	// Calls `visit(lowerIndex, upperIndex, size)` for each section of the leaf
+	// list that holds leafs inside of a region. The sections are visited in
+	// order, and are as large as possible. The region is described by a
+	// function that returns the Overlap of a node with the region, and a
+	// function `contains(leafIndex, count)` that returns a mask of which of
+	// `count` leafs (at most `internal::MaskWidth`) are inside of the region.
+	template<typename OverlapF, typename ContainsF, typename F>
+	void queryIndices(
+			OverlapF overlap,
+			ContainsF contains,
+			F visit) const;
+	
+	// Same as queryIndices, but for a box.
+	template<typename F>
+	void queryBoxIndices(
+			Vector const& position,
+			Vector const& dimensions,
+			F visit) const;
+	
+	// Same as queryIndices, but for a ball.
+	template<typename F>
+	void queryBallIndices(
+			Vector const& point,
+			Scalar radius,
+			F visit) const;
+	
+	// Calls `visit(leafIndex, otherLeafIndex)` for every pair of leafs within a
+	// certain distance of each other, with one leaf from each of two nodes. The
+	// two nodes must either be the same, or neither may contain the other.
+	template<typename F>
+	void pairIndicesWithin(
+			NodeListSizeType nodeIndex,
+			NodeListSizeType otherNodeIndex,
+			Scalar radiusSquared,
+			F& visit) const;
+	
+	// Visits a pair of nodes, one from each orthtree, in a dual-tree
+	// traversal. The pair must not have been pruned. See Orthtree::dualTree.
+	template<typename Rule>
+	void dualTreeIndices(
+			Orthtree const& other,
+			NodeListSizeType nodeIndex,
+			NodeListSizeType otherNodeIndex,
+			Rule& rule) const;
+	
+	// Calls `visit(leafIndex, result)` with the result of a Barnes-Hut
+	// evaluation for every leaf. See Orthtree::barnesHut.
+	template<typename Kernel, typename Criterion, typename F>
+	void barnesHutIndices(
+			Kernel const& kernel,
+			Criterion const& criterion,
+			F& visit,
+			std::size_t threadCount) const;
+	
+	// Adds the leafs of a node (and its descendants) that are closer to a point
+	// than the current `k` nearest leafs to a max-heap of squared distances and
+	// leaf indices.
+	void nearestIndices(
+			NodeListSizeType nodeIndex,
+			Vector const& point,
+			LeafListSizeType k,
+			std::vector<std::pair<Scalar, LeafListSizeType> >& heap) const;
+	
+	// A ray that is being traced through the orthtree. The axes along which the
+	// ray points in the negative direction are flipped (`mask`), so that the
+	// children of a node are crossed in increasing order of their flipped
+	// index. An axis that the ray is parallel to has an infinite inverse
+	// direction.
+	struct Ray {
+		Vector origin;
+		Vector inverseDirection;
+		std::size_t mask;
+		Scalar tMax;
+	};
+	
+	// Calls `visit(nodeIndex, tEnter, tExit)` for each node without children
+	// that holds leafs and is crossed by the ray `origin + t * direction` for
+	// `0 <= t <= tMax`. The nodes are visited in increasing order of `tEnter`,
+	// except that in a loose orthtree, where the nodes are enlarged by the
+	// loose margin and overlap, only siblings are in order. If `visit` returns
+	// false, then the traversal is stopped and false is returned.
+	template<typename F>
+	bool traceRayIndices(
+			Vector const& origin,
+			Vector const& direction,
+			Scalar tMax,
+			F visit) const;
+	
+	// Same as traceRayIndices, but starting from a node. The `tEnter` and
+	// `tExit` arrays hold the values of `t` at which the ray crosses the near
+	// and far faces of the node along each (flipped) axis.
+	template<typename F>
+	bool traceRayIndices(
+			NodeListSizeType nodeIndex,
+			Ray const& ray,
+			std::array<Scalar, Dim> const& tEnter,
+			std::array<Scalar, Dim> const& tExit,
+			F& visit) const;
+	
+	// Finds the squared distance from a point to the closest point of a node.
+	Scalar distanceSquared(NodeInternal const& node, Vector const& point) const;
+	// Finds the squared distance from a point to the furthest point of a node.
+	Scalar maxDistanceSquared(
+			NodeInternal const& node,
+			Vector const& point) const;
+	// Finds the squared distance between the closest points of two nodes.
+	Scalar distanceSquared(
+			NodeInternal const& node,
+			NodeInternal const& other) const;
+	
+	// Builds the nodes from scratch for the leafs in the leaf list, which must
+	// not have gaps. The node list must only hold an empty root node.
+	void build(std::size_t threadCount);
+	
+	// Finishes building the nodes below `depthLimit` after buildChildren was
+	// stopped there. Each of the subtrees is built in parallel in its own node
+	// list, and then they are all spliced into the main node list.
+	void buildSubtrees(
+			ScratchVector<MortonKey> const& keys,
+			NodeListSizeType levels,
+			NodeListSizeType depthLimit,
+			std::size_t threadCount);
+	
+	// Fills in the value of a single node, assuming that its children already
+	// have their values. See Orthtree::reduce.
+	template<typename LeafMap, typename Combine>
+	void reduceNode(
+			NodeListSizeType nodeIndex,
+			LeafMap& leafMap,
+			Combine& combine);
+	
 public:
 	
 	///@{
@@ -429,9 +1154,12 @@ public:
 	 * \positionEnd the end of a range of positions to insert at
 	 * \param nodeCapacity { the number of leaves that can be stored at
 	 * one node }
-	 * \param maxDepth the maximum number of generations of nodes
+	 * \param maxDepth { the maximum number of generations of nodes (at most
+	 * 32 with OrthtreeInternalDetailsDefault::ImplicitGeometry) }
 	 * \param adjust { whether the Orthtree should automatically create and
 	 * destroy nodes to optimize the number of leaves per node }
+	 * \param threadCount { the number of threads to use when constructing the
+	 * Orthtree from a range of leafs }
 	 */
 	Orthtree(
 		Vector position,
@@ -450,7 +1178,8 @@ public:
 		PositionIt positionEnd,
 		LeafListSizeType nodeCapacity = 1,
 		NodeListSizeType maxDepth = sizeof(Scalar) * CHAR_BIT,
-		bool autoAdjust = true);
+		bool autoAdjust = true,
+		std::size_t threadCount = 1);
 	///@}
 	
 	LeafListSizeType nodeCapacity() const {
@@ -466,6 +1195,26 @@ public:
 		_autoAdjust = autoAdjust;
 	}
 	
+	///@{
+	/**
+	 * \brief The number of leaves that a node must hold at most before its
+	 * children are merged back into it.
+	 * 
+	 * This starts out the same as the node capacity, so that nodes are merged
+	 * as soon as they could hold all of their leafs. Setting it lower means
+	 * that a node which is split when it grows past the node capacity isn't
+	 * merged again until it has lost a few leafs, so that inserting and
+	 * erasing leafs right at the node capacity doesn't create and destroy the
+	 * same children every time. It is clamped to the node capacity.
+	 */
+	LeafListSizeType mergeCapacity() const {
+		return _mergeCapacity;
+	}
+	void mergeCapacity(LeafListSizeType mergeCapacity) {
+		_mergeCapacity = std::min(mergeCapacity, _nodeCapacity);
+	}
+	///@}
+	
 	/**
 	 * \brief Reserves approximately the amount of space needed for a certain
 	 * number of leaves.
@@ -475,6 +1224,9 @@ public:
 		// distributed particles in an octree with node capacity of 1.
 		double nodesCount = (3.8 * count + 400) * (1 << Dim) / 8.0;
 		_leafs.reserve(count);
+		if (LeafGaps) {
+			_leafGaps.reserve(count);
+		}
 		// Add a factor of two for padding. This should handle the majority of
 		// distributions.
 		_nodes.reserve(static_cast<NodeListSizeType>(2.0 * nodesCount));
@@ -522,7 +1274,8 @@ public:
 	 * at each node.
 	 * 
 	 * This method will check for nodes that contain more than the maximum
-	 * number of leaves, as well as for unnecessary nodes. The node structure
+	 * number of leaves, as well as for nodes with children that hold no more
+	 * leaves than the merge capacity. The node structure
 	 * of the Orthtree will be adjusted so that these situations are resolved.
 	 * 
 	 * If the Orthtree was constructed to automatically adjust itself, then this
@@ -540,6 +1293,53 @@ public:
 	}
 	///@}
 	
+	/**
+	 * \brief Fills in the value of every node from the leafs and nodes below
+	 * it, such as the total mass and centre of mass of each node.
+	 * 
+	 * Starting from a default constructed NodeValue, the value of a node
+	 * without children is built up from each of its leafs in turn as
+	 * `value = combine(value, leafMap(leaf))`, where `leaf` is a constant
+	 * reference to the leaf. The value of a node with children is built up
+	 * from the values of each of its children in the same way, as
+	 * `value = combine(value, childValue)`. Since the children of a node come
+	 * after it in the node list, every node is filled in with a single pass
+	 * through the node list from back to front.
+	 * 
+	 * With more than one thread, the pass is split up between subtrees that
+	 * don't overlap, and then the nodes above them are filled in at the end.
+	 * In that case, `leafMap` and `combine` are called from several threads
+	 * at once.
+	 * 
+	 * \param leafMap turns a leaf into a NodeValue
+	 * \param combine merges two NodeValue%s together
+	 * \param threadCount the number of threads to use
+	 */
+	template<typename LeafMap, typename Combine>
+	void reduce(
+		LeafMap leafMap,
+		Combine combine,
+		std::size_t threadCount = 1);
+	
+	/**
+	 * \brief Fills in the values of only those nodes whose leafs or children
+	 * have changed since the last call to reduce or reduceChanged.
+	 * 
+	 * This gives the same result as Orthtree::reduce, as long as `leafMap` and
+	 * `combine` are the same as before. Inserting, erasing, and moving leafs,
+	 * as well as creating and destroying nodes, all mark the nodes involved
+	 * and their ancestors as changed. Only the changed nodes are visited, so
+	 * when a few leafs have changed, this takes time proportional to the
+	 * number of changed nodes instead of to the size of the Orthtree.
+	 * 
+	 * Changes made to a leaf directly through a LeafIterator aren't noticed.
+	 * 
+	 * \param leafMap turns a leaf into a NodeValue
+	 * \param combine merges two NodeValue%s together
+	 */
+	template<typename LeafMap, typename Combine>
+	void reduceChanged(LeafMap leafMap, Combine combine);
+	
 	///@{
 	/**
 	 * \brief Adds a new leaf to the Orthtree.
@@ -620,6 +1420,11 @@ public:
 	 * If the optional `hint` parameter is provided, then this method will begin
 	 * its search for the node to insert the leaf at the `hint` node.
 	 * 
+	 * The leafs are all merged into the Orthtree at once, so this is much
+	 * faster than inserting them one at a time. The Orthtree is adjusted
+	 * afterwards if it adjusts itself automatically. Leafs that lie outside of
+	 * the Orthtree are not inserted.
+	 * 
 	 * NodeIterator%s and LeafIterator%s may be invalidated.
 	 * 
 	 * \param hint a starting guess as to where the leafs should be placed
@@ -676,8 +1481,9 @@ public:
 			LeafTupleIt leafPairBegin, LeafTupleIt leafPairEnd) {
 		using LeafTuple = decltype(*leafPairBegin);
 		LeafListSizeType size = std::distance(leafPairBegin, leafPairEnd);
-		std::vector<LeafValue> leafValues;
-		std::vector<Vector> positions;
+		internal::ArenaScope scope(_scratch);
+		ScratchVector<LeafValue> leafValues(scratchAllocator<LeafValue>());
+		ScratchVector<Vector> positions(scratchAllocator<Vector>());
 		leafValues.reserve(size);
 		positions.reserve(size);
 		std::transform(
@@ -729,12 +1535,13 @@ public:
 	/**
 	 * \brief Removes a range of leafs from the Orthtree.
 	 * 
-	 * If the optional `hint` parameter is provided, then this method will begin
-	 * its search for the node to remove the leaf from at the `hint` node.
+	 * The leafs are all removed at once, and the Orthtree is adjusted
+	 * afterwards if it adjusts itself automatically. The leafs are given
+	 * directly, so there are no nodes to search for, and the overload that
+	 * takes a node ignores it. That overload is only kept for compatibility.
 	 * 
 	 * NodeIterator%s and LeafIterator%s may be invalidated.
 	 * 
-	 * \param hint a starting guess as to where the leafs should be removed from
 	 * \param leafBegin the start of a range of leafs to be removed
 	 * \param leafEnd the end of a range of leafs to be removed
 	 */
@@ -747,6 +1554,37 @@ public:
 	}
 	///@}
 	
+	/**
+	 * \brief Removes every leaf in a list of leafs from the Orthtree.
+	 * 
+	 * The leafs are all removed at once, and the Orthtree is adjusted
+	 * afterwards if it adjusts itself automatically. The same leaf may appear
+	 * more than once in the list.
+	 * 
+	 * NodeIterator%s and LeafIterator%s may be invalidated.
+	 * 
+	 * \param leafItBegin the start of a range of LeafIterator%s
+	 * \param leafItEnd the end of a range of LeafIterator%s
+	 */
+	template<typename LeafItIt>
+	void eraseEach(LeafItIt leafItBegin, LeafItIt leafItEnd);
+	
+	/**
+	 * \brief Removes every leaf that satisfies a predicate from the Orthtree.
+	 * 
+	 * The predicate is called once for each leaf, with a constant reference to
+	 * the leaf. The leafs are all removed at once, and the Orthtree is
+	 * adjusted afterwards if it adjusts itself automatically.
+	 * 
+	 * NodeIterator%s and LeafIterator%s may be invalidated.
+	 * 
+	 * \param predicate returns true for the leafs that should be removed
+	 * 
+	 * \return the number of leafs that were removed
+	 */
+	template<typename Predicate>
+	LeafListSizeType eraseIf(Predicate predicate);
+	
 	///@{
 	/**
 	 * \brief Changes the position of a leaf within the Orthtree.
@@ -782,6 +1620,10 @@ public:
 	 * If the optional `hint` parameter is provided, then this method will begin
 	 * its search for the node to move the leaf from at the `hint` node.
 	 * 
+	 * The leafs that leave their nodes are all taken out of the leaf list and
+	 * put back in at their new nodes in a single pass, and the Orthtree is
+	 * adjusted once at the end.
+	 * 
 	 * NodeIterator%s and LeafIterator%s may be invalidated.
 	 * 
 	 * \param hint a starting guess as to where the leaf should be moveds from
@@ -804,6 +1646,68 @@ public:
 	}
 	///@}
 	
+	/**
+	 * \brief Moves every leaf in the Orthtree to a new position at once.
+	 * 
+	 * This is meant for simulations in which all of the leafs move a little
+	 * bit each step. The positions are given in the same order as the leafs
+	 * are iterated over by Orthtree::leafs(). Leafs that stay within their
+	 * node don't move within the leaf list, and the rest are sorted into their
+	 * new nodes in a single pass, so the whole step takes linear time. The
+	 * Orthtree is adjusted once at the end. Leafs that would be moved out of
+	 * the Orthtree stay where they are.
+	 * 
+	 * NodeIterator%s and LeafIterator%s may be invalidated.
+	 * 
+	 * \param positionBegin the start of a range of positions to move to
+	 * \param positionEnd the end of a range of positions to move to
+	 */
+	template<typename PositionIt>
+	void rebin(PositionIt positionBegin, PositionIt positionEnd) {
+		move(
+			root(),
+			leafs().begin(), leafs().end(),
+			positionBegin, positionEnd);
+	}
+	
+	/**
+	 * \brief Information about a call to Orthtree::update.
+	 */
+	struct UpdateStats {
+		/// The number of leafs in the Orthtree.
+		LeafListSizeType leafCount;
+		/// The number of leafs that changed node.
+		LeafListSizeType movedCount;
+		/// Whether the Orthtree was rebuilt from scratch.
+		bool rebuilt;
+		/// The time taken by the update, in seconds.
+		double seconds;
+	};
+	
+	/**
+	 * \brief Moves every leaf in the Orthtree to a new position at once,
+	 * rebuilding the Orthtree if that is cheaper.
+	 * 
+	 * This works like Orthtree::rebin, except that if more than a fraction
+	 * OrthtreeInternalDetailsDefault::RebuildFraction of the leafs change
+	 * node, then the nodes are built from scratch instead, as if by the range
+	 * constructor. This sorts the leafs again, and leaves every node with a
+	 * default constructed value.
+	 * 
+	 * NodeIterator%s and LeafIterator%s may be invalidated.
+	 * 
+	 * \param positionBegin the start of a range of positions to move to
+	 * \param positionEnd the end of a range of positions to move to
+	 * \param threadCount the number of threads to use if the Orthtree is
+	 * rebuilt
+	 * \return what the update did, and how long it took
+	 */
+	template<typename PositionIt>
+	UpdateStats update(
+		PositionIt positionBegin,
+		PositionIt positionEnd,
+		std::size_t threadCount = 1);
+	
 	///@{
 	/**
 	 * \brief Searches for the node that contains a certain position.
@@ -923,6 +1827,613 @@ public:
 	}
 	///@}
 	
+	///@{
+	/**
+	 * \brief Finds all of the leafs that lie inside of a box.
+	 * 
+	 * The box includes its lower boundary but not its upper boundary, in the
+	 * same way as a node. The leafs are found as a set of LeafRange%s, in
+	 * depth-first order. A node that is completely inside of the box
+	 * contributes all of its leafs at once, without any of them being checked
+	 * individually, and neighbouring ranges are joined together. Only nodes
+	 * that are partly inside of the box have their leafs checked one by one.
+	 * 
+	 * The first version calls a function with each LeafRange, while the second
+	 * version returns all of the LeafRange%s in a list. The LeafRange%s are
+	 * invalidated in the same way as LeafIterator%s.
+	 * 
+	 * \param position the "upper-left" corner of the box
+	 * \param dimensions the size of the box
+	 * \param visit a function that is called with each LeafRange in the box
+	 */
+	template<typename F>
+	void query(Vector const& position, Vector const& dimensions, F visit) {
+		queryBoxIndices(
+			position,
+			dimensions,
+			[&](
+					LeafListSizeType lowerIndex,
+					LeafListSizeType upperIndex,
+					LeafListSizeType size) {
+				visit(LeafRange(this, lowerIndex, upperIndex, size));
+			});
+	}
+	template<typename F>
+	void query(
+			Vector const& position,
+			Vector const& dimensions,
+			F visit) const {
+		queryBoxIndices(
+			position,
+			dimensions,
+			[&](
+					LeafListSizeType lowerIndex,
+					LeafListSizeType upperIndex,
+					LeafListSizeType size) {
+				visit(ConstLeafRange(this, lowerIndex, upperIndex, size));
+			});
+	}
+	
+	std::vector<LeafRange> query(
+			Vector const& position,
+			Vector const& dimensions) {
+		std::vector<LeafRange> result;
+		query(position, dimensions, [&](LeafRange range) {
+			result.push_back(range);
+		});
+		return result;
+	}
+	std::vector<ConstLeafRange> query(
+			Vector const& position,
+			Vector const& dimensions) const {
+		std::vector<ConstLeafRange> result;
+		query(position, dimensions, [&](ConstLeafRange range) {
+			result.push_back(range);
+		});
+		return result;
+	}
+	///@}
+	
+	///@{
+	/**
+	 * \brief Finds all of the leafs within a certain distance of a point.
+	 * 
+	 * A leaf is included if its distance from the point is less than or equal
+	 * to the radius. As with Orthtree::query, the leafs are found as a set of
+	 * LeafRange%s in depth-first order, and a node that is completely inside
+	 * of the radius contributes all of its leafs at once.
+	 * 
+	 * \param point the center of the search
+	 * \param radius the largest distance from the point to search
+	 * \param visit a function that is called with each LeafRange found
+	 */
+	template<typename F>
+	void withinRadius(Vector const& point, Scalar radius, F visit) {
+		queryBallIndices(
+			point,
+			radius,
+			[&](
+					LeafListSizeType lowerIndex,
+					LeafListSizeType upperIndex,
+					LeafListSizeType size) {
+				visit(LeafRange(this, lowerIndex, upperIndex, size));
+			});
+	}
+	template<typename F>
+	void withinRadius(Vector const& point, Scalar radius, F visit) const {
+		queryBallIndices(
+			point,
+			radius,
+			[&](
+					LeafListSizeType lowerIndex,
+					LeafListSizeType upperIndex,
+					LeafListSizeType size) {
+				visit(ConstLeafRange(this, lowerIndex, upperIndex, size));
+			});
+	}
+	
+	std::vector<LeafRange> withinRadius(Vector const& point, Scalar radius) {
+		std::vector<LeafRange> result;
+		withinRadius(point, radius, [&](LeafRange range) {
+			result.push_back(range);
+		});
+		return result;
+	}
+	std::vector<ConstLeafRange> withinRadius(
+			Vector const& point,
+			Scalar radius) const {
+		std::vector<ConstLeafRange> result;
+		withinRadius(point, radius, [&](ConstLeafRange range) {
+			result.push_back(range);
+		});
+		return result;
+	}
+	///@}
+	
+	///@{
+	/**
+	 * \brief Finds every pair of leafs that are within a certain distance of
+	 * each other.
+	 * 
+	 * The function is called as `visit(leaf, otherLeaf)` once for each pair of
+	 * distinct leafs whose distance is less than or equal to the radius. The
+	 * order of the two leafs within a pair is unspecified.
+	 * 
+	 * Instead of searching around each leaf separately, pairs of nodes are
+	 * searched together (a dual-tree traversal). Two nodes are skipped as soon
+	 * as their closest points are further apart than the radius, and the leafs
+	 * of two nodes without children are compared directly, since they are
+	 * stored next to each other.
+	 * 
+	 * \param radius the largest distance between two leafs in a pair
+	 * \param visit a function that is called with each pair of LeafIterator%s
+	 */
+	template<typename F>
+	void forEachPairWithin(Scalar radius, F visit) {
+		auto visitIndices = [&](
+				LeafListSizeType leafIndex,
+				LeafListSizeType otherLeafIndex) {
+			visit(
+				LeafIterator(this, leafIndex),
+				LeafIterator(this, otherLeafIndex));
+		};
+		pairIndicesWithin(0, 0, radius * radius, visitIndices);
+	}
+	template<typename F>
+	void forEachPairWithin(Scalar radius, F visit) const {
+		auto visitIndices = [&](
+				LeafListSizeType leafIndex,
+				LeafListSizeType otherLeafIndex) {
+			visit(
+				ConstLeafIterator(this, leafIndex),
+				ConstLeafIterator(this, otherLeafIndex));
+		};
+		pairIndicesWithin(0, 0, radius * radius, visitIndices);
+	}
+	///@}
+	
+	/**
+	 * \brief The usual opening criterion for Orthtree::barnesHut.
+	 * 
+	 * A node is treated as a single body when its size, divided by its
+	 * distance from the leafs that it acts on, is less than `theta`. Smaller
+	 * angles are more accurate but slower, and an angle of zero gives the same
+	 * result as summing over every pair of leafs.
+	 */
+	struct OpeningAngle {
+		Scalar theta;
+		bool operator()(Scalar size, Scalar distanceSquared) const {
+			return size * size < theta * theta * distanceSquared;
+		}
+	};
+	
+	///@{
+	/**
+	 * \brief Evaluates an interaction between every leaf and all of the other
+	 * leafs, such as gravity, approximating far away nodes as single bodies
+	 * (the Barnes-Hut method).
+	 * 
+	 * The node values have to hold the aggregates that the kernel uses, such
+	 * as the total mass and centre of mass, and should be filled in first with
+	 * Orthtree::reduce or Orthtree::reduceChanged. The kernel provides a
+	 * `Result` type, which is default constructed for each leaf and then
+	 * accumulated into with
+	 * 
+	 *     kernel.node(result, position, nodeValue)
+	 *     kernel.leaf(result, position, otherPosition, otherLeafValue)
+	 * 
+	 * for far away nodes and for nearby leafs respectively. A leaf never acts
+	 * on itself. Whether a node is far enough away is decided by calling
+	 * `criterion(size, distanceSquared)` with the largest dimension of the
+	 * node and the squared distance from the center of the node to the
+	 * region of the leafs that it would act on, as with OpeningAngle.
+	 * 
+	 * The leafs of each node without children are evaluated together, sharing
+	 * a single list of far away nodes and nearby leafs. With more than one
+	 * thread, these groups are shared out between the threads, and `visit` is
+	 * called from several threads at once (for different leafs).
+	 * 
+	 * \param kernel the interaction to evaluate
+	 * \param criterion decides whether a node is far enough away
+	 * \param visit { a function that is called as `visit(leaf, result)` for
+	 * each leaf }
+	 * \param threadCount the number of threads to use
+	 */
+	template<typename Kernel, typename Criterion, typename F>
+	void barnesHut(
+			Kernel const& kernel,
+			Criterion const& criterion,
+			F visit,
+			std::size_t threadCount = 1) {
+		auto visitIndices = [&](
+				LeafListSizeType leafIndex,
+				typename Kernel::Result const& result) {
+			visit(LeafIterator(this, leafIndex), result);
+		};
+		barnesHutIndices(kernel, criterion, visitIndices, threadCount);
+	}
+	template<typename Kernel, typename Criterion, typename F>
+	void barnesHut(
+			Kernel const& kernel,
+			Criterion const& criterion,
+			F visit,
+			std::size_t threadCount = 1) const {
+		auto visitIndices = [&](
+				LeafListSizeType leafIndex,
+				typename Kernel::Result const& result) {
+			visit(ConstLeafIterator(this, leafIndex), result);
+		};
+		barnesHutIndices(kernel, criterion, visitIndices, threadCount);
+	}
+	///@}
+	
+	/**
+	 * \brief A lightweight reference to a node, which only reads the parts of
+	 * the node that are asked for.
+	 * 
+	 * Dereferencing a NodeIterator gathers everything about a node at once,
+	 * including iterators to all of its children and its range of leafs. A
+	 * NodeHandle is just the Orthtree and the index of the node, so it is cheap
+	 * to pass around in tight loops, such as when iterating over every node or
+	 * in a dual-tree traversal. A NodeHandle is found from a NodeIterator with
+	 * `NodeIterator::handle`.
+	 * 
+	 * Like a ConstNodeIterator, a NodeHandle is invalidated whenever the
+	 * Orthtree is modified.
+	 * 
+	 * \see Orthtree::dualTree
+	 */
+	class NodeHandle final {
+		
+	private:
+		
+		friend Orthtree<Dim, Vector, LeafValue, NodeValue, Details>;
+		
+		template<bool, bool>
+		friend class NodeIteratorBase;
+		
+		Orthtree const* _orthtree;
+		NodeListSizeType _index;
+		
+		NodeHandle(Orthtree const* orthtree, NodeListSizeType index) :
+				_orthtree(orthtree),
+				_index(index) {
+		}
+		
+		NodeInternal const& internal() const {
+			return _orthtree->_nodes[_index];
+		}
+		
+	public:
+		
+		bool hasParent() const {
+			return _index != 0;
+		}
+		// If the node has no parent, then the result is undefined.
+		NodeHandle parent() const {
+			return NodeHandle(_orthtree, _index + internal().parentIndex);
+		}
+		bool hasChildren() const {
+			return internal().hasChildren;
+		}
+		// If the node has no children, then the result is undefined. For
+		// compact nodes, this skips over the subtrees of the earlier children.
+		NodeHandle child(std::size_t index) const {
+			return NodeHandle(_orthtree, _orthtree->childIndex(_index, index));
+		}
+		ConstLeafRange leafs() const {
+			return ConstLeafRange(
+				_orthtree,
+				internal().leafIndex,
+				_orthtree->leafEndIndex(_index),
+				internal().leafCount);
+		}
+		LeafListSizeType leafCount() const {
+			return internal().leafCount;
+		}
+		NodeListSizeType depth() const {
+			return internal().depth;
+		}
+		GeometryReference position() const {
+			return _orthtree->nodePosition(internal());
+		}
+		GeometryReference dimensions() const {
+			return _orthtree->nodeDimensions(internal());
+		}
+		NodeValue const& value() const {
+			return internal().value;
+		}
+		ConstNodeIterator iterator() const {
+			return ConstNodeIterator(_orthtree, _index);
+		}
+		
+		friend bool operator==(NodeHandle lhs, NodeHandle rhs) {
+			return lhs._orthtree == rhs._orthtree && lhs._index == rhs._index;
+		}
+		friend bool operator!=(NodeHandle lhs, NodeHandle rhs) {
+			return !(lhs == rhs);
+		}
+		
+	};
+	
+	///@{
+	/**
+	 * \brief Visits pairs of nodes from this Orthtree and another one (or this
+	 * one again) together, pruning pairs of nodes that can't matter (a
+	 * dual-tree traversal).
+	 * 
+	 * The rule decides which pairs of nodes to visit, and handles the pairs of
+	 * leafs that are left over. For a pair of nodes, it is called as
+	 * 
+	 *     rule.score(node, otherNode)
+	 * 
+	 * with a NodeHandle to each node, and returns a Scalar. The pair is pruned
+	 * if the score is infinite, and otherwise, pairs with lower scores are
+	 * visited first. A pair is scored again just before it is visited, so a
+	 * rule that tightens its bounds as it goes (such as when searching for the
+	 * nearest neighbours of every leaf) can still prune pairs that were scored
+	 * before. When neither node has children, the rule is called as
+	 * 
+	 *     rule.baseCase(leaf, otherLeaf)
+	 * 
+	 * with ConstLeafIterator%s to each pair of their leafs. When both
+	 * Orthtrees are the same, then each ordered pair of distinct leafs can be
+	 * visited, and a leaf is never paired with itself. In a loose Orthtree,
+	 * the leafs of a node may be outside of it by the margin given by
+	 * OrthtreeInternalDetailsDefault::Looseness, which the rule has to allow
+	 * for.
+	 * 
+	 * With more than one thread, the nodes of this Orthtree are split up into
+	 * subtrees that are each traversed against the other Orthtree on their own.
+	 * The rule is called from several threads at once, but each leaf of this
+	 * Orthtree is only ever passed to `baseCase` from one thread at a time.
+	 * 
+	 * \param other the Orthtree that the leafs of this one are paired with
+	 * \param rule decides which nodes to visit and handles pairs of leafs
+	 * \param threadCount the number of threads to use
+	 */
+	template<typename Rule>
+	void dualTree(
+		Orthtree const& other,
+		Rule& rule,
+		std::size_t threadCount = 1) const;
+	template<typename Rule>
+	void dualTree(Rule& rule, std::size_t threadCount = 1) const {
+		dualTree(*this, rule, threadCount);
+	}
+	///@}
+	
+	/**
+	 * \brief Working memory for searching for the nearest leafs to a point.
+	 * 
+	 * If the same buffer is reused for many searches, then memory only has to
+	 * be allocated until the buffer has grown large enough.
+	 * 
+	 * \see Orthtree::nearest
+	 */
+	class NearestBuffer final {
+		
+	private:
+		
+		friend Orthtree<Dim, Vector, LeafValue, NodeValue, Details>;
+		
+		// The squared distances and indices of the closest leafs found so far.
+		std::vector<std::pair<Scalar, LeafListSizeType> > _heap;
+		
+	public:
+		
+		NearestBuffer() = default;
+		
+	};
+	
+	///@{
+	/**
+	 * \brief Finds the `k` leafs that are closest to a point.
+	 * 
+	 * The leafs are ranked by the squared distance between their position and
+	 * the point, and are written to the output iterator from closest to
+	 * furthest. If the Orthtree has fewer than `k` leafs, then all of them are
+	 * written. Leafs that are the same distance from the point are written in
+	 * depth-first order.
+	 * 
+	 * Nodes are searched starting from the one that contains the point, and
+	 * moving outwards. A node is skipped if it is further away than the `k`th
+	 * closest leaf found so far.
+	 * 
+	 * The versions that take a NearestBuffer don't allocate any memory once the
+	 * buffer is large enough. The other versions return the leafs in a list.
+	 * 
+	 * \param point the point to search around
+	 * \param k the number of leafs to find
+	 * \param output an output iterator that LeafIterator%s are written to
+	 * \param buffer working memory that can be reused between searches
+	 * 
+	 * \return the output iterator, after the last leaf that was written
+	 */
+	template<typename LeafOutputIt>
+	LeafOutputIt nearest(
+			Vector const& point,
+			LeafListSizeType k,
+			LeafOutputIt output,
+			NearestBuffer& buffer) {
+		nearestIndices(0, point, k, buffer._heap);
+		std::sort_heap(buffer._heap.begin(), buffer._heap.end());
+		for (auto const& entry : buffer._heap) {
+			*output++ = LeafIterator(this, entry.second);
+		}
+		return output;
+	}
+	template<typename LeafOutputIt>
+	LeafOutputIt nearest(
+			Vector const& point,
+			LeafListSizeType k,
+			LeafOutputIt output,
+			NearestBuffer& buffer) const {
+		nearestIndices(0, point, k, buffer._heap);
+		std::sort_heap(buffer._heap.begin(), buffer._heap.end());
+		for (auto const& entry : buffer._heap) {
+			*output++ = ConstLeafIterator(this, entry.second);
+		}
+		return output;
+	}
+	
+	std::vector<LeafIterator> nearest(
+			Vector const& point,
+			LeafListSizeType k) {
+		NearestBuffer buffer;
+		std::vector<LeafIterator> result;
+		nearest(point, k, std::back_inserter(result), buffer);
+		return result;
+	}
+	std::vector<ConstLeafIterator> nearest(
+			Vector const& point,
+			LeafListSizeType k) const {
+		NearestBuffer buffer;
+		std::vector<ConstLeafIterator> result;
+		nearest(point, k, std::back_inserter(result), buffer);
+		return result;
+	}
+	///@}
+	
+	///@{
+	/**
+	 * \brief Traces a ray through the Orthtree, visiting the leafs of each node
+	 * that it crosses from front to back.
+	 * 
+	 * The ray is made up of the points `origin + t * direction` for `t >= 0`.
+	 * The function is called as `visit(leafs, tEnter, tExit)` for each node
+	 * without children that holds leafs and is crossed by the ray, where
+	 * `leafs` is the LeafRange of the node and the ray is inside of the node
+	 * between `tEnter` and `tExit`. The nodes are visited in increasing order
+	 * of `tEnter`. The function should return true to continue the trace, or
+	 * false to stop it (for instance, once a leaf has been hit).
+	 * 
+	 * Every node that the ray passes through is visited, as is every node that
+	 * contains a point on the ray. A node that the ray only touches along an
+	 * edge or at a corner may or may not be visited. Within each node, the
+	 * values of `t` at which the ray crosses the planes between the children
+	 * are found from those of the node, and only the (at most `Dim + 1`)
+	 * children that the ray crosses are visited, in an order that depends on
+	 * the signs of the components of the direction.
+	 * 
+	 * In a loose Orthtree (see OrthtreeInternalDetailsDefault::Looseness), the
+	 * leafs of a node may lie outside of it by the loose margin, so each node
+	 * is traced as if it had been enlarged by that margin. The enlarged nodes
+	 * overlap, so the ray may be inside of several of them at once. Then
+	 * `tEnter` and `tExit` describe where the ray crosses the enlarged node,
+	 * and the children of each node are visited in increasing order of
+	 * `tEnter`, but a node may be visited before a node with a smaller
+	 * `tEnter` that has a different parent.
+	 * 
+	 * \param origin the start of the ray
+	 * \param direction the direction of the ray, which doesn't have to be
+	 * normalized
+	 * \param visit a function that is called with each LeafRange crossed
+	 * 
+	 * \return false if the trace was stopped by `visit`, and true otherwise
+	 */
+	template<typename F>
+	bool traceRay(Vector const& origin, Vector const& direction, F visit) {
+		return traceRayIndices(
+			origin,
+			direction,
+			std::numeric_limits<Scalar>::max(),
+			[&](NodeListSizeType nodeIndex, Scalar tEnter, Scalar tExit) {
+				NodeInternal const& node = _nodes[nodeIndex];
+				return visit(
+					LeafRange(
+						this,
+						node.leafIndex,
+						leafEndIndex(nodeIndex),
+						node.leafCount),
+					tEnter,
+					tExit);
+			});
+	}
+	template<typename F>
+	bool traceRay(
+			Vector const& origin,
+			Vector const& direction,
+			F visit) const {
+		return traceRayIndices(
+			origin,
+			direction,
+			std::numeric_limits<Scalar>::max(),
+			[&](NodeListSizeType nodeIndex, Scalar tEnter, Scalar tExit) {
+				NodeInternal const& node = _nodes[nodeIndex];
+				return visit(
+					ConstLeafRange(
+						this,
+						node.leafIndex,
+						leafEndIndex(nodeIndex),
+						node.leafCount),
+					tEnter,
+					tExit);
+			});
+	}
+	///@}
+	
+	///@{
+	/**
+	 * \brief Traces a line segment through the Orthtree, visiting the leafs of
+	 * each node that it crosses from front to back.
+	 * 
+	 * This is the same as Orthtree::traceRay with a direction of `end - start`,
+	 * except that the trace stops at `end`. The values of `t` passed to
+	 * `visit` go from 0 at `start` to 1 at `end`.
+	 * 
+	 * \param start the start of the segment
+	 * \param end the end of the segment
+	 * \param visit a function that is called with each LeafRange crossed
+	 * 
+	 * \return false if the trace was stopped by `visit`, and true otherwise
+	 */
+	template<typename F>
+	bool traceSegment(Vector const& start, Vector const& end, F visit) {
+		Vector direction = end;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			direction[dim] = end[dim] - start[dim];
+		}
+		return traceRayIndices(
+			start,
+			direction,
+			1,
+			[&](NodeListSizeType nodeIndex, Scalar tEnter, Scalar tExit) {
+				NodeInternal const& node = _nodes[nodeIndex];
+				return visit(
+					LeafRange(
+						this,
+						node.leafIndex,
+						leafEndIndex(nodeIndex),
+						node.leafCount),
+					tEnter,
+					tExit);
+			});
+	}
+	template<typename F>
+	bool traceSegment(Vector const& start, Vector const& end, F visit) const {
+		Vector direction = end;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			direction[dim] = end[dim] - start[dim];
+		}
+		return traceRayIndices(
+			start,
+			direction,
+			1,
+			[&](NodeListSizeType nodeIndex, Scalar tEnter, Scalar tExit) {
+				NodeInternal const& node = _nodes[nodeIndex];
+				return visit(
+					ConstLeafRange(
+						this,
+						node.leafIndex,
+						leafEndIndex(nodeIndex),
+						node.leafCount),
+					tEnter,
+					tExit);
+			});
+	}
+	///@}
+	
 	/**
 	 * \brief Determines whether a node contains a point.
 	 */
@@ -9,12 +9,14 @@
 #include "orthtree_value.h"
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <climits>
 #include <cmath>
 #include <cstddef>
 #include <iterator>
+#include <limits>
 #include <numeric>
-#include <stack>
 #include <tuple>
 #include <utility>
 #include <vector>
@@ -35,9 +37,21 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::Orthtree(
 		bool autoAdjust) :
 		_leafs(),
 		_nodes(),
+		_position(position),
+		_dimensions(dimensions),
 		_nodeCapacity(nodeCapacity),
+		_mergeCapacity(nodeCapacity),
 		_maxDepth(maxDepth),
 		_autoAdjust(autoAdjust) {
+	// With implicit geometry, the cells of the nodes can only be stored up to
+	// a certain depth.
+	if (Details::ImplicitGeometry && _maxDepth > MaxCellDepth) {
+		_maxDepth = MaxCellDepth;
+	}
+	// The depth of every node has to fit into a DepthType.
+	if (_maxDepth > std::numeric_limits<DepthType>::max()) {
+		_maxDepth = std::numeric_limits<DepthType>::max();
+	}
 	NodeInternal root(position, dimensions);
 	_nodes.insert(_nodes.begin(), root);
 }
@@ -58,56 +72,129 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::Orthtree(
 		PositionIt positionEnd,
 		LeafListSizeType nodeCapacity,
 		NodeListSizeType maxDepth,
-		bool autoAdjust) :
+		bool autoAdjust,
+		std::size_t threadCount) :
 		Orthtree(position, dimensions, nodeCapacity, maxDepth, autoAdjust) {
 	(void) positionEnd;
 	typename std::iterator_traits<LeafIt>::difference_type numLeafs =
 		std::distance(leafBegin, leafEnd);
+	checkLeafListSize(numLeafs);
 	reserve(numLeafs);
 	
-	// Add leafs to the leaf vector.
 	PositionIt positionIt = positionBegin;
 	for (LeafIt leafIt = leafBegin; leafIt != leafEnd; ++leafIt, ++positionIt) {
 		_leafs.push_back(LeafInternal(*positionIt, *leafIt));
 	}
+	build(threadCount);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::build(
+		std::size_t threadCount) {
+	// Sort the leafs by their Morton keys. Then the leafs of every node will
+	// be next to each other, in the same order as the nodes.
+	NodeListSizeType levels =
+		_maxDepth < MortonLevels ? _maxDepth : MortonLevels;
+	std::size_t const chunkSize = 4096;
+	internal::ArenaScope scope(_scratch);
+	ScratchVector<MortonKey> keys(
+		_leafs.size(),
+		scratchAllocator<MortonKey>());
+	ScratchVector<LeafListSizeType> order(
+		_leafs.size(),
+		scratchAllocator<LeafListSizeType>());
+	internal::parallelFor(threadCount, _leafs.size(), chunkSize, [&](
+			std::size_t begin,
+			std::size_t end) {
+		for (std::size_t index = begin; index < end; ++index) {
+			keys[index] = mortonKey(_leafs[index].position, _nodes[0], levels);
+			order[index] = index;
+		}
+	});
+	internal::radixSort(keys, order, levels * Dim, threadCount);
+	permuteLeafs(0, order);
+	if (LeafGaps) {
+		_leafGaps.assign(_leafs.size(), false);
+	}
 	_nodes[0].leafIndex = 0;
 	_nodes[0].leafCount = _leafs.size();
 	
-	// Get access to the current node.
-	NodeIterator node = root();
-	while (node != nodes().end()) {
-		if (!canHoldLeafs(node, 0)) {
-			// Create a new set of child nodes.
-			allocChildren(node);
-			updateNodeChildData(node, true);
-			// Assign each of the leafs from the current node into a child.
-			std::vector<LeafInternal> newLeafsByChild[1 << Dim];
-			for (std::size_t dim = 0; dim < (1 << Dim); ++dim) {
-				newLeafsByChild[dim].reserve(node->leafs.size());
-			}
-			for (
-					LeafIterator leaf = node->leafs.begin();
-					leaf != node->leafs.end();
-					++leaf) {
-				NodeIterator child = findChild(node, leaf->position);
-				newLeafsByChild[child.internalIt()->siblingIndex].push_back(
-					*leaf.internalIt());
+	// Now the nodes can be created in a single pass over the sorted keys. With
+	// multiple threads, the nodes close to the root are created first, and the
+	// subtrees below them are divided between the threads. There should be a
+	// few subtrees for each thread, so that the work can be balanced.
+	NodeListSizeType depthLimit = levels;
+	if (threadCount > 1) {
+		std::size_t subtreeCount = 1 << Dim;
+		depthLimit = 1;
+		while (depthLimit < levels && subtreeCount < 4 * threadCount) {
+			subtreeCount <<= Dim;
+			++depthLimit;
+		}
+	}
+	buildChildren(_nodes, 0, keys, levels, depthLimit);
+	if (depthLimit < levels) {
+		buildSubtrees(keys, levels, depthLimit, threadCount);
+	}
+	checkNodeListSize(_nodes.size());
+	
+	// If the Morton keys didn't have enough bits to reach the maximum depth,
+	// then some nodes may still have too many leafs. The leafs of each of them
+	// are sorted again by keys that start from the node instead of the root,
+	// and then all of their subtrees are built and spliced in at once. This is
+	// repeated until the keys reach the maximum depth.
+	while (levels < _maxDepth) {
+		NodeListSizeType nextLevels = _maxDepth - levels < MortonLevels ?
+			_maxDepth :
+			levels + MortonLevels;
+		bool overfull = false;
+		for (NodeListSizeType index = 0; index < _nodes.size(); ++index) {
+			NodeInternal const& node = _nodes[index];
+			if (node.depth != levels || node.leafCount <= _nodeCapacity) {
+				continue;
 			}
-			// Copy the new child leaf vectors into master leaf vector. Also
-			// update nodes.
-			LeafListSizeType leafIndex = node->leafs.begin()._index;
-			for (std::size_t dim = 0; dim < (1 << Dim); ++dim) {
-				std::vector<LeafInternal>& newLeafs = newLeafsByChild[dim];
-				node->children[dim].internalIt()->leafIndex = leafIndex;
-				node->children[dim].internalIt()->leafCount = newLeafs.size();
-				std::copy(
-					newLeafs.begin(),
-					newLeafs.end(),
-					_leafs.begin() + leafIndex);
-				leafIndex += newLeafs.size();
+			overfull = true;
+			internal::ArenaScope nodeScope(_scratch);
+			ScratchVector<MortonKey> nodeKeys(
+				node.leafCount,
+				scratchAllocator<MortonKey>());
+			ScratchVector<LeafListSizeType> nodeOrder(
+				node.leafCount,
+				scratchAllocator<LeafListSizeType>());
+			for (LeafListSizeType leaf = 0; leaf < node.leafCount; ++leaf) {
+				nodeKeys[leaf] = mortonKey(
+					_leafs[node.leafIndex + leaf].position,
+					node,
+					nextLevels - levels);
+				nodeOrder[leaf] = leaf;
 			}
+			internal::radixSort(
+				nodeKeys,
+				nodeOrder,
+				(nextLevels - levels) * Dim,
+				threadCount);
+			permuteLeafs(node.leafIndex, nodeOrder);
+			std::copy(
+				nodeKeys.begin(),
+				nodeKeys.end(),
+				keys.begin() + node.leafIndex);
+		}
+		if (!overfull) {
+			break;
 		}
-		++node;
+		buildSubtrees(keys, nextLevels, levels, threadCount);
+		checkNodeListSize(_nodes.size());
+		levels = nextLevels;
+	}
+	
+	// Leave room after each node for leafs that are inserted later.
+	if (LeafGaps) {
+		spreadLeafs(Details::LeafGapSize);
 	}
 }
 
@@ -122,6 +209,7 @@ void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::createChildren(
 	allocChildren(node);
 	updateNodeChildData(node, true);
 	distributeLeafs(node);
+	markChanged(node._index);
 }
 
 template<
@@ -132,8 +220,35 @@ template<
 	typename Details>
 void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::destroyChildren(
 		NodeIterator node) {
+	// If there are gaps, then gather the leafs of the children together at the
+	// start of the node's section of the leaf list.
+	if (LeafGaps) {
+		LeafListSizeType leafBegin = node.internalIt()->leafIndex;
+		LeafListSizeType leafEnd = leafEndIndex(node._index);
+		LeafListSizeType destIndex = leafBegin;
+		for (
+				LeafListSizeType sourceIndex = leafBegin;
+				sourceIndex < leafEnd;
+				++sourceIndex) {
+			if (!_leafGaps[sourceIndex]) {
+				if (destIndex != sourceIndex) {
+					_leafs[destIndex] = std::move(_leafs[sourceIndex]);
+				}
+				++destIndex;
+			}
+		}
+		std::fill(
+			_leafGaps.begin() + leafBegin,
+			_leafGaps.begin() + destIndex,
+			false);
+		std::fill(
+			_leafGaps.begin() + destIndex,
+			_leafGaps.begin() + leafEnd,
+			true);
+	}
 	freeChildren(node);
 	updateNodeChildData(node, false);
+	markChanged(node._index);
 }
 
 template<
@@ -146,10 +261,11 @@ void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::allocChildren(
 		NodeIterator node) {
 	// Create the 2^Dim child nodes inside the list of nodes. This will not
 	// invalidate the node iterator.
+	checkNodeListSize(_nodes.size() + (1 << Dim));
 	_nodes.insert(
 		node.internalIt() + 1,
 		1 << Dim,
-		NodeInternal(node->position, node->dimensions));
+		NodeInternal(_position, _dimensions));
 	
 	// Loop through the new children, and set up their various properties.
 	for (std::size_t index = 0; index < (1 << Dim); ++index) {
@@ -161,13 +277,7 @@ void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::allocChildren(
 			node.internalIt()->leafIndex +
 			node.internalIt()->leafCount;
 		// Position and size the child node.
-		for (std::size_t dim = 0; dim < Dim; ++dim) {
-			child.dimensions[dim] = child.dimensions[dim] / 2;
-			if ((1 << dim) & index) {
-				child.position[dim] =
-					child.position[dim] + node->dimensions[dim] / 2;
-			}
-		}
+		setChildGeometry(*node.internalIt(), index, child);
 	}
 }
 
@@ -197,17 +307,16 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::updateNodeChildData(
 		bool childrenCreated,
 		bool updateParentIndices) {
 	// Update the original node's references to its children first.
-	node.internalIt()->hasChildren = childrenCreated;
-	auto childIndicesBegin = node.internalIt()->childIndices;
-	auto childIndicesEnd = node.internalIt()->childIndices + (1 << Dim) + 1;
-	NodeListDifferenceType childCountChange = -*(childIndicesEnd - 1);
-	if (childrenCreated) {
-		std::iota(childIndicesBegin, childIndicesEnd, 1);
-	}
-	else {
-		std::fill(childIndicesBegin, childIndicesEnd, 1);
+	NodeInternal& nodeInternal = *node.internalIt();
+	nodeInternal.hasChildren = childrenCreated;
+	NodeListSizeType& size =
+		nodeInternal.childIndices[NodeInternal::ChildIndexCount - 1];
+	NodeListDifferenceType childCountChange = -size;
+	for (std::size_t index = 0; index < (1 << Dim); ++index) {
+		setChildOffset(nodeInternal, index, childrenCreated ? index + 1 : 1);
 	}
-	childCountChange += *(childIndicesEnd - 1);
+	size = childrenCreated ? (1 << Dim) + 1 : 1;
+	childCountChange += size;
 	
 	return updateAncestorChildData(node, childCountChange, updateParentIndices);
 }
@@ -225,20 +334,26 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::updateAncestorChildData(
 		NodeListDifferenceType childCountChange,
 		bool updateParentIndices) {
 	// Go through the parent, grandparent, great-grandparent, ... of this node
-	// and update their child indices.
-	NodeIterator parent = node;
-	while (parent->hasParent) {
-		NodeListSizeType siblingIndex = parent.internalIt()->siblingIndex;
-		parent = parent->parent;
+	// and update their child indices. If the parent indices are updated, then
+	// every node is in place, so the later siblings can be found by skipping
+	// over subtrees (which works for compact nodes too).
+	NodeHandle current = node.handle();
+	while (current.hasParent()) {
+		NodeHandle parentHandle = current.parent();
+		NodeListSizeType siblingIndex = current.internal().siblingIndex;
+		NodeInternal& parent = _nodes[parentHandle._index];
+		NodeListSizeType childIndex = current._index;
 		while (++siblingIndex < (1 << Dim)) {
-			parent.internalIt()->childIndices[siblingIndex] += childCountChange;
-			NodeIterator child = parent->children[siblingIndex];
+			shiftChildOffset(parent, siblingIndex, childCountChange);
 			// Only update parent indices if requested.
 			if (updateParentIndices) {
-				child.internalIt()->parentIndex -= childCountChange;
+				childIndex += subtreeSize(childIndex);
+				_nodes[childIndex].parentIndex -= childCountChange;
 			}
 		}
-		parent.internalIt()->childIndices[1 << Dim] += childCountChange;
+		parent.childIndices[NodeInternal::ChildIndexCount - 1] +=
+			childCountChange;
+		current = parentHandle;
 	}
 	return childCountChange;
 }
@@ -251,15 +366,146 @@ template<
 	typename Details>
 void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::distributeLeafs(
 		NodeIterator node) {
-	// Distribute the leaves of this node to the children.
-	for (LeafListSizeType index = 0; index < node->leafs.size(); ++index) {
-		NodeListSizeType childIndex = 0;
-		// The leaf is always taken from the front of the list, and moved to
-		// a location on the end of the list to prevent double processing.
-		LeafIterator leaf = node->leafs.begin();
-		NodeIterator child = findChild(node, leaf->position);
-		moveAt(node, child, leaf);
+	// Distribute the leaves of this node to the children. The leaves are
+	// sorted by child with a counting sort so that their relative order is
+	// kept. Any gaps at the end of the node are split evenly between the
+	// children that received leaves.
+	NodeInternal& nodeInternal = *node.internalIt();
+	LeafListSizeType leafBegin = nodeInternal.leafIndex;
+	LeafListSizeType leafCount = nodeInternal.leafCount;
+	LeafListSizeType gapCount = leafEndIndex(node._index) - leafBegin - leafCount;
+	
+	internal::ArenaScope scope(_scratch);
+	ScratchVector<NodeListSizeType> leafChildIndices(
+		scratchAllocator<NodeListSizeType>());
+	leafChildIndices.reserve(leafCount);
+	LeafListSizeType childLeafCounts[1 << Dim] = {};
+	for (LeafListSizeType index = 0; index < leafCount; ++index) {
+		NodeListSizeType childIndex = findChildIndex(
+			nodeInternal,
+			_leafs[leafBegin + index].position);
+		leafChildIndices.push_back(childIndex);
+		++childLeafCounts[childIndex];
+	}
+	LeafListSizeType childLeafOffsets[1 << Dim] = {};
+	for (std::size_t childIndex = 1; childIndex < (1 << Dim); ++childIndex) {
+		childLeafOffsets[childIndex] =
+			childLeafOffsets[childIndex - 1] +
+			childLeafCounts[childIndex - 1];
+	}
+	ScratchVector<LeafListSizeType> sortedIndices(
+		leafCount,
+		scratchAllocator<LeafListSizeType>());
+	for (LeafListSizeType index = 0; index < leafCount; ++index) {
+		sortedIndices[childLeafOffsets[leafChildIndices[index]]++] = index;
+	}
+	ScratchVector<LeafInternal> sortedLeafs(scratchAllocator<LeafInternal>());
+	sortedLeafs.reserve(leafCount);
+	for (LeafListSizeType index = 0; index < leafCount; ++index) {
+		sortedLeafs.push_back(
+			std::move(_leafs[leafBegin + sortedIndices[index]]));
+	}
+	
+	// Move the sorted leafs back into the leaf list, and update the children.
+	// If none of the children received leafs, then the first one gets the gaps.
+	LeafListSizeType nonEmptyCount = std::count_if(
+		childLeafCounts,
+		childLeafCounts + (1 << Dim),
+		[](LeafListSizeType count) { return count != 0; });
+	LeafListSizeType nonEmptyIndex = 0;
+	LeafListSizeType leafIndex = leafBegin;
+	auto sortedLeaf = sortedLeafs.begin();
+	NodeListSizeType children[1 << Dim];
+	childIndices(node._index, children);
+	for (std::size_t childIndex = 0; childIndex < (1 << Dim); ++childIndex) {
+		NodeInternal& child = _nodes[children[childIndex]];
+		LeafListSizeType childGapCount = 0;
+		if (childLeafCounts[childIndex] != 0) {
+			childGapCount =
+				gapCount / nonEmptyCount +
+				(nonEmptyIndex < gapCount % nonEmptyCount ? 1 : 0);
+			++nonEmptyIndex;
+		}
+		else if (nonEmptyCount == 0 && childIndex == 0) {
+			childGapCount = gapCount;
+		}
+		child.leafIndex = leafIndex;
+		child.leafCount = childLeafCounts[childIndex];
+		std::move(
+			sortedLeaf,
+			sortedLeaf + child.leafCount,
+			_leafs.begin() + leafIndex);
+		sortedLeaf += child.leafCount;
+		if (LeafGaps) {
+			std::fill(
+				_leafGaps.begin() + leafIndex,
+				_leafGaps.begin() + leafIndex + child.leafCount,
+				false);
+			std::fill(
+				_leafGaps.begin() + leafIndex + child.leafCount,
+				_leafGaps.begin() + leafIndex + child.leafCount + childGapCount,
+				true);
+		}
+		leafIndex += child.leafCount + childGapCount;
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::splitNode(
+		NodeList& nodes,
+		NodeListSizeType nodeIndex,
+		ScratchVector<LeafInternal>& buffer) {
+	NodeInternal node = nodes[nodeIndex];
+	if (canHoldLeafs(node)) {
+		return;
+	}
+	nodes[nodeIndex].hasChildren = true;
+	
+	// Sort the leafs of the node by child with a counting sort, so that their
+	// relative order is kept in the same way as with distributeLeafs.
+	buffer.clear();
+	LeafListSizeType childLeafOffsets[1 << Dim] = {};
+	for (LeafListSizeType index = 0; index < node.leafCount; ++index) {
+		buffer.push_back(std::move(_leafs[node.leafIndex + index]));
+		++childLeafOffsets[findChildIndex(node, buffer.back().position)];
+	}
+	LeafListSizeType childLeafCounts[1 << Dim];
+	LeafListSizeType leafIndex = node.leafIndex;
+	for (std::size_t childIndex = 0; childIndex < (1 << Dim); ++childIndex) {
+		childLeafCounts[childIndex] = childLeafOffsets[childIndex];
+		childLeafOffsets[childIndex] = leafIndex;
+		leafIndex += childLeafCounts[childIndex];
+	}
+	for (LeafInternal& leaf : buffer) {
+		NodeListSizeType childIndex = findChildIndex(node, leaf.position);
+		*(_leafs.begin() + childLeafOffsets[childIndex]++) = std::move(leaf);
 	}
+	
+	// Then create the children in the same way as buildChildren does, and
+	// split each of them in turn.
+	leafIndex = node.leafIndex;
+	for (std::size_t index = 0; index < (1 << Dim); ++index) {
+		NodeListSizeType childNodeIndex = nodes.size();
+		NodeInternal child(_position, _dimensions);
+		child.depth = node.depth + 1;
+		child.parentIndex = -static_cast<NodeListDifferenceType>(
+			childNodeIndex - nodeIndex);
+		child.siblingIndex = index;
+		child.leafIndex = leafIndex;
+		child.leafCount = childLeafCounts[index];
+		setChildGeometry(node, index, child);
+		nodes.push_back(child);
+		setChildOffset(nodes[nodeIndex], index, childNodeIndex - nodeIndex);
+		splitNode(nodes, childNodeIndex, buffer);
+		leafIndex += childLeafCounts[index];
+	}
+	nodes[nodeIndex].childIndices[NodeInternal::ChildIndexCount - 1] =
+		nodes.size() - nodeIndex;
 }
 
 template<
@@ -273,7 +519,25 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::insertAt(
 		NodeIterator node,
 		LeafValue const& value,
 		Vector const& position) {
+	markChanged(node._index);
+	// If there are gaps, then the leaf can be put into the first gap after the
+	// node's leafs. Only the node and its ancestors have to be updated.
+	if (LeafGaps) {
+		NodeListSizeType nodeIndex = node._index;
+		LeafListSizeType leafIndex =
+			_nodes[nodeIndex].leafIndex + _nodes[nodeIndex].leafCount;
+		if (leafIndex == leafEndIndex(nodeIndex)) {
+			growLeafs(nodeIndex);
+			leafIndex = _nodes[nodeIndex].leafIndex + _nodes[nodeIndex].leafCount;
+		}
+		_leafs[leafIndex] = LeafInternal(position, value);
+		_leafGaps[leafIndex] = false;
+		updateLeafCounts(nodeIndex, +1);
+		return LeafIterator(this, leafIndex);
+	}
+	
 	// Add the leaf to the master list of leaves in the orthtree.
+	checkLeafListSize(_leafs.size() + 1);
 	_leafs.insert(
 		node->leafs.end().internalIt(),
 		LeafInternal(position, value));
@@ -308,6 +572,24 @@ typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::LeafIterator
 Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::eraseAt(
 		NodeIterator node,
 		LeafIterator leaf) {
+	markChanged(node._index);
+	// If there are gaps, then the rest of the node's leafs are shifted down and
+	// a gap is left at the end. Only the node and its ancestors have to be
+	// updated.
+	if (LeafGaps) {
+		NodeListSizeType nodeIndex = node._index;
+		LeafListSizeType leafIndex = leaf._index;
+		LeafListSizeType leafEnd =
+			_nodes[nodeIndex].leafIndex + _nodes[nodeIndex].leafCount;
+		std::move(
+			_leafs.begin() + leafIndex + 1,
+			_leafs.begin() + leafEnd,
+			_leafs.begin() + leafIndex);
+		_leafGaps[leafEnd - 1] = true;
+		updateLeafCounts(nodeIndex, -1);
+		return LeafIterator(this, leafIndex);
+	}
+	
 	// Remove the leaf from the master orthtree leaf vector.
 	_leafs.erase(leaf.internalIt());
 	
@@ -327,8 +609,1664 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::eraseAt(
 		hasParent = parent->hasParent;
 		parent = parent->parent;
 	}
-	
-	return leaf;
+	
+	return leaf;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::eraseMarked(
+		ScratchVector<LeafListSizeType>& marks) {
+	// The running sums give the number of removed leafs before each index.
+	std::partial_sum(marks.begin(), marks.end(), marks.begin());
+	if (marks.back() == 0) {
+		return;
+	}
+	auto isMarked = [&marks](LeafListSizeType index) {
+		return marks[index + 1] != marks[index];
+	};
+	
+	// If there are gaps, then the remaining leafs of each node are shifted
+	// down, leaving gaps at the end of the node. Otherwise, the whole leaf
+	// list is compacted in a single pass.
+	if (LeafGaps) {
+		for (NodeInternal const& node : _nodes) {
+			if (node.hasChildren) {
+				continue;
+			}
+			LeafListSizeType leafEnd = node.leafIndex + node.leafCount;
+			LeafListSizeType writeIndex = node.leafIndex;
+			for (
+					LeafListSizeType readIndex = node.leafIndex;
+					readIndex < leafEnd;
+					++readIndex) {
+				if (!isMarked(readIndex)) {
+					if (writeIndex != readIndex) {
+						*(_leafs.begin() + writeIndex) =
+							std::move(*(_leafs.begin() + readIndex));
+					}
+					++writeIndex;
+				}
+			}
+			std::fill(
+				_leafGaps.begin() + writeIndex,
+				_leafGaps.begin() + leafEnd,
+				true);
+		}
+	}
+	else {
+		LeafListSizeType writeIndex = 0;
+		for (
+				LeafListSizeType readIndex = 0;
+				readIndex < _leafs.size();
+				++readIndex) {
+			if (!isMarked(readIndex)) {
+				if (writeIndex != readIndex) {
+					*(_leafs.begin() + writeIndex) =
+						std::move(*(_leafs.begin() + readIndex));
+				}
+				++writeIndex;
+			}
+		}
+		_leafs.erase(_leafs.begin() + writeIndex, _leafs.end());
+	}
+	
+	// Then fix up the nodes in a single pass. Each node loses the removed leafs
+	// in its section of the leaf list, and without gaps, it is shifted down by
+	// the number of removed leafs before it. A node that loses leafs is marked
+	// as changed, and so are its ancestors, since they lose the same leafs.
+	for (NodeListSizeType index = 0; index < _nodes.size(); ++index) {
+		LeafListSizeType leafEnd = leafEndIndex(index);
+		NodeInternal& node = _nodes[index];
+		LeafListSizeType removedCount = marks[leafEnd] - marks[node.leafIndex];
+		node.leafCount -= removedCount;
+		node.changed = node.changed || removedCount != 0;
+		if (!LeafGaps) {
+			node.leafIndex -= marks[node.leafIndex];
+		}
+	}
+	
+	if (_autoAdjust) {
+		adjust();
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::mergeLeafs(
+		ScratchVector<LeafInternal>& newLeafs,
+		ScratchVector<NodeListSizeType>& nodeIndices) {
+	if (newLeafs.empty()) {
+		return;
+	}
+	checkLeafListSize(_leafs.size() + newLeafs.size());
+	
+	// Sort the new leafs by node. The sort is stable, so the leafs end up in
+	// the same order as if they had been inserted one at a time.
+	ScratchVector<LeafListSizeType> order(
+		newLeafs.size(),
+		scratchAllocator<LeafListSizeType>());
+	for (LeafListSizeType index = 0; index < order.size(); ++index) {
+		order[index] = index;
+	}
+	std::size_t nodeBits = 0;
+	while ((std::size_t(1) << nodeBits) < _nodes.size()) {
+		++nodeBits;
+	}
+	internal::radixSort(nodeIndices, order, nodeBits);
+	
+	// Merge the new leafs into the leaf list, starting from the back, so that
+	// each of the old leafs is moved only once. The new leafs of a node go
+	// after its old leafs.
+	LeafListSizeType readIndex = _leafs.size();
+	_leafs.insert(_leafs.end(), newLeafs.size(), newLeafs.front());
+	LeafListSizeType writeIndex = _leafs.size();
+	for (std::size_t index = newLeafs.size(); index-- > 0; ) {
+		NodeInternal const& node = _nodes[nodeIndices[index]];
+		LeafListSizeType leafEnd = node.leafIndex + node.leafCount;
+		std::move_backward(
+			_leafs.begin() + leafEnd,
+			_leafs.begin() + readIndex,
+			_leafs.begin() + writeIndex);
+		writeIndex -= readIndex - leafEnd + 1;
+		readIndex = leafEnd;
+		*(_leafs.begin() + writeIndex) = std::move(newLeafs[order[index]]);
+	}
+	
+	// Then fix up the nodes in a single pass. Each node is shifted by the
+	// number of new leafs in the nodes before it, and grows by the number of
+	// new leafs in its subtree.
+	ScratchVector<LeafListSizeType> leafOffsets(
+		_nodes.size() + 1,
+		0,
+		scratchAllocator<LeafListSizeType>());
+	for (NodeListSizeType nodeIndex : nodeIndices) {
+		++leafOffsets[nodeIndex + 1];
+	}
+	std::partial_sum(
+		leafOffsets.begin(),
+		leafOffsets.end(),
+		leafOffsets.begin());
+	for (NodeListSizeType index = 0; index < _nodes.size(); ++index) {
+		NodeInternal& node = _nodes[index];
+		LeafListSizeType addedCount =
+			leafOffsets[index + subtreeSize(index)] - leafOffsets[index];
+		node.leafCount += addedCount;
+		node.leafIndex += leafOffsets[index];
+		node.changed = node.changed || addedCount != 0;
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::LeafIterator
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::moveAt(
+		NodeIterator sourceNode,
+		NodeIterator destNode,
+		LeafIterator sourceLeaf) {
+	markChanged(sourceNode._index);
+	markChanged(destNode._index);
+	LeafIterator destLeaf = destNode->leafs.end();
+	LeafIterator result = sourceLeaf;
+	// Determine the relative order of the source and destination iterators.
+	if (destLeaf > sourceLeaf) {
+		// Perform a left rotation.
+		LeafInternal oldLeafInternal = *sourceLeaf.internalIt();
+		std::move(
+			sourceLeaf.internalIt() + 1,
+			destLeaf.internalIt(),
+			sourceLeaf.internalIt());
+		result = destLeaf - 1;
+		*result.internalIt() = oldLeafInternal;
+	}
+	else if (destLeaf < sourceLeaf) {
+		// Perform a right rotation.
+		LeafInternal oldLeafInternal = *sourceLeaf.internalIt();
+		std::move_backward(
+			destLeaf.internalIt(),
+			sourceLeaf.internalIt(),
+			sourceLeaf.internalIt() + 1);
+		result = destLeaf;
+		*result.internalIt() = oldLeafInternal;
+	}
+	
+	// Adjust the ancestors of the destination node to all have one more leaf.
+	NodeIterator destParentNode = destNode;
+	++destNode.internalIt()->leafCount;
+	while (destParentNode->hasParent) {
+		destParentNode = destParentNode->parent;
+		++destParentNode.internalIt()->leafCount;
+	}
+	
+	// Adjust the ancestors of the source node to all have one less leaf. Note
+	// that integer underflow will not occur because of the previous loop.
+	NodeIterator sourceParentNode = sourceNode;
+	--sourceNode.internalIt()->leafCount;
+	while (sourceParentNode->hasParent) {
+		sourceParentNode = sourceParentNode->parent;
+		--sourceParentNode.internalIt()->leafCount;
+	}
+	
+	// Adjust the leaf indices of the nodes between the source and destination.
+	bool nodeInverted = (sourceNode >= destNode);
+	signed char leafIndexOffset = nodeInverted ? +1 : -1;
+	NodeIterator firstNode = nodeInverted ? destNode : sourceNode;
+	NodeIterator lastNode = nodeInverted ? sourceNode : destNode;
+	++firstNode;
+	++lastNode;
+	for (NodeIterator node = firstNode; node != lastNode; ++node) {
+		node.internalIt()->leafIndex += leafIndexOffset;
+	}
+	
+	return result;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::updateLeafCounts(
+		NodeListSizeType nodeIndex,
+		LeafListDifferenceType change) {
+	// Go through the node and all of its ancestors.
+	while (true) {
+		_nodes[nodeIndex].leafCount += change;
+		if (nodeIndex == 0) {
+			break;
+		}
+		nodeIndex += _nodes[nodeIndex].parentIndex;
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::NodeListSizeType
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::findChildIndex(
+		NodeInternal const& node,
+		Vector const& point) const {
+	GeometryReference position = nodePosition(node);
+	GeometryReference dimensions = nodeDimensions(node);
+	NodeListSizeType childIndex = 0;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		if (point[dim] - position[dim] >= dimensions[dim] / 2) {
+			childIndex += (1 << dim);
+		}
+	}
+	return childIndex;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::LeafListSizeType
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::leafEndIndex(
+		NodeListSizeType nodeIndex) const {
+	NodeInternal const& node = _nodes[nodeIndex];
+	if (!LeafGaps) {
+		return node.leafIndex + node.leafCount;
+	}
+	// The section of the leaf list belonging to a node ends where the section
+	// of the next node after its descendants begins.
+	NodeListSizeType nextIndex = nodeIndex + subtreeSize(nodeIndex);
+	if (nextIndex < _nodes.size()) {
+		return _nodes[nextIndex].leafIndex;
+	}
+	else {
+		return _leafs.size();
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+std::uint64_t
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::boxLeafMask(
+		LeafListSizeType leafIndex,
+		std::size_t count,
+		std::array<Scalar, Dim> const& lower,
+		std::array<Scalar, Dim> const& dimensions,
+		std::false_type) const {
+	std::uint64_t result = 0;
+	for (std::size_t offset = 0; offset < count; ++offset) {
+		Vector const& position = _leafs[leafIndex + offset].position;
+		bool inside = true;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			inside = inside &
+				(position[dim] >= lower[dim]) &
+				(position[dim] - lower[dim] < dimensions[dim]);
+		}
+		result |= static_cast<std::uint64_t>(inside) << offset;
+	}
+	return result;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+std::uint64_t
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::boxLeafMask(
+		LeafListSizeType leafIndex,
+		std::size_t count,
+		std::array<Scalar, Dim> const& lower,
+		std::array<Scalar, Dim> const& dimensions,
+		std::true_type) const {
+	std::array<Scalar const*, Dim> coordinates;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		coordinates[dim] = _leafs.coordinates(dim) + leafIndex;
+	}
+	return internal::boxMask<Dim>(
+		coordinates.data(),
+		count,
+		lower.data(),
+		dimensions.data());
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+std::uint64_t
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::ballLeafMask(
+		LeafListSizeType leafIndex,
+		std::size_t count,
+		std::array<Scalar, Dim> const& center,
+		Scalar radiusSquared,
+		std::false_type) const {
+	std::uint64_t result = 0;
+	for (std::size_t offset = 0; offset < count; ++offset) {
+		Vector const& position = _leafs[leafIndex + offset].position;
+		Scalar distance = 0;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			Scalar delta = position[dim] - center[dim];
+			distance += delta * delta;
+		}
+		bool inside = distance <= radiusSquared;
+		result |= static_cast<std::uint64_t>(inside) << offset;
+	}
+	return result;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+std::uint64_t
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::ballLeafMask(
+		LeafListSizeType leafIndex,
+		std::size_t count,
+		std::array<Scalar, Dim> const& center,
+		Scalar radiusSquared,
+		std::true_type) const {
+	std::array<Scalar const*, Dim> coordinates;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		coordinates[dim] = _leafs.coordinates(dim) + leafIndex;
+	}
+	return internal::ballMask<Dim>(
+		coordinates.data(),
+		count,
+		center.data(),
+		radiusSquared);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::
+LeafListDifferenceType
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::nextLeafIndex(
+		LeafListDifferenceType index) const {
+	LeafListDifferenceType size = _leafGaps.size();
+	while (index < size && _leafGaps[index]) {
+		++index;
+	}
+	return index;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::
+LeafListDifferenceType
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::prevLeafIndex(
+		LeafListDifferenceType index) const {
+	while (index >= 0 && _leafGaps[index]) {
+		--index;
+	}
+	return index;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::
+LeafListDifferenceType
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::leafDistance(
+		LeafListDifferenceType lowerIndex,
+		LeafListDifferenceType upperIndex) const {
+	if (!LeafGaps) {
+		return upperIndex - lowerIndex;
+	}
+	return leafRank(upperIndex) - leafRank(lowerIndex);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::
+LeafListDifferenceType
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::leafRank(
+		LeafListDifferenceType index) const {
+	if (index < 0) {
+		return -1;
+	}
+	// The leafs of a node without children come first in its section of the
+	// leaf list, followed by its gaps. The section of a child ends where the
+	// section of the next child begins.
+	NodeListSizeType nodeIndex = 0;
+	LeafListDifferenceType leafEnd = _leafs.size();
+	LeafListDifferenceType rank = 0;
+	while (_nodes[nodeIndex].hasChildren) {
+		NodeListSizeType children[1 << Dim];
+		childIndices(nodeIndex, children);
+		std::size_t childIndex = 0;
+		for (; childIndex < (1 << Dim); ++childIndex) {
+			LeafListDifferenceType childEnd = childIndex + 1 < (1 << Dim) ?
+				_nodes[children[childIndex + 1]].leafIndex :
+				leafEnd;
+			if (index < childEnd) {
+				leafEnd = childEnd;
+				break;
+			}
+			rank += _nodes[children[childIndex]].leafCount;
+		}
+		if (childIndex == (1 << Dim)) {
+			return rank;
+		}
+		nodeIndex = children[childIndex];
+	}
+	NodeInternal const& node = _nodes[nodeIndex];
+	return rank + std::min<LeafListDifferenceType>(
+		index - node.leafIndex,
+		node.leafCount);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::
+LeafListDifferenceType
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::leafAtRank(
+		LeafListDifferenceType rank) const {
+	if (rank < 0) {
+		return -1;
+	}
+	LeafListSizeType count = rank;
+	if (count >= _nodes[0].leafCount) {
+		return _leafs.size();
+	}
+	NodeListSizeType nodeIndex = 0;
+	while (_nodes[nodeIndex].hasChildren) {
+		NodeListSizeType children[1 << Dim];
+		childIndices(nodeIndex, children);
+		std::size_t childIndex = 0;
+		while (count >= _nodes[children[childIndex]].leafCount) {
+			count -= _nodes[children[childIndex]].leafCount;
+			++childIndex;
+		}
+		nodeIndex = children[childIndex];
+	}
+	return _nodes[nodeIndex].leafIndex + count;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::spreadLeafs(
+		LeafListSizeType gapSize,
+		NodeListSizeType nodeIndex) {
+	// Copy the leafs into a new list in one pass, leaving gaps after the leafs
+	// of every node without children. The gaps are filled with a placeholder
+	// value.
+	LeafList newLeafs;
+	typename Details::template VectorType<bool> newLeafGaps;
+	std::size_t newSize =
+		std::size_t(_nodes[0].leafCount) + std::size_t(gapSize) * _nodes.size();
+	checkLeafListSize(newSize);
+	newLeafs.reserve(newSize);
+	newLeafGaps.reserve(newSize);
+	LeafInternal gap(_position);
+	for (NodeListSizeType index = 0; index < _nodes.size(); ++index) {
+		NodeInternal& node = _nodes[index];
+		LeafListSizeType oldLeafIndex = node.leafIndex;
+		node.leafIndex = newLeafs.size();
+		if (!node.hasChildren) {
+			LeafListSizeType nodeGapSize =
+				node.leafCount != 0 || index == nodeIndex ? gapSize : 0;
+			newLeafs.insert(
+				newLeafs.end(),
+				_leafs.begin() + oldLeafIndex,
+				_leafs.begin() + oldLeafIndex + node.leafCount);
+			newLeafs.insert(newLeafs.end(), nodeGapSize, gap);
+			newLeafGaps.insert(newLeafGaps.end(), node.leafCount, false);
+			newLeafGaps.insert(newLeafGaps.end(), nodeGapSize, true);
+		}
+	}
+	_leafs.swap(newLeafs);
+	_leafGaps.swap(newLeafGaps);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::growLeafs(
+		NodeListSizeType nodeIndex) {
+	// Look for the closest node without children that has a gap to spare. The
+	// leafs in between the two nodes are shifted over by one to move the gap.
+	// Only the leaf indices of the nodes in between have to be updated.
+	NodeListSizeType const searchLimit = 8 * (1 << Dim);
+	LeafListSizeType leafEnd = leafEndIndex(nodeIndex);
+	for (NodeListSizeType offset = 1; offset <= searchLimit; ++offset) {
+		if (nodeIndex + offset < _nodes.size()) {
+			NodeListSizeType otherIndex = nodeIndex + offset;
+			NodeInternal const& other = _nodes[otherIndex];
+			LeafListSizeType gapIndex = other.leafIndex + other.leafCount;
+			if (!other.hasChildren && gapIndex != leafEndIndex(otherIndex)) {
+				// Take the first gap of the later node.
+				std::move_backward(
+					_leafs.begin() + leafEnd,
+					_leafs.begin() + gapIndex,
+					_leafs.begin() + gapIndex + 1);
+				_leafGaps[gapIndex] = false;
+				_leafGaps[leafEnd] = true;
+				for (
+						NodeListSizeType index = nodeIndex + 1;
+						index <= otherIndex;
+						++index) {
+					++_nodes[index].leafIndex;
+				}
+				return;
+			}
+		}
+		if (offset <= nodeIndex) {
+			NodeListSizeType otherIndex = nodeIndex - offset;
+			NodeInternal const& other = _nodes[otherIndex];
+			LeafListSizeType gapEnd = leafEndIndex(otherIndex);
+			if (!other.hasChildren && other.leafIndex + other.leafCount != gapEnd) {
+				// Take the last gap of the earlier node.
+				std::move(
+					_leafs.begin() + gapEnd,
+					_leafs.begin() + leafEnd,
+					_leafs.begin() + gapEnd - 1);
+				_leafGaps[gapEnd - 1] = false;
+				_leafGaps[leafEnd - 1] = true;
+				for (
+						NodeListSizeType index = otherIndex + 1;
+						index <= nodeIndex;
+						++index) {
+					--_nodes[index].leafIndex;
+				}
+				return;
+			}
+		}
+	}
+	// If there were no gaps nearby, then redistribute the gaps throughout the
+	// whole leaf list.
+	spreadLeafs(Details::LeafGapSize, nodeIndex);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::MortonKey
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::mortonKey(
+		Vector const& point,
+		NodeInternal const& node,
+		NodeListSizeType levels) const {
+	return mortonKey(
+		point,
+		node,
+		levels,
+		std::integral_constant<bool, Details::ImplicitGeometry>());
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::MortonKey
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::mortonKey(
+		Vector const& point,
+		NodeInternal const& node,
+		NodeListSizeType levels,
+		std::false_type) const {
+	// Descend through the levels of the orthtree in the same way as
+	// findChildIndex and allocChildren do, so that the key agrees with them
+	// exactly even for points on the boundary between two nodes.
+	Vector position = node.position;
+	Vector dimensions = node.dimensions;
+	MortonKey key = 0;
+	for (NodeListSizeType level = 0; level < levels; ++level) {
+		MortonKey childIndex = 0;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			// This is written without branches, since the branch would be
+			// impossible to predict. Adding zero leaves the position unchanged.
+			auto halfDimension = dimensions[dim] / 2;
+			bool upper = point[dim] - position[dim] >= halfDimension;
+			childIndex |= MortonKey(upper) << dim;
+			position[dim] = position[dim] + halfDimension * upper;
+			dimensions[dim] = halfDimension;
+		}
+		key = (key << Dim) | childIndex;
+	}
+	return key;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::MortonKey
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::mortonKey(
+		Vector const& point,
+		NodeInternal const& node,
+		NodeListSizeType levels,
+		std::true_type) const {
+	// With implicit geometry, the bounds of each cell are found in the same
+	// way as nodePosition and nodeDimensions do, instead of by halving.
+	std::array<std::uint32_t, Dim> cell = node.cell;
+	MortonKey key = 0;
+	for (NodeListSizeType level = 0; level < levels; ++level) {
+		Scalar scale = cellScale(node.depth + level);
+		MortonKey childIndex = 0;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			Scalar lower = cellLower(dim, cell[dim], scale);
+			bool upper = point[dim] - lower >= cellSize(dim, scale) / 2;
+			childIndex |= MortonKey(upper) << dim;
+			cell[dim] = 2 * cell[dim] + upper;
+		}
+		key = (key << Dim) | childIndex;
+	}
+	return key;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::permuteLeafs(
+		LeafListSizeType leafIndex,
+		ScratchVector<LeafListSizeType>& order) {
+	// Follow each cycle of the permutation, so that a second copy of the leafs
+	// isn't needed. Each entry of `order` is reset once its leaf is in place.
+	for (LeafListSizeType start = 0; start < order.size(); ++start) {
+		if (order[start] == start) {
+			continue;
+		}
+		LeafInternal leaf(std::move(_leafs[leafIndex + start]));
+		LeafListSizeType index = start;
+		while (order[index] != start) {
+			LeafListSizeType source = order[index];
+			_leafs[leafIndex + index] = std::move(_leafs[leafIndex + source]);
+			order[index] = index;
+			index = source;
+		}
+		_leafs[leafIndex + index] = std::move(leaf);
+		order[index] = index;
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::buildChildren(
+		NodeList& nodes,
+		NodeListSizeType nodeIndex,
+		ScratchVector<MortonKey> const& keys,
+		NodeListSizeType levels,
+		NodeListSizeType depthLimit) const {
+	NodeInternal node = nodes[nodeIndex];
+	if (
+			node.leafCount <= _nodeCapacity ||
+			node.depth >= _maxDepth ||
+			node.depth >= levels ||
+			node.depth >= depthLimit) {
+		return;
+	}
+	nodes[nodeIndex].hasChildren = true;
+	
+	// The leafs of the node are sorted by key, so the leafs of each child are
+	// found with a binary search on the part of the key for this level.
+	std::size_t shift = (levels - node.depth - 1) * Dim;
+	auto childIndexOf = [shift](MortonKey key) {
+		return (key >> shift) & ((MortonKey(1) << Dim) - 1);
+	};
+	auto keyBegin = keys.begin() + node.leafIndex;
+	auto keyEnd = keyBegin + node.leafCount;
+	for (std::size_t index = 0; index < (1 << Dim); ++index) {
+		auto childKeyEnd = std::partition_point(
+			keyBegin,
+			keyEnd,
+			[&](MortonKey key) {
+				return childIndexOf(key) <= index;
+			});
+		NodeListSizeType childNodeIndex = nodes.size();
+		NodeInternal child(_position, _dimensions);
+		child.depth = node.depth + 1;
+		child.parentIndex = -static_cast<NodeListDifferenceType>(
+			childNodeIndex - nodeIndex);
+		child.siblingIndex = index;
+		child.leafIndex = keyBegin - keys.begin();
+		child.leafCount = childKeyEnd - keyBegin;
+		setChildGeometry(node, index, child);
+		nodes.push_back(child);
+		setChildOffset(nodes[nodeIndex], index, childNodeIndex - nodeIndex);
+		buildChildren(nodes, childNodeIndex, keys, levels, depthLimit);
+		keyBegin = childKeyEnd;
+	}
+	nodes[nodeIndex].childIndices[NodeInternal::ChildIndexCount - 1] =
+		nodes.size() - nodeIndex;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename OverlapF, typename ContainsF, typename F>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::queryIndices(
+		OverlapF overlap,
+		ContainsF contains,
+		F visit) const {
+	// The current section of the leaf list, which is extended for as long as
+	// possible before it is visited.
+	LeafListSizeType lowerIndex = 0;
+	LeafListSizeType upperIndex = 0;
+	LeafListSizeType size = 0;
+	auto addSection = [&](
+			LeafListSizeType sectionLowerIndex,
+			LeafListSizeType sectionUpperIndex,
+			LeafListSizeType sectionSize) {
+		if (sectionSize == 0) {
+			return;
+		}
+		if (size != 0 && sectionLowerIndex != upperIndex) {
+			visit(lowerIndex, upperIndex, size);
+			size = 0;
+		}
+		if (size == 0) {
+			lowerIndex = sectionLowerIndex;
+		}
+		upperIndex = sectionUpperIndex;
+		size += sectionSize;
+	};
+	
+	// Go through the nodes in depth-first order. Since the descendants of a
+	// node come right after it, a node can be skipped together with all of its
+	// descendants by jumping ahead by the size of the subtree.
+	NodeListSizeType nodeIndex = 0;
+	while (nodeIndex < _nodes.size()) {
+		NodeInternal const& node = _nodes[nodeIndex];
+		Overlap nodeOverlap =
+			node.leafCount == 0 ? Overlap::Outside : overlap(node);
+		if (nodeOverlap == Overlap::Outside) {
+			nodeIndex += subtreeSize(nodeIndex);
+		}
+		else if (nodeOverlap == Overlap::Inside) {
+			addSection(node.leafIndex, leafEndIndex(nodeIndex), node.leafCount);
+			nodeIndex += subtreeSize(nodeIndex);
+		}
+		else if (node.hasChildren) {
+			nodeIndex += 1;
+		}
+		else {
+			// The leafs of a node without children come before any gaps. The
+			// gaps are included with the last leaf so that the section can be
+			// joined with the one after it.
+			LeafListSizeType leafEnd = node.leafIndex + node.leafCount;
+			for (
+					LeafListSizeType blockIndex = node.leafIndex;
+					blockIndex < leafEnd;
+					blockIndex += internal::MaskWidth) {
+				std::size_t count = std::min<LeafListSizeType>(
+					leafEnd - blockIndex,
+					internal::MaskWidth);
+				std::uint64_t mask = contains(blockIndex, count);
+				while (mask != 0) {
+					LeafListSizeType leafIndex =
+						blockIndex + internal::lowestBit(mask);
+					mask &= mask - 1;
+					addSection(
+						leafIndex,
+						leafIndex + 1 == leafEnd ?
+							leafEndIndex(nodeIndex) :
+							leafIndex + 1,
+						1);
+				}
+			}
+			nodeIndex += 1;
+		}
+	}
+	if (size != 0) {
+		visit(lowerIndex, upperIndex, size);
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename F>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::queryBoxIndices(
+		Vector const& position,
+		Vector const& dimensions,
+		F visit) const {
+	auto overlap = [&](NodeInternal const& node) {
+		GeometryReference nodePosition = this->nodePosition(node);
+		GeometryReference nodeDimensions = this->nodeDimensions(node);
+		bool outside = false;
+		bool inside = true;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			Scalar lower = nodePosition[dim] - position[dim];
+			Scalar upper = lower + nodeDimensions[dim];
+			if (Loose) {
+				lower -= looseMargin(dim);
+				upper += looseMargin(dim);
+			}
+			outside = outside || upper <= 0 || lower >= dimensions[dim];
+			inside = inside && lower >= 0 && upper <= dimensions[dim];
+		}
+		return
+			outside ? Overlap::Outside :
+			inside ? Overlap::Inside :
+			Overlap::Partial;
+	};
+	std::array<Scalar, Dim> lower;
+	std::array<Scalar, Dim> extent;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		lower[dim] = position[dim];
+		extent[dim] = dimensions[dim];
+	}
+	auto contains = [&](LeafListSizeType leafIndex, std::size_t count) {
+		return boxLeafMask(leafIndex, count, lower, extent);
+	};
+	queryIndices(overlap, contains, visit);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename F>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::queryBallIndices(
+		Vector const& point,
+		Scalar radius,
+		F visit) const {
+	Scalar radiusSquared = radius * radius;
+	auto overlap = [&](NodeInternal const& node) {
+		return
+			distanceSquared(node, point) > radiusSquared ? Overlap::Outside :
+			maxDistanceSquared(node, point) <= radiusSquared ? Overlap::Inside :
+			Overlap::Partial;
+	};
+	std::array<Scalar, Dim> center;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		center[dim] = point[dim];
+	}
+	auto contains = [&](LeafListSizeType leafIndex, std::size_t count) {
+		return ballLeafMask(leafIndex, count, center, radiusSquared);
+	};
+	queryIndices(overlap, contains, visit);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename Rule>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::dualTree(
+		Orthtree const& other,
+		Rule& rule,
+		std::size_t threadCount) const {
+	// Split this orthtree up into subtrees that are small enough to share out
+	// between the threads. Only nodes without children hold leafs of their
+	// own, so the subtrees cover all of the leafs. With a single thread, the
+	// whole orthtree is one subtree.
+	std::vector<NodeListSizeType> subtreeIndices;
+	NodeListSizeType grainSize = _nodes.size();
+	if (threadCount > 1) {
+		grainSize = std::max<NodeListSizeType>(
+			_nodes.size() / (8 * threadCount),
+			1);
+	}
+	NodeListSizeType nodeIndex = 0;
+	while (nodeIndex < _nodes.size()) {
+		NodeListSizeType size = subtreeSize(nodeIndex);
+		if (size <= grainSize) {
+			subtreeIndices.push_back(nodeIndex);
+			nodeIndex += size;
+		}
+		else {
+			nodeIndex += 1;
+		}
+	}
+	internal::parallelFor(threadCount, subtreeIndices.size(), 1, [&](
+			std::size_t begin,
+			std::size_t end) {
+		for (std::size_t index = begin; index < end; ++index) {
+			NodeListSizeType subtreeIndex = subtreeIndices[index];
+			Scalar score = rule.score(
+				NodeHandle(this, subtreeIndex),
+				NodeHandle(&other, 0));
+			if (score != std::numeric_limits<Scalar>::infinity()) {
+				dualTreeIndices(other, subtreeIndex, 0, rule);
+			}
+		}
+	});
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename Rule>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::dualTreeIndices(
+		Orthtree const& other,
+		NodeListSizeType nodeIndex,
+		NodeListSizeType otherNodeIndex,
+		Rule& rule) const {
+	NodeInternal const& node = _nodes[nodeIndex];
+	NodeInternal const& otherNode = other._nodes[otherNodeIndex];
+	if (node.leafCount == 0 || otherNode.leafCount == 0) {
+		return;
+	}
+	if (!node.hasChildren && !otherNode.hasChildren) {
+		bool same = this == &other;
+		LeafListSizeType leafEnd = node.leafIndex + node.leafCount;
+		LeafListSizeType otherLeafEnd =
+			otherNode.leafIndex + otherNode.leafCount;
+		for (
+				LeafListSizeType leafIndex = node.leafIndex;
+				leafIndex < leafEnd;
+				++leafIndex) {
+			for (
+					LeafListSizeType otherLeafIndex = otherNode.leafIndex;
+					otherLeafIndex < otherLeafEnd;
+					++otherLeafIndex) {
+				if (!same || leafIndex != otherLeafIndex) {
+					rule.baseCase(
+						ConstLeafIterator(this, leafIndex),
+						ConstLeafIterator(&other, otherLeafIndex));
+				}
+			}
+		}
+		return;
+	}
+	
+	// Split whichever node is larger along its longest side, or this one if
+	// they are the same size, and visit its children paired with the other
+	// node from lowest to highest score.
+	bool split = node.hasChildren;
+	if (node.hasChildren && otherNode.hasChildren) {
+		GeometryReference dimensions = nodeDimensions(node);
+		GeometryReference otherDimensions = other.nodeDimensions(otherNode);
+		Scalar size = 0;
+		Scalar otherSize = 0;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			size = std::max<Scalar>(size, dimensions[dim]);
+			otherSize = std::max<Scalar>(otherSize, otherDimensions[dim]);
+		}
+		split = size >= otherSize;
+	}
+	NodeListSizeType children[1 << Dim];
+	if (split) {
+		childIndices(nodeIndex, children);
+	}
+	else {
+		other.childIndices(otherNodeIndex, children);
+	}
+	auto score = [&](NodeListSizeType childIndex) {
+		return split ?
+			rule.score(
+				NodeHandle(this, childIndex),
+				NodeHandle(&other, otherNodeIndex)) :
+			rule.score(
+				NodeHandle(this, nodeIndex),
+				NodeHandle(&other, childIndex));
+	};
+	Scalar const infinity = std::numeric_limits<Scalar>::infinity();
+	// There are only a few children, so they are put in order with an
+	// insertion sort as they are scored.
+	std::pair<Scalar, NodeListSizeType> scores[1 << Dim];
+	std::size_t scoreCount = 0;
+	for (std::size_t child = 0; child < (1 << Dim); ++child) {
+		std::pair<Scalar, NodeListSizeType> entry(
+			score(children[child]),
+			children[child]);
+		if (entry.first == infinity) {
+			continue;
+		}
+		std::size_t index = scoreCount++;
+		while (index > 0 && entry < scores[index - 1]) {
+			scores[index] = scores[index - 1];
+			--index;
+		}
+		scores[index] = entry;
+	}
+	for (std::size_t index = 0; index < scoreCount; ++index) {
+		// Visiting the earlier pairs may have let the rule tighten its bounds,
+		// so the later pairs are scored again in case they can now be pruned.
+		NodeListSizeType childIndex = scores[index].second;
+		if (index != 0 && score(childIndex) == infinity) {
+			continue;
+		}
+		if (split) {
+			dualTreeIndices(other, childIndex, otherNodeIndex, rule);
+		}
+		else {
+			dualTreeIndices(other, nodeIndex, childIndex, rule);
+		}
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename Kernel, typename Criterion, typename F>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::barnesHutIndices(
+		Kernel const& kernel,
+		Criterion const& criterion,
+		F& visit,
+		std::size_t threadCount) const {
+	using Result = typename Kernel::Result;
+	// The leafs are evaluated in groups, one for each node without children.
+	std::vector<NodeListSizeType> targetIndices;
+	for (NodeListSizeType index = 0; index < _nodes.size(); ++index) {
+		if (!_nodes[index].hasChildren && _nodes[index].leafCount != 0) {
+			targetIndices.push_back(index);
+		}
+	}
+	internal::parallelFor(threadCount, targetIndices.size(), 16, [&](
+			std::size_t begin,
+			std::size_t end) {
+		// The nodes that act on the whole group as single bodies, and the
+		// nodes whose leafs act on the group one by one.
+		std::vector<NodeListSizeType> farIndices;
+		std::vector<NodeListSizeType> nearIndices;
+		std::vector<NodeListSizeType> stack;
+		for (std::size_t targetIndex = begin; targetIndex < end; ++targetIndex) {
+			NodeInternal const& target = _nodes[targetIndices[targetIndex]];
+			GeometryReference targetPosition = nodePosition(target);
+			GeometryReference targetDimensions = nodeDimensions(target);
+			farIndices.clear();
+			nearIndices.clear();
+			stack.assign(1, 0);
+			while (!stack.empty()) {
+				NodeListSizeType nodeIndex = stack.back();
+				stack.pop_back();
+				NodeInternal const& node = _nodes[nodeIndex];
+				if (node.leafCount == 0) {
+					continue;
+				}
+				// In a loose orthtree, the leafs of both nodes may be outside
+				// of them by the margin.
+				GeometryReference position = nodePosition(node);
+				GeometryReference dimensions = nodeDimensions(node);
+				Scalar size = 0;
+				Scalar distanceSquared = 0;
+				for (std::size_t dim = 0; dim < Dim; ++dim) {
+					Scalar margin = Loose ? looseMargin(dim) : Scalar(0);
+					Scalar center = position[dim] + dimensions[dim] / 2;
+					Scalar lower = targetPosition[dim] - margin - center;
+					Scalar upper = center -
+						(targetPosition[dim] + targetDimensions[dim] + margin);
+					Scalar delta = std::max(std::max(lower, upper), Scalar(0));
+					distanceSquared += delta * delta;
+					size = std::max(size, dimensions[dim] + 2 * margin);
+				}
+				if (criterion(size, distanceSquared)) {
+					farIndices.push_back(nodeIndex);
+				}
+				else if (!node.hasChildren) {
+					nearIndices.push_back(nodeIndex);
+				}
+				else {
+					NodeListSizeType children[1 << Dim];
+					childIndices(nodeIndex, children);
+					stack.insert(stack.end(), children, children + (1 << Dim));
+				}
+			}
+			
+			LeafListSizeType leafEnd = target.leafIndex + target.leafCount;
+			for (
+					LeafListSizeType leafIndex = target.leafIndex;
+					leafIndex < leafEnd;
+					++leafIndex) {
+				Vector const& position = _leafs[leafIndex].position;
+				Result result = Result();
+				for (NodeListSizeType nodeIndex : farIndices) {
+					kernel.node(result, position, _nodes[nodeIndex].value);
+				}
+				for (NodeListSizeType nodeIndex : nearIndices) {
+					NodeInternal const& node = _nodes[nodeIndex];
+					LeafListSizeType otherLeafEnd =
+						node.leafIndex + node.leafCount;
+					for (
+							LeafListSizeType otherLeafIndex = node.leafIndex;
+							otherLeafIndex < otherLeafEnd;
+							++otherLeafIndex) {
+						if (otherLeafIndex != leafIndex) {
+							kernel.leaf(
+								result,
+								position,
+								_leafs[otherLeafIndex].position,
+								_leafs[otherLeafIndex].value);
+						}
+					}
+				}
+				visit(leafIndex, result);
+			}
+		}
+	});
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename F>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::pairIndicesWithin(
+		NodeListSizeType nodeIndex,
+		NodeListSizeType otherNodeIndex,
+		Scalar radiusSquared,
+		F& visit) const {
+	NodeInternal const& node = _nodes[nodeIndex];
+	NodeInternal const& other = _nodes[otherNodeIndex];
+	if (node.leafCount == 0 || other.leafCount == 0) {
+		return;
+	}
+	if (
+			nodeIndex != otherNodeIndex &&
+			distanceSquared(node, other) > radiusSquared) {
+		return;
+	}
+	if (nodeIndex == otherNodeIndex && node.hasChildren) {
+		// Pair up the children with each other, including each child with
+		// itself.
+		NodeListSizeType children[1 << Dim];
+		childIndices(nodeIndex, children);
+		for (std::size_t index = 0; index < (1 << Dim); ++index) {
+			for (
+					std::size_t otherIndex = index;
+					otherIndex < (1 << Dim);
+					++otherIndex) {
+				pairIndicesWithin(
+					children[index],
+					children[otherIndex],
+					radiusSquared,
+					visit);
+			}
+		}
+	}
+	else if (
+			node.hasChildren &&
+			(!other.hasChildren || node.depth <= other.depth)) {
+		// Split the larger of the two nodes.
+		NodeListSizeType children[1 << Dim];
+		childIndices(nodeIndex, children);
+		for (std::size_t index = 0; index < (1 << Dim); ++index) {
+			pairIndicesWithin(
+				children[index],
+				otherNodeIndex,
+				radiusSquared,
+				visit);
+		}
+	}
+	else if (other.hasChildren) {
+		NodeListSizeType children[1 << Dim];
+		childIndices(otherNodeIndex, children);
+		for (std::size_t index = 0; index < (1 << Dim); ++index) {
+			pairIndicesWithin(
+				nodeIndex,
+				children[index],
+				radiusSquared,
+				visit);
+		}
+	}
+	else {
+		// Compare the leafs of the two nodes directly. If the nodes are the
+		// same, then each pair is only compared once.
+		LeafListSizeType leafEnd = node.leafIndex + node.leafCount;
+		LeafListSizeType otherLeafEnd = other.leafIndex + other.leafCount;
+		for (
+				LeafListSizeType leafIndex = node.leafIndex;
+				leafIndex < leafEnd;
+				++leafIndex) {
+			std::array<Scalar, Dim> center;
+			Vector const& position = _leafs[leafIndex].position;
+			for (std::size_t dim = 0; dim < Dim; ++dim) {
+				center[dim] = position[dim];
+			}
+			LeafListSizeType otherLeafBegin =
+				nodeIndex == otherNodeIndex ? leafIndex + 1 : other.leafIndex;
+			for (
+					LeafListSizeType blockIndex = otherLeafBegin;
+					blockIndex < otherLeafEnd;
+					blockIndex += internal::MaskWidth) {
+				std::size_t count = std::min<LeafListSizeType>(
+					otherLeafEnd - blockIndex,
+					internal::MaskWidth);
+				std::uint64_t mask =
+					ballLeafMask(blockIndex, count, center, radiusSquared);
+				while (mask != 0) {
+					visit(leafIndex, blockIndex + internal::lowestBit(mask));
+					mask &= mask - 1;
+				}
+			}
+		}
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::nearestIndices(
+		NodeListSizeType nodeIndex,
+		Vector const& point,
+		LeafListSizeType k,
+		std::vector<std::pair<Scalar, LeafListSizeType> >& heap) const {
+	if (nodeIndex == 0) {
+		heap.clear();
+		if (k == 0) {
+			return;
+		}
+	}
+	NodeInternal const& node = _nodes[nodeIndex];
+	if (!node.hasChildren) {
+		std::array<Scalar, Dim> center;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			center[dim] = point[dim];
+		}
+		LeafListSizeType leafEnd = node.leafIndex + node.leafCount;
+		for (
+				LeafListSizeType blockIndex = node.leafIndex;
+				blockIndex < leafEnd;
+				blockIndex += internal::MaskWidth) {
+			std::size_t count = std::min<LeafListSizeType>(
+				leafEnd - blockIndex,
+				internal::MaskWidth);
+			// Once the heap is full, only leafs that are at least as close as
+			// the furthest leaf in the heap can be added to it. The heap only
+			// gets closer, so the leafs that pass this test are checked again.
+			std::uint64_t mask = heap.size() < k ?
+				internal::lowMask(count) :
+				ballLeafMask(blockIndex, count, center, heap.front().first);
+			while (mask != 0) {
+				LeafListSizeType leafIndex =
+					blockIndex + internal::lowestBit(mask);
+				mask &= mask - 1;
+				Vector const& position = _leafs[leafIndex].position;
+				Scalar distance = 0;
+				for (std::size_t dim = 0; dim < Dim; ++dim) {
+					Scalar delta = position[dim] - center[dim];
+					distance += delta * delta;
+				}
+				std::pair<Scalar, LeafListSizeType> entry(distance, leafIndex);
+				if (heap.size() < k) {
+					heap.push_back(entry);
+					std::push_heap(heap.begin(), heap.end());
+				}
+				else if (entry < heap.front()) {
+					std::pop_heap(heap.begin(), heap.end());
+					heap.back() = entry;
+					std::push_heap(heap.begin(), heap.end());
+				}
+			}
+		}
+		return;
+	}
+	
+	// Visit the children from closest to furthest. The child that contains the
+	// point is at a distance of zero, so it always comes first. A child that is
+	// exactly as far as the furthest leaf in the heap is still visited, since
+	// it may hold a leaf at that distance that comes earlier in depth-first
+	// order.
+	NodeListSizeType childNodeIndices[1 << Dim];
+	childIndices(nodeIndex, childNodeIndices);
+	std::pair<Scalar, NodeListSizeType> children[1 << Dim];
+	for (std::size_t index = 0; index < (1 << Dim); ++index) {
+		NodeListSizeType childIndex = childNodeIndices[index];
+		children[index].first = distanceSquared(_nodes[childIndex], point);
+		children[index].second = childIndex;
+	}
+	std::swap(children[0], children[findChildIndex(node, point)]);
+	std::sort(children + 1, children + (1 << Dim));
+	for (std::size_t index = 0; index < (1 << Dim); ++index) {
+		bool closer =
+			heap.size() < k ||
+			children[index].first <= heap.front().first;
+		if (closer && _nodes[children[index].second].leafCount != 0) {
+			nearestIndices(children[index].second, point, k, heap);
+		}
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename F>
+bool Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::traceRayIndices(
+		Vector const& origin,
+		Vector const& direction,
+		Scalar tMax,
+		F visit) const {
+	Scalar const infinity = std::numeric_limits<Scalar>::infinity();
+	Ray ray;
+	ray.origin = origin;
+	ray.mask = 0;
+	ray.tMax = tMax;
+	std::array<Scalar, Dim> tEnter;
+	std::array<Scalar, Dim> tExit;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		Scalar lower = _position[dim];
+		Scalar upper = _position[dim] + _dimensions[dim];
+		if (Loose) {
+			lower -= looseMargin(dim);
+			upper += looseMargin(dim);
+		}
+		ray.inverseDirection[dim] = 1 / direction[dim];
+		if (std::isinf(ray.inverseDirection[dim])) {
+			// The ray never crosses the faces along this axis, so it must start
+			// between them.
+			if (!(origin[dim] >= lower && origin[dim] < upper)) {
+				return true;
+			}
+			tEnter[dim] = -infinity;
+			tExit[dim] = infinity;
+		}
+		else {
+			if (direction[dim] < 0) {
+				ray.mask |= (std::size_t) 1 << dim;
+				std::swap(lower, upper);
+			}
+			tEnter[dim] = (lower - origin[dim]) * ray.inverseDirection[dim];
+			tExit[dim] = (upper - origin[dim]) * ray.inverseDirection[dim];
+		}
+	}
+	Scalar tNear = 0;
+	Scalar tFar = tMax;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		tNear = std::max(tNear, tEnter[dim]);
+		tFar = std::min(tFar, tExit[dim]);
+	}
+	if (tNear > tFar || _nodes[0].leafCount == 0) {
+		return true;
+	}
+	return traceRayIndices(0, ray, tEnter, tExit, visit);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename F>
+bool Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::traceRayIndices(
+		NodeListSizeType nodeIndex,
+		Ray const& ray,
+		std::array<Scalar, Dim> const& tEnter,
+		std::array<Scalar, Dim> const& tExit,
+		F& visit) const {
+	Scalar const infinity = std::numeric_limits<Scalar>::infinity();
+	NodeInternal const& node = _nodes[nodeIndex];
+	if (!node.hasChildren) {
+		Scalar tNear = 0;
+		Scalar tFar = ray.tMax;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			tNear = std::max(tNear, tEnter[dim]);
+			tFar = std::min(tFar, tExit[dim]);
+		}
+		return visit(nodeIndex, tNear, tFar);
+	}
+	
+	// Find where the ray crosses the planes that divide the node in half. The
+	// split is computed in the same way as when the children are created. If
+	// the ray is parallel to an axis, then it stays on one side of the plane.
+	GeometryReference position = nodePosition(node);
+	GeometryReference dimensions = nodeDimensions(node);
+	std::array<Scalar, Dim> tMiddle;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		Scalar middle = position[dim] + dimensions[dim] / 2;
+		if (std::isinf(ray.inverseDirection[dim])) {
+			tMiddle[dim] = ray.origin[dim] < middle ? infinity : -infinity;
+		}
+		else {
+			tMiddle[dim] =
+				(middle - ray.origin[dim]) * ray.inverseDirection[dim];
+		}
+	}
+	// Along the flipped axes, the ray can only move from a child to a child
+	// whose index has more bits set. It starts in the child that is on the far
+	// side of every plane crossed before it enters the node, and then crosses
+	// the remaining planes in order of `t`, setting one bit each time.
+	NodeListSizeType children[1 << Dim];
+	childIndices(nodeIndex, children);
+	Scalar tNear = 0;
+	Scalar tFar = ray.tMax;
+	std::size_t index = 0;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		tNear = std::max(tNear, tEnter[dim]);
+		tFar = std::min(tFar, tExit[dim]);
+	}
+	if (Loose) {
+		// The children of a loose node overlap by twice the margin around each
+		// plane, so the ray may be inside of several of them at once. Along
+		// each axis, the near child is left where the ray passes the plane
+		// plus the margin, and the far child is entered where the ray passes
+		// the plane minus the margin. Every child that the ray crosses is
+		// visited, in increasing order of where the ray enters it.
+		std::array<Scalar, Dim> tNearExit;
+		std::array<Scalar, Dim> tFarEnter;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			Scalar middle = position[dim] + dimensions[dim] / 2;
+			Scalar margin = looseMargin(dim);
+			if (std::isinf(ray.inverseDirection[dim])) {
+				tNearExit[dim] =
+					ray.origin[dim] < middle + margin ? infinity : -infinity;
+				tFarEnter[dim] =
+					ray.origin[dim] >= middle - margin ? -infinity : infinity;
+			}
+			else {
+				Scalar tMargin = margin * std::abs(ray.inverseDirection[dim]);
+				tNearExit[dim] = tMiddle[dim] + tMargin;
+				tFarEnter[dim] = tMiddle[dim] - tMargin;
+			}
+		}
+		struct Crossing {
+			Scalar tNear;
+			std::size_t index;
+		};
+		Crossing crossings[1 << Dim];
+		std::size_t crossingCount = 0;
+		for (index = 0; index < ((std::size_t) 1 << Dim); ++index) {
+			if (_nodes[children[index ^ ray.mask]].leafCount == 0) {
+				continue;
+			}
+			Scalar childTNear = tNear;
+			Scalar childTFar = tFar;
+			for (std::size_t dim = 0; dim < Dim; ++dim) {
+				if ((index >> dim) & 1) {
+					childTNear = std::max(childTNear, tFarEnter[dim]);
+				}
+				else {
+					childTFar = std::min(childTFar, tNearExit[dim]);
+				}
+			}
+			// There are only a few children, so they are put in order with an
+			// insertion sort as they are found.
+			if (childTNear <= childTFar) {
+				std::size_t position = crossingCount;
+				while (
+						position > 0 &&
+						crossings[position - 1].tNear > childTNear) {
+					crossings[position] = crossings[position - 1];
+					--position;
+				}
+				crossings[position] = Crossing { childTNear, index };
+				++crossingCount;
+			}
+		}
+		for (std::size_t i = 0; i < crossingCount; ++i) {
+			std::array<Scalar, Dim> childTEnter;
+			std::array<Scalar, Dim> childTExit;
+			for (std::size_t dim = 0; dim < Dim; ++dim) {
+				bool back = (crossings[i].index >> dim) & 1;
+				childTEnter[dim] = back ? tFarEnter[dim] : tEnter[dim];
+				childTExit[dim] = back ? tExit[dim] : tNearExit[dim];
+			}
+			if (!traceRayIndices(
+					children[crossings[i].index ^ ray.mask],
+					ray,
+					childTEnter,
+					childTExit,
+					visit)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		if (tMiddle[dim] < tNear) {
+			index |= (std::size_t) 1 << dim;
+		}
+	}
+	while (true) {
+		std::array<Scalar, Dim> childTEnter;
+		std::array<Scalar, Dim> childTExit;
+		std::size_t nextDim = Dim;
+		Scalar tNext = tFar;
+		for (std::size_t dim = 0; dim < Dim; ++dim) {
+			bool back = (index >> dim) & 1;
+			childTEnter[dim] = back ? tMiddle[dim] : tEnter[dim];
+			childTExit[dim] = back ? tExit[dim] : tMiddle[dim];
+			if (!back && tMiddle[dim] <= tNext) {
+				nextDim = dim;
+				tNext = tMiddle[dim];
+			}
+		}
+		NodeListSizeType childIndex = children[index ^ ray.mask];
+		if (
+				_nodes[childIndex].leafCount != 0 &&
+				!traceRayIndices(
+					childIndex,
+					ray,
+					childTEnter,
+					childTExit,
+					visit)) {
+			return false;
+		}
+		if (nextDim == Dim) {
+			break;
+		}
+		index |= (std::size_t) 1 << nextDim;
+	}
+	return true;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::Scalar
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::distanceSquared(
+		NodeInternal const& node,
+		Vector const& point) const {
+	GeometryReference position = nodePosition(node);
+	GeometryReference dimensions = nodeDimensions(node);
+	Scalar distance = 0;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		Scalar lower = position[dim] - point[dim];
+		Scalar upper = point[dim] - (position[dim] + dimensions[dim]);
+		if (Loose) {
+			lower -= looseMargin(dim);
+			upper -= looseMargin(dim);
+		}
+		Scalar delta = std::max(std::max(lower, upper), Scalar(0));
+		distance += delta * delta;
+	}
+	return distance;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::Scalar
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::maxDistanceSquared(
+		NodeInternal const& node,
+		Vector const& point) const {
+	GeometryReference position = nodePosition(node);
+	GeometryReference dimensions = nodeDimensions(node);
+	Scalar distance = 0;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		Scalar lower = point[dim] - position[dim];
+		Scalar upper = (position[dim] + dimensions[dim]) - point[dim];
+		if (Loose) {
+			lower += looseMargin(dim);
+			upper += looseMargin(dim);
+		}
+		Scalar delta = std::max(std::abs(lower), std::abs(upper));
+		distance += delta * delta;
+	}
+	return distance;
 }
 
 template<
@@ -337,64 +2275,119 @@ template<
 	typename LeafValue,
 	typename NodeValue,
 	typename Details>
-typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::LeafIterator
-Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::moveAt(
-		NodeIterator sourceNode,
-		NodeIterator destNode,
-		LeafIterator sourceLeaf) {
-	LeafIterator destLeaf = destNode->leafs.end();
-	LeafIterator result = sourceLeaf;
-	// Determine the relative order of the source and destination iterators.
-	if (destLeaf > sourceLeaf) {
-		// Perform a left rotation.
-		LeafInternal oldLeafInternal = *sourceLeaf.internalIt();
-		std::move(
-			sourceLeaf.internalIt() + 1,
-			destLeaf.internalIt(),
-			sourceLeaf.internalIt());
-		result = destLeaf - 1;
-		*result.internalIt() = oldLeafInternal;
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::Scalar
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::distanceSquared(
+		NodeInternal const& node,
+		NodeInternal const& other) const {
+	GeometryReference position = nodePosition(node);
+	GeometryReference dimensions = nodeDimensions(node);
+	GeometryReference otherPosition = nodePosition(other);
+	GeometryReference otherDimensions = nodeDimensions(other);
+	Scalar distance = 0;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		Scalar lower =
+			position[dim] - (otherPosition[dim] + otherDimensions[dim]);
+		Scalar upper =
+			otherPosition[dim] - (position[dim] + dimensions[dim]);
+		if (Loose) {
+			lower -= 2 * looseMargin(dim);
+			upper -= 2 * looseMargin(dim);
+		}
+		Scalar delta = std::max(std::max(lower, upper), Scalar(0));
+		distance += delta * delta;
 	}
-	else if (destLeaf < sourceLeaf) {
-		// Perform a right rotation.
-		LeafInternal oldLeafInternal = *sourceLeaf.internalIt();
-		std::move_backward(
-			destLeaf.internalIt(),
-			sourceLeaf.internalIt(),
-			sourceLeaf.internalIt() + 1);
-		result = destLeaf;
-		*result.internalIt() = oldLeafInternal;
+	return distance;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::buildSubtrees(
+		ScratchVector<MortonKey> const& keys,
+		NodeListSizeType levels,
+		NodeListSizeType depthLimit,
+		std::size_t threadCount) {
+	// Find the nodes at the depth limit that still need children, and build
+	// each of their subtrees separately.
+	internal::ArenaScope scope(_scratch);
+	ScratchVector<NodeListSizeType> subtreeIndices(
+		scratchAllocator<NodeListSizeType>());
+	for (NodeListSizeType index = 0; index < _nodes.size(); ++index) {
+		NodeInternal const& node = _nodes[index];
+		if (
+				node.depth == depthLimit &&
+				node.leafCount > _nodeCapacity &&
+				node.depth < _maxDepth) {
+			subtreeIndices.push_back(index);
+		}
 	}
+	ScratchVector<NodeList> subtrees(
+		subtreeIndices.size(),
+		NodeList(),
+		scratchAllocator<NodeList>());
+	internal::parallelFor(threadCount, subtrees.size(), 1, [&](
+			std::size_t begin,
+			std::size_t end) {
+		for (std::size_t index = begin; index < end; ++index) {
+			subtrees[index].push_back(_nodes[subtreeIndices[index]]);
+			buildChildren(subtrees[index], 0, keys, levels, levels);
+		}
+	});
 	
-	// Adjust the ancestors of the destination node to all have one more leaf.
-	NodeIterator destParentNode = destNode;
-	++destNode.internalIt()->leafCount;
-	while (destParentNode->hasParent) {
-		destParentNode = destParentNode->parent;
-		++destParentNode.internalIt()->leafCount;
+	// Splice the subtrees into the node list. The relative indices within each
+	// subtree stay the same, but the ones between the nodes that were built
+	// first have to be recalculated.
+	NodeListSizeType newSize = _nodes.size();
+	for (NodeList const& subtree : subtrees) {
+		newSize += subtree.size() - 1;
 	}
-	
-	// Adjust the ancestors of the source node to all have one less leaf. Note
-	// that integer underflow will not occur because of the previous loop.
-	NodeIterator sourceParentNode = sourceNode;
-	--sourceNode.internalIt()->leafCount;
-	while (sourceParentNode->hasParent) {
-		sourceParentNode = sourceParentNode->parent;
-		--sourceParentNode.internalIt()->leafCount;
+	NodeList newNodes;
+	newNodes.reserve(newSize);
+	ScratchVector<NodeListSizeType> newIndices(
+		_nodes.size(),
+		scratchAllocator<NodeListSizeType>());
+	auto subtreeIndex = subtreeIndices.begin();
+	auto subtree = subtrees.begin();
+	for (NodeListSizeType index = 0; index < _nodes.size(); ++index) {
+		newIndices[index] = newNodes.size();
+		if (subtreeIndex != subtreeIndices.end() && *subtreeIndex == index) {
+			newNodes.insert(newNodes.end(), subtree->begin(), subtree->end());
+			++subtreeIndex;
+			++subtree;
+		}
+		else {
+			newNodes.push_back(_nodes[index]);
+		}
 	}
-	
-	// Adjust the leaf indices of the nodes between the source and destination.
-	bool nodeInverted = (sourceNode >= destNode);
-	signed char leafIndexOffset = nodeInverted ? +1 : -1;
-	NodeIterator firstNode = nodeInverted ? destNode : sourceNode;
-	NodeIterator lastNode = nodeInverted ? sourceNode : destNode;
-	++firstNode;
-	++lastNode;
-	for (NodeIterator node = firstNode; node != lastNode; ++node) {
-		node.internalIt()->leafIndex += leafIndexOffset;
+	for (NodeListSizeType index = 0; index < _nodes.size(); ++index) {
+		NodeInternal const& oldNode = _nodes[index];
+		NodeInternal& newNode = newNodes[newIndices[index]];
+		if (index != 0) {
+			newNode.parentIndex =
+				static_cast<NodeListDifferenceType>(
+					newIndices[index + oldNode.parentIndex]) -
+				static_cast<NodeListDifferenceType>(newIndices[index]);
+		}
+		if (oldNode.hasChildren) {
+			NodeListSizeType children[1 << Dim];
+			childIndices(index, children);
+			for (std::size_t child = 0; child < (1 << Dim); ++child) {
+				setChildOffset(
+					newNode,
+					child,
+					newIndices[children[child]] - newIndices[index]);
+			}
+		}
+		NodeListSizeType next = index + subtreeSize(index);
+		NodeListSizeType newNext =
+			next < _nodes.size() ? newIndices[next] : newNodes.size();
+		newNode.childIndices[NodeInternal::ChildIndexCount - 1] =
+			newNext - newIndices[index];
 	}
-	
-	return result;
+	_nodes.swap(newNodes);
 }
 
 template<
@@ -405,7 +2398,7 @@ template<
 	typename Details>
 typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::LeafRange
 Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::leafs() {
-	return LeafRange(this, 0, _leafs.size());
+	return LeafRange(this, 0, _leafs.size(), _nodes[0].leafCount);
 }
 
 template<
@@ -416,7 +2409,7 @@ template<
 	typename Details>
 typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::ConstLeafRange
 Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::leafs() const {
-	return ConstLeafRange(this, 0, _leafs.size());
+	return ConstLeafRange(this, 0, _leafs.size(), _nodes[0].leafCount);
 }
 
 template<
@@ -427,7 +2420,7 @@ template<
 	typename Details>
 typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::ConstLeafRange
 Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::cleafs() const {
-	return ConstLeafRange(this, 0, _leafs.size());
+	return ConstLeafRange(this, 0, _leafs.size(), _nodes[0].leafCount);
 }
 
 template<
@@ -549,126 +2542,261 @@ template<
 	typename Details>
 bool Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::adjust(
 		NodeIterator node) {
-	// To do this in linear time, the current nodes need to be copied (with
-	// adjustments) into a new vector.
-	bool result = false;
-	
-	// Create a new orthtree with 'node' as the root to store the modified part.
-	Orthtree<Dim, Vector, LeafValue, NodeValue, Details> newOrthtree(
-		Vector(),
-		Vector(),
-		_nodeCapacity,
-		_maxDepth,
-		false);
-	// Reserve space in the new orthtree to hold copies of the node/leaf data.
-	newOrthtree.reserve(node->leafs.size());
-	newOrthtree._nodes.reserve(2 * (descendants(node).size() + 1));
-	std::copy(
-		node->leafs.begin().internalIt(),
-		node->leafs.end().internalIt(),
-		std::back_inserter(newOrthtree._leafs));
-	
-	// Set the root to be the node we are adjusting.
-	*newOrthtree.root().internalIt() = *node.internalIt();
-	LeafListSizeType leafOffset = node.internalIt()->leafIndex;
-	newOrthtree.root().internalIt()->leafIndex -= leafOffset;
+	// If there are gaps, then creating and destroying children never moves
+	// leafs outside of the node, so the descendants can be adjusted in place.
+	if (LeafGaps) {
+		bool result = false;
+		NodeListSizeType index = node._index;
+		NodeListSizeType endIndex = index + subtreeSize(index);
+		while (index < endIndex) {
+			NodeHandle current(this, index);
+			if (!current.hasChildren() && !canHoldLeafs(current, 0)) {
+				result = true;
+				createChildren(NodeIterator(this, index));
+				endIndex += (1 << Dim);
+			}
+			else if (current.hasChildren() && canMergeLeafs(current, 0)) {
+				result = true;
+				endIndex -= subtreeSize(index) - 1;
+				destroyChildren(NodeIterator(this, index));
+			}
+			++index;
+		}
+		return result;
+	}
 	
-	// Create a new set of adjusted nodes from the old set of nodes.
-	NodeIterator oldNode = node;
-	NodeIterator newNode = newOrthtree.root();
-	std::stack<NodeListDifferenceType> parentOffsets;
-	parentOffsets.push(0);
-	NodeListSizeType depth = newNode->depth;
-	while (newNode != newOrthtree.nodes().end()) {
-		// Adjust the parent offsets stack depending on whether we're going up
-		// or down in the orthtree.
-		while (newNode->depth > depth) {
-			++depth;
-			parentOffsets.push(0);
-		}
-		while (newNode->depth < depth) {
-			--depth;
-			NodeListDifferenceType lastTop = parentOffsets.top();
-			parentOffsets.pop();
-			parentOffsets.top() += lastTop;
+	// Without gaps, the new layout of the node and its descendants is built in
+	// a single pass over the old layout, in a buffer that is kept between
+	// calls. Neither destroying nor creating children moves any leafs outside
+	// of the node they belong to, so the leafs are only sorted in place, and
+	// the new layout can then be copied over the old one.
+	bool result = false;
+	internal::ArenaScope scope(_scratch);
+	ScratchVector<LeafInternal> buffer(scratchAllocator<LeafInternal>());
+	ScratchVector<NodeListSizeType> parents(
+		scratchAllocator<NodeListSizeType>());
+	NodeList& newNodes = _scratchNodes;
+	newNodes.clear();
+	NodeListSizeType const beginIndex = node._index;
+	NodeListSizeType const endIndex = beginIndex + subtreeSize(beginIndex);
+	// The new parents of the current node are kept in a stack. Once all of the
+	// descendants of a parent have been added, its subtree size is known.
+	auto finishParent = [&]() {
+		NodeListSizeType parentIndex = parents.back();
+		newNodes[parentIndex].childIndices[NodeInternal::ChildIndexCount - 1] =
+			newNodes.size() - parentIndex;
+		parents.pop_back();
+	};
+	// A node that is merged or split is marked as changed together with its
+	// new parents. The ancestors outside of the section are marked at the end.
+	auto markNewChanged = [&](NodeListSizeType newIndex) {
+		newNodes[newIndex].changed = true;
+		for (NodeListSizeType parentIndex : parents) {
+			newNodes[parentIndex].changed = true;
 		}
-		
-		// Adjust the parent offset.
-		newNode.internalIt()->parentIndex += parentOffsets.top();
-		
-		// If the node doesn't have children but should, create them.
-		if (!newNode->hasChildren && !newOrthtree.canHoldLeafs(newNode, 0)) {
+	};
+	NodeListSizeType index = beginIndex;
+	while (index < endIndex) {
+		NodeInternal const& oldNode = _nodes[index];
+		while (
+				!parents.empty() &&
+				newNodes[parents.back()].depth >= oldNode.depth) {
+			finishParent();
+		}
+		NodeListSizeType newIndex = newNodes.size();
+		newNodes.push_back(oldNode);
+		if (!parents.empty()) {
+			NodeListSizeType parentIndex = parents.back();
+			newNodes[newIndex].parentIndex =
+				-static_cast<NodeListDifferenceType>(newIndex - parentIndex);
+			setChildOffset(
+				newNodes[parentIndex],
+				oldNode.siblingIndex,
+				newIndex - parentIndex);
+		}
+		// If the node does have children but shouldn't, leave them out.
+		if (oldNode.hasChildren && canMergeLeafs(oldNode)) {
 			result = true;
-			newOrthtree.allocChildren(newNode);
-			parentOffsets.top() -= newOrthtree.updateNodeChildData(
-				newNode, true, false);
-			newOrthtree.distributeLeafs(newNode);
+			markNewChanged(newIndex);
+			NodeInternal& newNode = newNodes[newIndex];
+			newNode.hasChildren = false;
+			for (std::size_t child = 0; child < (1 << Dim); ++child) {
+				setChildOffset(newNode, child, 1);
+			}
+			newNode.childIndices[NodeInternal::ChildIndexCount - 1] = 1;
+			index += subtreeSize(index);
 		}
-		// If the node does have children but shouldn't, destroy them.
-		else if (newNode->hasChildren && newOrthtree.canHoldLeafs(newNode, 0)) {
+		// If the node doesn't have children but should, create them.
+		else if (!oldNode.hasChildren && !canHoldLeafs(oldNode)) {
 			result = true;
-			parentOffsets.top() -= newOrthtree.updateNodeChildData(
-				newNode, false, false);
-			// Skip the remaining children from the old list of nodes, since we
-			// won't be adding them anyway.
-			oldNode = oldNode->children[(1 << Dim)];
-			--oldNode;
+			markNewChanged(newIndex);
+			splitNode(newNodes, newIndex, buffer);
+			++index;
 		}
-		
-		// Continue to the next new node.
-		++newNode;
-		// If we've run out of nodes to process in the new set of nodes, then
-		// take the next node from the old set.
-		if (
-				newNode == newOrthtree.nodes().end() &&
-				oldNode + 1 != node->children[1 << Dim]) {
-			++oldNode;
-			newOrthtree._nodes.push_back(*oldNode.internalIt());
-			newNode.internalIt()->leafIndex -= leafOffset;
+		else {
+			if (oldNode.hasChildren) {
+				parents.push_back(newIndex);
+			}
+			++index;
 		}
 	}
-	
-	// Resize the section of the nodes vector used to store 'node' and its
-	// descendants so it can hold the new descendants.
-	NodeListDifferenceType change = newOrthtree.nodes().size();
-	change -= (1 + descendants(node).size());
-	if (change < 0) {
-		_nodes.erase(
-			node.internalIt(),
-			node.internalIt() + std::abs(change));
-	}
-	else if (change > 0) {
-		_nodes.insert(
-			node.internalIt(),
-			std::abs(change),
-			NodeInternal(Vector(), Vector()));
-	}
-	// Copy the new descendants into the node vector. Also overwrite the section
-	// of the leafs vector to account for changes due to creating children.
-	if (leafOffset != 0) {
-		std::for_each(
-			newOrthtree._nodes.begin(),
-			newOrthtree._nodes.end(),
-			[leafOffset](NodeInternal& nodeInternal) {
-				nodeInternal.leafIndex += leafOffset;
-			});
+	while (!parents.empty()) {
+		finishParent();
 	}
-	std::copy(
-		newOrthtree._nodes.begin(),
-		newOrthtree._nodes.end(),
-		node.internalIt());
-	std::copy(
-		newOrthtree._leafs.begin(),
-		newOrthtree._leafs.end(),
-		node->leafs.begin().internalIt());
 	
-	// Adjust all the ancestors of the node so they see the change in number of
-	// children.
-	updateAncestorChildData(node, change + 1);
+	// Replace the old section of the node list with the new one. The nodes
+	// after the section only have to be shifted once.
+	if (result) {
+		NodeListDifferenceType change =
+			static_cast<NodeListDifferenceType>(newNodes.size()) -
+			static_cast<NodeListDifferenceType>(endIndex - beginIndex);
+		if (change < 0) {
+			_nodes.erase(
+				_nodes.begin() + endIndex + change,
+				_nodes.begin() + endIndex);
+		}
+		else if (change > 0) {
+			checkNodeListSize(_nodes.size() + change);
+			_nodes.insert(
+				_nodes.begin() + endIndex,
+				change,
+				NodeInternal(_position, _dimensions));
+		}
+		std::copy(newNodes.begin(), newNodes.end(), _nodes.begin() + beginIndex);
+		// Adjust all the ancestors of the node so they see the change in number
+		// of children.
+		updateAncestorChildData(node, change);
+		markChanged(beginIndex);
+	}
+	newNodes.clear();
+	if (!Details::ScratchArena) {
+		NodeList().swap(newNodes);
+	}
 	
 	return result;
 }
 
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename LeafMap, typename Combine>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::reduce(
+		LeafMap leafMap,
+		Combine combine,
+		std::size_t threadCount) {
+	// Split the node list up into subtrees that are small enough to share
+	// out between the threads. The nodes above them are left for the end.
+	// With a single thread, the whole orthtree is one subtree.
+	internal::ArenaScope scope(_scratch);
+	ScratchVector<NodeListSizeType> subtreeIndices(
+		scratchAllocator<NodeListSizeType>());
+	ScratchVector<NodeListSizeType> upperIndices(
+		scratchAllocator<NodeListSizeType>());
+	NodeListSizeType grainSize = _nodes.size();
+	if (threadCount > 1) {
+		grainSize = std::max<NodeListSizeType>(
+			_nodes.size() / (8 * threadCount),
+			1);
+	}
+	NodeListSizeType nodeIndex = 0;
+	while (nodeIndex < _nodes.size()) {
+		NodeListSizeType size = subtreeSize(nodeIndex);
+		if (size <= grainSize) {
+			subtreeIndices.push_back(nodeIndex);
+			nodeIndex += size;
+		}
+		else {
+			upperIndices.push_back(nodeIndex);
+			nodeIndex += 1;
+		}
+	}
+	
+	// Within each subtree, the children of a node always come after it, so
+	// going backwards fills in the children before their parents.
+	internal::parallelFor(threadCount, subtreeIndices.size(), 1, [&](
+			std::size_t begin,
+			std::size_t end) {
+		for (std::size_t index = begin; index < end; ++index) {
+			NodeListSizeType subtreeIndex = subtreeIndices[index];
+			NodeListSizeType nodeIndex =
+				subtreeIndex + subtreeSize(subtreeIndex);
+			while (nodeIndex-- > subtreeIndex) {
+				reduceNode(nodeIndex, leafMap, combine);
+			}
+		}
+	});
+	for (std::size_t index = upperIndices.size(); index-- > 0;) {
+		reduceNode(upperIndices[index], leafMap, combine);
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename LeafMap, typename Combine>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::reduceChanged(
+		LeafMap leafMap,
+		Combine combine) {
+	// The descendants of a node that hasn't changed haven't changed either, so
+	// those subtrees are skipped over.
+	internal::ArenaScope scope(_scratch);
+	ScratchVector<NodeListSizeType> changedIndices(
+		scratchAllocator<NodeListSizeType>());
+	NodeListSizeType nodeIndex = 0;
+	while (nodeIndex < _nodes.size()) {
+		if (_nodes[nodeIndex].changed) {
+			changedIndices.push_back(nodeIndex);
+			nodeIndex += 1;
+		}
+		else {
+			nodeIndex += subtreeSize(nodeIndex);
+		}
+	}
+	for (std::size_t index = changedIndices.size(); index-- > 0;) {
+		reduceNode(changedIndices[index], leafMap, combine);
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename LeafMap, typename Combine>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::reduceNode(
+		NodeListSizeType nodeIndex,
+		LeafMap& leafMap,
+		Combine& combine) {
+	NodeInternal const& node = _nodes[nodeIndex];
+	NodeValue value = NodeValue();
+	if (!node.hasChildren) {
+		LeafListSizeType leafEnd = node.leafIndex + node.leafCount;
+		for (
+				LeafListSizeType leafIndex = node.leafIndex;
+				leafIndex < leafEnd;
+				++leafIndex) {
+			ConstLeafIterator leaf(this, leafIndex);
+			value = combine(value, leafMap(*leaf));
+		}
+	}
+	else {
+		NodeListSizeType children[1 << Dim];
+		childIndices(nodeIndex, children);
+		for (std::size_t child = 0; child < (1 << Dim); ++child) {
+			value = combine(value, _nodes[children[child]].value);
+		}
+	}
+	_nodes[nodeIndex].value = value;
+	_nodes[nodeIndex].changed = false;
+}
+
 template<
 	std::size_t Dim,
 	typename Vector,
@@ -708,17 +2836,59 @@ void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::insert(
 		ConstNodeIterator hint,
 		LeafIt leafBegin, LeafIt leafEnd,
 		PositionIt positionBegin, PositionIt positionEnd) {
-	// Add every leaf to the orthtree (without adjustment).
 	(void) positionEnd;
-	reserve(std::distance(leafBegin, leafEnd));
-	autoAdjust(false);
+	bool const adjustAfter = _autoAdjust;
+	// If there are gaps, then each leaf can usually be put into a gap next to
+	// its node without shifting the rest of the leaf list, so the leafs are
+	// added one at a time (without adjustment).
+	if (LeafGaps) {
+		reserve(std::distance(leafBegin, leafEnd));
+		_autoAdjust = false;
+		PositionIt positionIt = positionBegin;
+		for (
+				LeafIt leafIt = leafBegin;
+				leafIt != leafEnd;
+				++leafIt, ++positionIt) {
+			insert(hint, *leafIt, *positionIt);
+		}
+		_autoAdjust = adjustAfter;
+		if (adjustAfter) {
+			adjust();
+		}
+		return;
+	}
+	
+	// Otherwise, find the node that each leaf belongs to before changing
+	// anything. Leafs outside of the orthtree are skipped.
+	internal::ArenaScope scope(_scratch);
+	ScratchVector<LeafInternal> newLeafs(scratchAllocator<LeafInternal>());
+	ScratchVector<NodeListSizeType> nodeIndices(
+		scratchAllocator<NodeListSizeType>());
 	PositionIt positionIt = positionBegin;
 	for (LeafIt leafIt = leafBegin; leafIt != leafEnd; ++leafIt, ++positionIt) {
-		insert(hint, *leafIt, *positionIt);
+		NodeIterator node = find(hint, *positionIt);
+		if (node != nodes().end()) {
+			newLeafs.push_back(LeafInternal(*positionIt, *leafIt));
+			nodeIndices.push_back(node._index);
+		}
+	}
+	if (newLeafs.empty()) {
+		return;
+	}
+	mergeLeafs(newLeafs, nodeIndices);
+	
+	// Only the nodes that received leafs can have too many of them now, so if
+	// none of them do, then there is nothing to adjust.
+	bool overCapacity = false;
+	for (NodeListSizeType nodeIndex : nodeIndices) {
+		if (!canHoldLeafs(_nodes[nodeIndex])) {
+			overCapacity = true;
+			break;
+		}
+	}
+	if (adjustAfter && overCapacity) {
+		adjust();
 	}
-	// Then adjust.
-	adjust();
-	autoAdjust(true);
 }
 
 template<
@@ -739,12 +2909,36 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::erase(
 	if (node == nodes().end()) {
 		return std::make_tuple(nodes().end(), leafs().end());
 	}
+	// If there are gaps, then merging children moves leafs around. So the leaf
+	// is erased first, and then the children are merged.
+	if (LeafGaps) {
+		NodeIterator parent = node;
+		while (
+				_autoAdjust &&
+				parent->hasParent &&
+				canMergeLeafs(parent->parent, -1)) {
+			parent = parent->parent;
+		}
+		LeafIterator nextLeaf = eraseAt(node, leaf);
+		if (parent == node) {
+			return std::make_tuple(node, nextLeaf);
+		}
+		// Find the leaf after the erased one by counting how many leafs of the
+		// merged node came before it.
+		LeafListDifferenceType leafOffset = leafDistance(
+			parent.internalIt()->leafIndex,
+			leaf._index);
+		destroyChildren(parent);
+		return std::make_tuple(
+			parent,
+			LeafIterator(this, parent.internalIt()->leafIndex + leafOffset));
+	}
 	// If the parent of this node doesn't need to be divided into subnodes
 	// anymore, then merge its children together.
 	while (
 			_autoAdjust &&
 			node->hasParent &&
-			canHoldLeafs(node->parent, -1)) {
+			canMergeLeafs(node->parent, -1)) {
 		node = node->parent;
 		destroyChildren(node);
 	}
@@ -760,18 +2954,67 @@ template<
 void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::erase(
 		ConstNodeIterator hint,
 		LeafIterator leafBegin, LeafIterator leafEnd) {
-	// Erase the leafs in reverse, to prevent invalidation of the iterators
-	// (without adjustment).
-	autoAdjust(false);
+	// The leafs are already known, so there is nothing to search for.
+	(void) hint;
+	internal::ArenaScope scope(_scratch);
+	ScratchVector<LeafListSizeType> marks(
+		_leafs.size() + 1,
+		0,
+		scratchAllocator<LeafListSizeType>());
+	for (LeafIterator leafIt = leafBegin; leafIt != leafEnd; ++leafIt) {
+		marks[leafIt._index + 1] = 1;
+	}
+	eraseMarked(marks);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename LeafItIt>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::eraseEach(
+		LeafItIt leafItBegin,
+		LeafItIt leafItEnd) {
+	internal::ArenaScope scope(_scratch);
+	ScratchVector<LeafListSizeType> marks(
+		_leafs.size() + 1,
+		0,
+		scratchAllocator<LeafListSizeType>());
+	for (LeafItIt leafItIt = leafItBegin; leafItIt != leafItEnd; ++leafItIt) {
+		LeafIterator leafIt = *leafItIt;
+		marks[leafIt._index + 1] = 1;
+	}
+	eraseMarked(marks);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename Predicate>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::LeafListSizeType
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::eraseIf(
+		Predicate predicate) {
+	internal::ArenaScope scope(_scratch);
+	ScratchVector<LeafListSizeType> marks(
+		_leafs.size() + 1,
+		0,
+		scratchAllocator<LeafListSizeType>());
 	for (
-			ReverseLeafIterator leafIt = leafEnd.reverse();
-			leafIt != leafBegin.reverse();
+			LeafIterator leafIt = leafs().begin();
+			leafIt != leafs().end();
 			++leafIt) {
-		erase(hint, leafIt.reverse() - 1);
+		ConstLeafIterator constLeafIt = leafIt;
+		if (predicate(*constLeafIt)) {
+			marks[leafIt._index + 1] = 1;
+		}
 	}
-	// Then adjust.
-	adjust();
-	autoAdjust(true);
+	eraseMarked(marks);
+	return marks.back();
 }
 
 template<
@@ -795,13 +3038,43 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::move(
 	if (source == nodes().end() || dest == nodes().end()) {
 		return std::make_tuple(nodes().end(), nodes().end(), leafs().end());
 	}
+	// In a loose orthtree, a leaf that is only moved a short distance out of
+	// its node stays where it is.
+	if (
+			Loose &&
+			dest != source &&
+			containsLoosely(*source.internalIt(), position)) {
+		setLeafPosition(leaf._index, position);
+		markChanged(source._index);
+		return std::make_tuple(source, source, leaf);
+	}
+	// If there are gaps, then creating and destroying children may move the
+	// leaf. Instead, the leaf is erased and then inserted at its new position.
+	if (LeafGaps) {
+		LeafValue value = _leafs[leaf._index].value;
+		source = std::get<NodeIterator>(erase(source, leaf));
+		NodeListSizeType sourceIndex = source._index;
+		NodeListSizeType destIndex = find(source, position)._index;
+		NodeListSizeType nodeCount = _nodes.size();
+		std::tuple<NodeIterator, LeafIterator> result =
+			insert(source, value, position);
+		// Any children created by the insertion come after the node that the
+		// leaf was inserted into.
+		if (destIndex < sourceIndex) {
+			sourceIndex += _nodes.size() - nodeCount;
+		}
+		return std::make_tuple(
+			NodeIterator(this, sourceIndex),
+			std::get<NodeIterator>(result),
+			std::get<LeafIterator>(result));
+	}
 	// If the source and the destination are distinct, then check to make
 	// sure that they remain within the node capacity. If they won't, then
 	// create or destroy children until they do.
 	if (_autoAdjust) {
 		while (
 				source->hasParent &&
-				canHoldLeafs(source->parent, -1) &&
+				canMergeLeafs(source->parent, -1) &&
 				!contains(source->parent, dest)) {
 			// If dest will become invalidated by destroying children, then
 			// adjust it so it will still be valid.
@@ -822,7 +3095,7 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::move(
 		}
 	}
 	// Move the leaf.
-	leaf.internalIt()->position = position;
+	setLeafPosition(leaf._index, position);
 	return std::make_tuple(source, dest, moveAt(source, dest, leaf));
 }
 
@@ -838,51 +3111,182 @@ void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::move(
 		LeafIterator leafBegin, LeafIterator leafEnd,
 		PositionIt positionBegin, PositionIt positionEnd) {
 	(void) positionEnd;
-	// Move the leafs one by one (without adjustment).
-	autoAdjust(false);
-	LeafListDifferenceType numLeafs = std::distance(leafBegin, leafEnd);
-	std::vector<bool> processed(numLeafs, false);
-	LeafListDifferenceType processedIndex = 0;
-	LeafIterator leafIt = leafBegin;
+	internal::ArenaScope scope(_scratch);
+	ScratchVector<LeafListSizeType> marks(
+		_leafs.size() + 1,
+		0,
+		scratchAllocator<LeafListSizeType>());
+	ScratchVector<LeafInternal> movedLeafs(scratchAllocator<LeafInternal>());
+	ScratchVector<NodeListSizeType> nodeIndices(
+		scratchAllocator<NodeListSizeType>());
+	markMoves(
+		hint,
+		leafBegin, leafEnd,
+		positionBegin,
+		marks, movedLeafs, nodeIndices);
+	moveMarked(marks, movedLeafs, nodeIndices);
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename PositionIt>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::markMoves(
+		ConstNodeIterator hint,
+		LeafIterator leafBegin, LeafIterator leafEnd,
+		PositionIt positionBegin,
+		ScratchVector<LeafListSizeType>& marks,
+		ScratchVector<LeafInternal>& movedLeafs,
+		ScratchVector<NodeListSizeType>& nodeIndices) {
+	// Neighbouring leafs usually share a node, so the search for the node of
+	// each leaf starts from the node of the one before it.
+	NodeIterator source(this, hint._index);
 	PositionIt positionIt = positionBegin;
 	for (
-			LeafListDifferenceType leafIndex = 0;
-			leafIndex < numLeafs;
-			++leafIndex) {
-		// Move the leaf and get an iterator to its new position.
-		LeafIterator newLeafIt =
-			std::get<LeafIterator>(move(hint, leafIt, *positionIt));
-		LeafListDifferenceType newProcessedIndex = (newLeafIt - leafBegin);
-		// If the leaf is moved into the range that still has to be processed,
-		// then tag it so that it isn't processed twice.
-		if (newProcessedIndex <= processedIndex) {
-			processed[processedIndex] = true;
-		}
-		else if (newProcessedIndex < numLeafs) {
-			// Perform a left rotation on the processed flags.
-			std::move(
-				processed.begin() + processedIndex + 1,
-				processed.begin() + newProcessedIndex + 1,
-				processed.begin() + processedIndex);
-			processed[newProcessedIndex] = true;
+			LeafIterator leafIt = leafBegin;
+			leafIt != leafEnd;
+			++leafIt, ++positionIt) {
+		Vector position = *positionIt;
+		source = find(source, leafIt);
+		bool inRoot = contains(root(), position);
+		if (
+				contains(source, position) ||
+				(Loose &&
+					inRoot &&
+					containsLoosely(*source.internalIt(), position))) {
+			setLeafPosition(leafIt._index, position);
+			markChanged(source._index);
+			continue;
 		}
-		else {
-			// Perform a left rotation but don't flag the new processed since
-			// it is so far to the right it won't be encountered again.
-			std::move(
-				processed.begin() + processedIndex + 1,
-				processed.end(),
-				processed.begin() + processedIndex);
+		if (!inRoot) {
+			continue;
+		}
+		// The marked leaf is only erased after this, so its value can be moved
+		// out of it.
+		marks[leafIt._index + 1] = 1;
+		movedLeafs.push_back(
+			LeafInternal(position, std::move(_leafs[leafIt._index].value)));
+		nodeIndices.push_back(source._index);
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+void Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::moveMarked(
+		ScratchVector<LeafListSizeType>& marks,
+		ScratchVector<LeafInternal>& movedLeafs,
+		ScratchVector<NodeListSizeType>& nodeIndices) {
+	if (movedLeafs.empty()) {
+		return;
+	}
+	// Each search for a new node starts from the old node of the leaf.
+	for (std::size_t index = 0; index < movedLeafs.size(); ++index) {
+		nodeIndices[index] = find(
+			NodeIterator(this, nodeIndices[index]),
+			movedLeafs[index].position)._index;
+	}
+	// Taking out the marked leafs doesn't change the node list, so the node
+	// indices stay valid until the leafs are put back in.
+	bool const adjustAfter = _autoAdjust;
+	_autoAdjust = false;
+	eraseMarked(marks);
+	_autoAdjust = adjustAfter;
+	if (LeafGaps) {
+		for (std::size_t index = 0; index < movedLeafs.size(); ++index) {
+			insertAt(
+				NodeIterator(this, nodeIndices[index]),
+				movedLeafs[index].value,
+				movedLeafs[index].position);
+		}
+	}
+	else {
+		mergeLeafs(movedLeafs, nodeIndices);
+	}
+	if (adjustAfter) {
+		adjust();
+	}
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+template<typename PositionIt>
+typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::UpdateStats
+Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::update(
+		PositionIt positionBegin,
+		PositionIt positionEnd,
+		std::size_t threadCount) {
+	(void) positionEnd;
+	auto start = std::chrono::steady_clock::now();
+	UpdateStats stats;
+	stats.leafCount = _nodes[0].leafCount;
+	stats.rebuilt = false;
+	{
+		internal::ArenaScope scope(_scratch);
+		ScratchVector<LeafListSizeType> marks(
+			_leafs.size() + 1,
+			0,
+			scratchAllocator<LeafListSizeType>());
+		ScratchVector<LeafInternal> movedLeafs(
+			scratchAllocator<LeafInternal>());
+		ScratchVector<NodeListSizeType> nodeIndices(
+			scratchAllocator<NodeListSizeType>());
+		markMoves(
+			root(),
+			leafs().begin(), leafs().end(),
+			positionBegin,
+			marks, movedLeafs, nodeIndices);
+		stats.movedCount = movedLeafs.size();
+		
+		// Finding out how many leafs leave their nodes is the first step of
+		// moving them anyways. Finding their new nodes costs much more, and
+		// isn't needed for a rebuild.
+		if (
+				stats.movedCount == 0 ||
+				stats.movedCount <=
+					Details::RebuildFraction * stats.leafCount) {
+			moveMarked(marks, movedLeafs, nodeIndices);
 		}
-		while (processed[processedIndex]) {
-			++processedIndex;
-			++leafIt;
+		else {
+			// Otherwise, put the leafs at their new positions in place, in the
+			// same order as before, and build a new orthtree from them. Any
+			// gaps are squeezed out, so a leaf only ever moves to an earlier
+			// slot that has already been read.
+			LeafListDifferenceType newIndex = 0;
+			std::size_t movedIndex = 0;
+			for (
+					LeafIterator leafIt = leafs().begin();
+					leafIt != leafs().end();
+					++leafIt, ++newIndex) {
+				if (marks[leafIt._index + 1] != 0) {
+					_leafs[newIndex] = std::move(movedLeafs[movedIndex]);
+					++movedIndex;
+				}
+				else if (leafIt._index != newIndex) {
+					_leafs[newIndex] = std::move(_leafs[leafIt._index]);
+				}
+			}
+			_leafs.erase(_leafs.begin() + newIndex, _leafs.end());
+			_leafGaps.clear();
+			_nodes.clear();
+			_nodes.push_back(NodeInternal(_position, _dimensions));
+			build(threadCount);
+			stats.rebuilt = true;
 		}
-		++positionIt;
 	}
-	// Then adjust.
-	adjust();
-	autoAdjust(true);
+	stats.seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+	return stats;
 }
 
 template<
@@ -897,10 +3301,10 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::find(
 		Vector const& point) {
 	// If the hint node doesn't contain the point, then go up the tree until we
 	// reach a node that does contain the point.
-	NodeIterator node(this, hint._index);
-	while (!contains(node, point)) {
-		if (node->hasParent) {
-			node = node->parent;
+	NodeHandle node = hint.handle();
+	while (!contains(node.iterator(), point)) {
+		if (node.hasParent()) {
+			node = node.parent();
 		}
 		else {
 			return nodes().end();
@@ -909,11 +3313,11 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::find(
 	
 	// Then, go down the tree until we reach the deepest node that contains the
 	// point.
-	while (node->hasChildren) {
-		node = findChild(node, point);
+	while (node.hasChildren()) {
+		node = node.child(findChildIndex(node.internal(), point));
 	}
 	
-	return node;
+	return NodeIterator(this, node._index);
 }
 
 template<
@@ -928,10 +3332,10 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::find(
 		ConstLeafIterator leaf) {
 	// If the hint node doesn't contain the leaf, then go up the tree until we
 	// reach a node that does contain the leaf.
-	NodeIterator node(this, hint._index);
-	while (!contains(node, leaf)) {
-		if (node->hasParent) {
-			node = node->parent;
+	NodeHandle node = hint.handle();
+	while (!contains(node.iterator(), leaf)) {
+		if (node.hasParent()) {
+			node = node.parent();
 		}
 		else {
 			return nodes().end();
@@ -940,11 +3344,11 @@ Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::find(
 	
 	// Then go down the tree until we reach the deepest node that contains the
 	// point.
-	while (node->hasChildren) {
-		node = findChild(node, leaf);
+	while (node.hasChildren()) {
+		node = findChild(node.iterator(), leaf).handle();
 	}
 	
-	return node;
+	return NodeIterator(this, node._index);
 }
 
 template<
@@ -957,13 +3361,8 @@ typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::NodeIterator
 Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::findChild(
 		ConstNodeIterator node,
 		Vector const& point) {
-	NodeListSizeType childIndex = 0;
-	for (std::size_t dim = 0; dim < Dim; ++dim) {
-		if (point[dim] - node->position[dim] >= node->dimensions[dim] / 2) {
-			childIndex += (1 << dim);
-		}
-	}
-	ConstNodeIterator child = node->children[childIndex];
+	NodeHandle parent = node.handle();
+	NodeHandle child = parent.child(findChildIndex(parent.internal(), point));
 	return NodeIterator(this, child._index);
 }
 
@@ -977,13 +3376,16 @@ typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::NodeIterator
 Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::findChild(
 		ConstNodeIterator node,
 		ConstLeafIterator leaf) {
+	// All of the children are looked at, so their indices are found together
+	// instead of one at a time, which would be slow for compact nodes.
+	NodeListSizeType children[1 << Dim];
+	childIndices(node._index, children);
 	for (
 			NodeListSizeType childIndex = 0;
 			childIndex < (1 << Dim);
 			++childIndex) {
-		ConstNodeIterator child = node->children[childIndex];
-		if (contains(child, leaf)) {
-			return NodeIterator(this, child._index);
+		if (contains(ConstNodeIterator(this, children[childIndex]), leaf)) {
+			return NodeIterator(this, children[childIndex]);
 		}
 	}
 	return nodes().end();
@@ -998,12 +3400,36 @@ template<
 bool Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::contains(
 		ConstNodeIterator node,
 		Vector const& point) const {
+	// The geometry is looked up once, instead of through the node proxy for
+	// every comparison.
+	GeometryReference position = nodePosition(*node.internalIt());
+	GeometryReference dimensions = nodeDimensions(*node.internalIt());
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		if (!(
+				point[dim] >= position[dim] &&
+				point[dim] - position[dim] < dimensions[dim])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+bool Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::containsLoosely(
+		NodeInternal const& node,
+		Vector const& point) const {
+	GeometryReference position = nodePosition(node);
+	GeometryReference dimensions = nodeDimensions(node);
 	for (std::size_t dim = 0; dim < Dim; ++dim) {
-		Scalar lower = node->position[dim];
-		Scalar upper = lower + node->dimensions[dim];
+		Scalar margin = looseMargin(dim);
 		if (!(
-				point[dim] >= node->position[dim] &&
-				point[dim] - node->position[dim] < node->dimensions[dim])) {
+				point[dim] >= position[dim] - margin &&
+				point[dim] - position[dim] < dimensions[dim] + margin)) {
 			return false;
 		}
 	}
@@ -1021,7 +3447,7 @@ bool Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::contains(
 		ConstLeafIterator leaf) const {
 	LeafListSizeType leafIndex = leaf._index;
 	LeafListSizeType lower = node.internalIt()->leafIndex;
-	LeafListSizeType upper = lower + node.internalIt()->leafCount;
+	LeafListSizeType upper = leafEndIndex(node._index);
 	return leafIndex >= lower && leafIndex < upper;
 }
 
@@ -1034,12 +3460,12 @@ template<
 bool Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::contains(
 		ConstNodeIterator parent,
 		ConstNodeIterator node) const {
-	ConstNodeIterator nodeParent = node;
+	NodeHandle nodeParent = node.handle();
 	NodeListSizeType parentDepth = parent.internalIt()->depth;
-	while (nodeParent.internalIt()->depth > parentDepth) {
-		nodeParent = nodeParent->parent;
+	while (nodeParent.depth() > parentDepth) {
+		nodeParent = nodeParent.parent();
 	}
-	return nodeParent == parent;
+	return nodeParent == parent.handle();
 }
 
 }
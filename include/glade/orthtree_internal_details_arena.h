@@ -0,0 +1,28 @@
+#ifndef __GLADE_ORTHTREE_INTERNAL_DETAILS_ARENA_H_
+#define __GLADE_ORTHTREE_INTERNAL_DETAILS_ARENA_H_
+
+#include "orthtree_internal_details_default.h"
+
+namespace glade {
+
+/**
+ * \brief Implementation details for an Orthtree that reuses the memory of its
+ * temporary buffers.
+ * 
+ * With these details, an Orthtree that is repeatedly updated in batches (by
+ * inserting, moving, and adjusting) stops going to the heap for its temporary
+ * buffers after the first few batches. The leaf and node lists themselves are
+ * still allocated by Details::VectorType.
+ * 
+ * \see OrthtreeInternalDetailsDefault::ScratchArena
+ */
+struct OrthtreeInternalDetailsArena : public OrthtreeInternalDetailsDefault {
+	
+	static constexpr bool ScratchArena = true;
+	
+};
+
+}
+
+#endif
+
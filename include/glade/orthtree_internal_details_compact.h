@@ -0,0 +1,28 @@
+#ifndef __GLADE_ORTHTREE_INTERNAL_DETAILS_COMPACT_H_
+#define __GLADE_ORTHTREE_INTERNAL_DETAILS_COMPACT_H_
+
+#include "orthtree_internal_details_default.h"
+
+namespace glade {
+
+/**
+ * \brief Implementation details for an Orthtree whose nodes don't store the
+ * indices of their children.
+ * 
+ * With these details, the memory used by each node no longer grows as `2^Dim`,
+ * which makes a large difference for Orthtree%s in more than three or four
+ * dimensions. The cost is that finding a particular child of a node takes time
+ * proportional to the number of children that come before it. Going through
+ * all of the children in order is still fast.
+ * 
+ * \see OrthtreeInternalDetailsDefault::CompactNodes
+ */
+struct OrthtreeInternalDetailsCompact : public OrthtreeInternalDetailsDefault {
+	
+	static constexpr bool CompactNodes = true;
+	
+};
+
+}
+
+#endif
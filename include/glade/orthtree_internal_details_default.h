@@ -1,5 +1,8 @@
 #ifndef __GLADE_ORTHTREE_INTERNAL_DETAILS_DEFAULT_H_
-#define __GLADE_ORTHTREE_INTERNAL_DETAULS_DEFAULT_H_
+#define __GLADE_ORTHTREE_INTERNAL_DETAILS_DEFAULT_H_
+
+#include <cstddef>
+#include <vector>
 
 namespace glade {
 
@@ -35,6 +38,124 @@ struct OrthtreeInternalDetailsDefault {
 	template<typename T>
 	using DifferenceType = typename VectorType<T>::difference_type;
 	
+	/**
+	 * \brief An unsigned type that is used to store the depth of a node, and
+	 * which child of its parent a node is.
+	 * 
+	 * It must be able to hold the maximum depth of the Orthtree, as well as
+	 * `2^Dim - 1`.
+	 */
+	using DepthType = std::size_t;
+	
+	/**
+	 * \brief Whether the Orthtree checks that its leafs and nodes can still
+	 * be indexed by SizeType and DifferenceType whenever it grows.
+	 * 
+	 * If this is true, then anything that would make either list too large
+	 * throws `std::length_error` instead, and leaves the Orthtree valid. This
+	 * is only useful when the size types are much smaller than `std::size_t`.
+	 */
+	static constexpr bool CheckOverflow = false;
+	
+	/**
+	 * \brief Whether the Orthtree keeps an arena that its temporary buffers
+	 * are allocated from.
+	 * 
+	 * Building an Orthtree from a range, creating children, adjusting, and
+	 * inserting or moving a range of leafs all need temporary buffers. If this
+	 * is true, then these buffers are taken from an arena owned by the
+	 * Orthtree, and the list that `adjust` builds the new nodes in is kept
+	 * as well. Their memory is reused from one operation to the next, so that
+	 * repeated operations stop allocating once the arena is large enough. The
+	 * cost is that the Orthtree holds on to the largest amount of temporary
+	 * memory that it has needed so far.
+	 */
+	static constexpr bool ScratchArena = false;
+	
+	/**
+	 * \brief The fraction of the leafs that have to change node before
+	 * Orthtree::update rebuilds the Orthtree instead of moving them.
+	 * 
+	 * Moving a leaf to another node costs more than building the Orthtree does
+	 * per leaf, so once most of the leafs change node, it is faster to start
+	 * over. With uniformly distributed leafs, rebuilding wins once about 60% of
+	 * them change node. If this is one or more, then the Orthtree is never
+	 * rebuilt.
+	 */
+	static constexpr double RebuildFraction = 0.6;
+	
+	/**
+	 * \brief The number of unused leaf slots that are reserved at the end of
+	 * every node without children.
+	 * 
+	 * If this is zero, then all of the leafs are stored contiguously. Otherwise,
+	 * gaps are left in the leaf list so that a leaf can be inserted into (or
+	 * erased from) a node without shifting the leafs of every other node. When
+	 * a node runs out of room, it borrows a gap from a nearby node, and if none
+	 * are available, then the gaps are redistributed throughout the whole leaf
+	 * list.
+	 */
+	static constexpr std::size_t LeafGapSize = 0;
+	
+	/**
+	 * \brief Whether the leafs are stored as a structure of arrays.
+	 * 
+	 * If this is false, then the position and value of each leaf are stored
+	 * together. Otherwise, each coordinate of the leaf positions is stored in
+	 * its own contiguous array, and the leaf values are stored in another
+	 * array, so that searches which only look at positions don't have to load
+	 * the values. The LeafReferenceProxyBase type then holds a copy of the
+	 * position instead of a reference to it, and LeafRangeBase::coordinates
+	 * replaces LeafRangeBase::data.
+	 */
+	static constexpr bool SplitLeafs = false;
+	
+	/**
+	 * \brief Whether nodes only store the size of their subtree, instead of
+	 * the index of each of their children.
+	 * 
+	 * Since the children of a node are stored one after another in
+	 * depth-first order, the index of a child can always be found by skipping
+	 * over the subtrees of the children that come before it. If this is true,
+	 * then that is done every time a child is needed, so that each node stores
+	 * one index instead of `2^Dim + 1`. This saves a lot of memory in high
+	 * dimensions, where most of each node would otherwise be child indices.
+	 */
+	static constexpr bool CompactNodes = false;
+	
+	/**
+	 * \brief Whether nodes store the cell that they cover, instead of their
+	 * position and dimensions.
+	 * 
+	 * The children of a node always split it exactly in half along each
+	 * dimension, so a node at depth `d` covers one of the `2^d` cells along
+	 * each dimension of the root. If this is true, then each node only stores
+	 * the integer coordinates of that cell, and its position and dimensions
+	 * are worked out from those of the root whenever they are needed. The
+	 * cells are stored with 32 bit integers, which limits the maximum depth of
+	 * the Orthtree to 32.
+	 */
+	static constexpr bool ImplicitGeometry = false;
+	
+	/**
+	 * \brief How far a leaf may be moved outside of its node before it has to
+	 * be moved to another node, as a fraction of the size of the Orthtree
+	 * along each dimension.
+	 * 
+	 * If this is zero, then every leaf is always in the node that covers its
+	 * position. Otherwise, when a leaf is moved a short distance out of its
+	 * node, it stays where it is, so that leafs jittering back and forth
+	 * across the boundary between two nodes don't keep moving between them
+	 * (and creating and destroying children along the way). Leafs are still
+	 * inserted into the node that covers their position. Searches for leafs
+	 * treat every node as if it were enlarged by this much on every side,
+	 * which makes them a bit slower. The margin is the same for all nodes, so
+	 * that a leaf stays within it when its node is divided into children.
+	 * Orthtree::find still goes by the regions that the nodes cover, so it may
+	 * miss leafs within the margin of a node.
+	 */
+	static constexpr double Looseness = 0;
+	
 };
 
 }
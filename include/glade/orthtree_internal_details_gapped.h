@@ -0,0 +1,32 @@
+#ifndef __GLADE_ORTHTREE_INTERNAL_DETAILS_GAPPED_H_
+#define __GLADE_ORTHTREE_INTERNAL_DETAILS_GAPPED_H_
+
+#include <cstddef>
+
+#include "orthtree_internal_details_default.h"
+
+namespace glade {
+
+/**
+ * \brief Implementation details for an Orthtree that leaves gaps in its leaf
+ * list.
+ * 
+ * With these details, inserting or erasing a single leaf only has to update
+ * the node that holds the leaf and the ancestors of that node, instead of
+ * every node in the Orthtree. The cost is some extra memory for the gaps, as
+ * well as LeafIterator arithmetic (but not incrementing) having to walk down
+ * the Orthtree, which takes time proportional to its depth. This works best
+ * for Orthtree%s with a node capacity of at least a few leafs.
+ * 
+ * \see OrthtreeInternalDetailsDefault::LeafGapSize
+ */
+struct OrthtreeInternalDetailsGapped : public OrthtreeInternalDetailsDefault {
+	
+	static constexpr std::size_t LeafGapSize = 4;
+	
+};
+
+}
+
+#endif
+
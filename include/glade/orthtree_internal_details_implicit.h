@@ -0,0 +1,30 @@
+#ifndef __GLADE_ORTHTREE_INTERNAL_DETAILS_IMPLICIT_H_
+#define __GLADE_ORTHTREE_INTERNAL_DETAILS_IMPLICIT_H_
+
+#include "orthtree_internal_details_default.h"
+
+namespace glade {
+
+/**
+ * \brief Implementation details for an Orthtree whose nodes don't store their
+ * position and dimensions.
+ * 
+ * With these details, each node stores `Dim` 32 bit integers in place of two
+ * `Vector`s. For three dimensional `double` vectors, this saves 32 bytes per
+ * node. The cost is a few multiplications each time the position or dimensions
+ * of a node are needed, and a maximum depth of 32. These details can be
+ * combined with OrthtreeInternalDetailsDefault::CompactNodes for the smallest
+ * possible nodes.
+ * 
+ * \see OrthtreeInternalDetailsDefault::ImplicitGeometry
+ */
+struct OrthtreeInternalDetailsImplicit : public OrthtreeInternalDetailsDefault {
+	
+	static constexpr bool ImplicitGeometry = true;
+	
+};
+
+}
+
+#endif
+
@@ -0,0 +1,28 @@
+#ifndef __GLADE_ORTHTREE_INTERNAL_DETAILS_LOOSE_H_
+#define __GLADE_ORTHTREE_INTERNAL_DETAILS_LOOSE_H_
+
+#include "orthtree_internal_details_default.h"
+
+namespace glade {
+
+/**
+ * \brief Implementation details for an Orthtree whose leafs can move a short
+ * distance outside of their nodes.
+ * 
+ * A leaf only has to be moved to another node once it is more than 1/128th of
+ * the size of the Orthtree outside of its own node. This suits simulations in
+ * which the leafs move a little bit at a time. For other distances, a custom
+ * details class can derive from this one and set its own looseness.
+ * 
+ * \see OrthtreeInternalDetailsDefault::Looseness
+ */
+struct OrthtreeInternalDetailsLoose : public OrthtreeInternalDetailsDefault {
+	
+	static constexpr double Looseness = 1.0 / 128;
+	
+};
+
+}
+
+#endif
+
@@ -0,0 +1,38 @@
+#ifndef __GLADE_ORTHTREE_INTERNAL_DETAILS_NARROW_H_
+#define __GLADE_ORTHTREE_INTERNAL_DETAILS_NARROW_H_
+
+#include <cstdint>
+
+#include "orthtree_internal_details_default.h"
+
+namespace glade {
+
+/**
+ * \brief Implementation details for an Orthtree that uses 32 bit indices.
+ * 
+ * With these details, the indices stored in each node take up half as much
+ * space as with `std::size_t`, and the depth of each node takes up a single
+ * byte. The Orthtree can then hold at most `2^31 - 1` leafs and `2^31 - 1`
+ * nodes, in no more than eight dimensions. Growing past this throws
+ * `std::length_error`.
+ * 
+ * \see OrthtreeInternalDetailsDefault::CheckOverflow
+ */
+struct OrthtreeInternalDetailsNarrow : public OrthtreeInternalDetailsDefault {
+	
+	template<typename T>
+	using SizeType = std::uint32_t;
+	
+	template<typename T>
+	using DifferenceType = std::int32_t;
+	
+	using DepthType = std::uint8_t;
+	
+	static constexpr bool CheckOverflow = true;
+	
+};
+
+}
+
+#endif
+
@@ -0,0 +1,29 @@
+#ifndef __GLADE_ORTHTREE_INTERNAL_DETAILS_SPLIT_H_
+#define __GLADE_ORTHTREE_INTERNAL_DETAILS_SPLIT_H_
+
+#include "orthtree_internal_details_default.h"
+
+namespace glade {
+
+/**
+ * \brief Implementation details for an Orthtree that stores the coordinates of
+ * its leaf positions in separate arrays.
+ * 
+ * With these details, searches that only need leaf positions (box and radius
+ * queries, nearest neighbour searches, and so on) only load the coordinates of
+ * the leafs, and not their values. This works best when the leaf values are
+ * large compared to the positions. Accessing a whole leaf is a bit slower,
+ * since its position has to be gathered from each of the arrays.
+ * 
+ * \see OrthtreeInternalDetailsDefault::SplitLeafs
+ */
+struct OrthtreeInternalDetailsSplit : public OrthtreeInternalDetailsDefault {
+	
+	static constexpr bool SplitLeafs = true;
+	
+};
+
+}
+
+#endif
+
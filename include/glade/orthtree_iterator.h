@@ -68,6 +68,24 @@ private:
 			ListDifferenceType index) :
 			_orthtree(orthtree),
 			_index(index) {
+		skipGaps(Reverse ? -1 : +1);
+	}
+	
+	// If the leaf list has gaps, then moves the iterator in a direction until it
+	// no longer points to a gap.
+	void skipGaps(ListDifferenceType shift) {
+		if (LeafGaps) {
+			_index = shift > 0 ?
+				_orthtree->nextLeafIndex(_index) :
+				_orthtree->prevLeafIndex(_index);
+		}
+	}
+	
+	// Counts the leafs between two indices, not including any gaps.
+	ListDifferenceType leafDistance(
+			ListDifferenceType lowerIndex,
+			ListDifferenceType upperIndex) const {
+		return _orthtree->leafDistance(lowerIndex, upperIndex);
 	}
 	
 	// Converts this iterator to an iterator over the internal leaf type.
@@ -119,6 +137,7 @@ public:
 	LeafIteratorBase<Const, Reverse>& operator++() {
 		difference_type shift = Reverse ? -1 : +1;
 		_index += shift;
+		skipGaps(shift);
 		return *this;
 	}
 	LeafIteratorBase<Const, Reverse> operator++(int) {
@@ -130,6 +149,7 @@ public:
 	LeafIteratorBase<Const, Reverse>& operator--() {
 		difference_type shift = Reverse ? +1 : -1;
 		_index += shift;
+		skipGaps(shift);
 		return *this;
 	}
 	LeafIteratorBase<Const, Reverse> operator--(int) {
@@ -141,10 +161,20 @@ public:
 	// Iterator arithmetic methods.
 	LeafIteratorBase<Const, Reverse>& operator+=(difference_type n) {
 		difference_type shift = Reverse ? -n : +n;
+		// If the leaf list has gaps, then count the leafs before the iterator
+		// and look up the leaf that many places further on, so that the gaps
+		// aren't counted.
+		if (LeafGaps) {
+			_index = _orthtree->leafAtRank(_orthtree->leafRank(_index) + shift);
+			return *this;
+		}
 		_index += shift;
 		return *this;
 	}
 	LeafIteratorBase<Const, Reverse>& operator-=(difference_type n) {
+		if (LeafGaps) {
+			return operator+=(-n);
+		}
 		difference_type shift = Reverse ? +n : -n;
 		_index += shift;
 		return *this;
@@ -170,6 +200,11 @@ public:
 	friend difference_type operator-(
 			LeafIteratorBase<Const, Reverse> const& lhs,
 			LeafIteratorBase<Const, Reverse> const& rhs) {
+		if (LeafGaps) {
+			return Reverse ?
+				lhs.leafDistance(lhs._index + 1, rhs._index + 1) :
+				lhs.leafDistance(rhs._index, lhs._index);
+		}
 		difference_type diff = lhs._index - rhs._index;
 		return Reverse ? -diff : +diff;
 	}
@@ -178,7 +213,7 @@ public:
 	friend bool operator<(
 			LeafIteratorBase<Const, Reverse> const& lhs,
 			LeafIteratorBase<Const, Reverse> const& rhs) {
-		return 0 < (rhs - lhs);
+		return Reverse ? lhs._index > rhs._index : lhs._index < rhs._index;
 	}
 	friend bool operator<=(
 			LeafIteratorBase<Const, Reverse> const& lhs,
@@ -308,6 +343,16 @@ public:
 		return NodeIteratorBase<Const, !Reverse>(_orthtree, _index + shift);
 	}
 	
+	/**
+	 * \brief Gives a lightweight NodeHandle to the node.
+	 * 
+	 * Unlike dereferencing the iterator, this doesn't look up anything about
+	 * the node until it is asked for through the NodeHandle.
+	 */
+	NodeHandle handle() const {
+		return NodeHandle(_orthtree, _index);
+	}
+	
 	// Iterator element access methods.
 	reference operator*() const;
 	pointer operator->() const;
@@ -105,19 +105,21 @@ operator*() const {
 	NodeIteratorBase<Const, false> parent(
 		_orthtree,
 		_index + _orthtree->_nodes[_index].parentIndex);
+	NodeListSizeType childIndices[1 << Dim];
+	_orthtree->childIndices(_index, childIndices);
 	NodeIteratorBase<Const, false> children[(1 << Dim) + 1];
-	for (
-			std::size_t childIndex = 0;
-			childIndex < (1 << Dim) + 1;
-			++childIndex) {
+	for (std::size_t childIndex = 0; childIndex < (1 << Dim); ++childIndex) {
 		children[childIndex] = NodeIteratorBase<Const, false>(
 			_orthtree,
-			_index + _orthtree->_nodes[_index].childIndices[childIndex]);
+			childIndices[childIndex]);
 	}
+	children[1 << Dim] = NodeIteratorBase<Const, false>(
+		_orthtree,
+		_index + _orthtree->subtreeSize(_index));
 	LeafRangeBase<Const> leafs(
 		_orthtree,
 		_orthtree->_nodes[_index].leafIndex,
-		_orthtree->_nodes[_index].leafIndex +
+		_orthtree->leafEndIndex(_index),
 		_orthtree->_nodes[_index].leafCount);
 	return NodeReferenceProxyBase<Const>(
 		parent,
@@ -126,8 +128,8 @@ operator*() const {
 		_index != 0,
 		_orthtree->_nodes[_index].hasChildren,
 		_orthtree->_nodes[_index].depth,
-		_orthtree->_nodes[_index].position,
-		_orthtree->_nodes[_index].dimensions,
+		_orthtree->nodePosition(_orthtree->_nodes[_index]),
+		_orthtree->nodeDimensions(_orthtree->_nodes[_index]),
 		_orthtree->_nodes[_index].value,
 		std::make_index_sequence<(1 << Dim) + 1>());
 }
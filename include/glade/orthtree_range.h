@@ -48,14 +48,19 @@ private:
 	OrthtreePointer _orthtree;
 	LeafListSizeType _lowerIndex;
 	LeafListSizeType _upperIndex;
+	// The number of leafs in the range. This can be less than the distance
+	// between the indices if the leaf list has gaps.
+	LeafListSizeType _size;
 	
 	LeafRangeBase(
 			OrthtreePointer orthtree,
 			LeafListSizeType lowerIndex,
-			LeafListSizeType upperIndex) :
+			LeafListSizeType upperIndex,
+			LeafListSizeType size) :
 			_orthtree(orthtree),
 			_lowerIndex(lowerIndex),
-			_upperIndex(upperIndex) {
+			_upperIndex(upperIndex),
+			_size(size) {
 	}
 	
 public:
@@ -79,18 +84,34 @@ public:
 	using difference_type = typename iterator::difference_type;
 	
 	operator LeafRangeBase<true>() const {
-		return LeafRangeBase<true>(_orthtree, _lowerIndex, _upperIndex);
+		return LeafRangeBase<true>(_orthtree, _lowerIndex, _upperIndex, _size);
 	}
 	
 	/**
 	 * \brief Provides read-only access to the raw memory where the data for
 	 * this range is stored.
+	 * 
+	 * If the Orthtree's leaf list has gaps (see
+	 * OrthtreeInternalDetailsDefault::LeafGapSize), then the memory may contain
+	 * unused entries between the leafs.
 	 */
 	Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::LeafInternal const*
 	data() const {
 		return _orthtree->_leafs.data() + _lowerIndex;
 	}
 	
+	/**
+	 * \brief Provides read-only access to the raw memory where one coordinate
+	 * of the leaf positions in this range is stored.
+	 * 
+	 * This is only available if the Orthtree stores its leafs as a structure
+	 * of arrays (see OrthtreeInternalDetailsDefault::SplitLeafs). As with
+	 * LeafRangeBase::data, the memory may contain gaps.
+	 */
+	Scalar const* coordinates(std::size_t dim) const {
+		return _orthtree->_leafs.coordinates(dim) + _lowerIndex;
+	}
+	
 	// Container iteration range methods.
 	iterator begin() const {
 		return iterator(_orthtree, _lowerIndex);
@@ -150,13 +171,13 @@ public:
 	
 	// Container size methods.
 	size_type size() const {
-		return _upperIndex - _lowerIndex;
+		return _size;
 	}
 	size_type max_size() const {
 		return size();
 	}
 	bool empty() const {
-		return _upperIndex == _lowerIndex;
+		return _size == 0;
 	}
 	
 };
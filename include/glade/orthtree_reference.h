@@ -43,6 +43,12 @@ private:
 		Const,
 		LeafValue const&,
 		LeafValue&>;
+	// If the coordinates of the leaf positions are stored in separate arrays,
+	// then there is no Vector to refer to, so a copy is stored instead.
+	using PositionReference = std::conditional_t<
+		Details::SplitLeafs,
+		Vector const,
+		Vector const&>;
 	
 	LeafReferenceProxyBase(Vector const& position, ValueReference value) :
 		position(position),
@@ -51,7 +57,7 @@ private:
 	
 public:
 	
-	Vector const& position;
+	PositionReference position;
 	ValueReference value;
 	
 	LeafReferenceProxyBase(LeafReference leaf) : LeafReferenceProxyBase(
@@ -104,6 +110,12 @@ private:
 		Const,
 		NodeValue const&,
 		NodeValue&>;
+	// If the nodes don't store their geometry, then there is no Vector to
+	// refer to, so a copy is stored instead.
+	using GeometryReference = std::conditional_t<
+		Details::ImplicitGeometry,
+		Vector const,
+		Vector const&>;
 	
 	template<std::size_t... Index>
 	NodeReferenceProxyBase(
@@ -112,7 +124,7 @@ private:
 			LeafRangeBase<Const> leafs,
 			bool hasParent,
 			bool const& hasChildren,
-			NodeListSizeType const& depth,
+			NodeListSizeType depth,
 			Vector const& position,
 			Vector const& dimensions,
 			ValueReference value,
@@ -138,10 +150,10 @@ public:
 	bool const hasParent;
 	bool const& hasChildren;
 	
-	NodeListSizeType const& depth;
+	NodeListSizeType const depth;
 	
-	Vector const& position;
-	Vector const& dimensions;
+	GeometryReference position;
+	GeometryReference dimensions;
 	
 	ValueReference value;
 	
@@ -5,11 +5,15 @@
 #include <boost/test/data/monomorphic.hpp>
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <functional>
 #include <iterator>
 #include <limits>
+#include <random>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
@@ -27,7 +31,42 @@ using Scalar = double;
 using Point = std::array<Scalar, Dimension>;
 using LeafPair = std::tuple<LeafValue, Point>;
 using Octree = Orthtree<Dimension, Point, LeafValue, NodeValue>;
+using GappedOctree = Orthtree<
+	Dimension, Point, LeafValue, NodeValue,
+	OrthtreeInternalDetailsGapped>;
+using SplitOctree = Orthtree<
+	Dimension, Point, LeafValue, NodeValue,
+	OrthtreeInternalDetailsSplit>;
+using CompactOctree = Orthtree<
+	Dimension, Point, LeafValue, NodeValue,
+	OrthtreeInternalDetailsCompact>;
+using ImplicitOctree = Orthtree<
+	Dimension, Point, LeafValue, NodeValue,
+	OrthtreeInternalDetailsImplicit>;
+using NarrowOctree = Orthtree<
+	Dimension, Point, LeafValue, NodeValue,
+	OrthtreeInternalDetailsNarrow>;
+using ArenaOctree = Orthtree<
+	Dimension, Point, LeafValue, NodeValue,
+	OrthtreeInternalDetailsArena>;
+using LooseOctree = Orthtree<
+	Dimension, Point, LeafValue, NodeValue,
+	OrthtreeInternalDetailsLoose>;
+// The Details that an orthtree type was made with.
+template<typename Orthtree>
+struct DetailsOf;
+template<
+	std::size_t Dim,
+	typename Vector,
+	typename LeafValue,
+	typename NodeValue,
+	typename Details>
+struct DetailsOf<Orthtree<Dim, Vector, LeafValue, NodeValue, Details> > {
+	using type = Details;
+};
 using RangeIndicesPair = std::pair<std::size_t, std::size_t>;
+// A box, stored as its position and its dimensions.
+using Box = std::pair<Point, Point>;
 
 struct LeafValue {
 	std::size_t data;
@@ -72,18 +111,45 @@ enum class CheckOrthtreeResult {
 // Takes an orthtree and a list of leaf-position pairs that should be contained
 // within it. Checks the structure of the orthtree to make sure that the leafs
 // are located at appropriate locations within the orthtree.
+template<typename Orthtree>
+static bool checkQuery(
+		Orthtree const& orthtree,
+		Box const& box,
+		std::vector<LeafPair> const& leafPairs);
+
+template<typename Orthtree>
+static bool checkPairsWithin(
+		Orthtree const& orthtree,
+		Scalar radius,
+		std::vector<LeafPair> const& leafPairs);
+
+template<typename Orthtree>
+static bool checkTrace(
+		Orthtree const& orthtree,
+		Box const& segment,
+		bool isSegment);
+
 template<
 	typename LeafPair,
-	std::size_t Dim, typename Vector, typename LeafValue, typename NodeValue>
+	std::size_t Dim, typename Vector, typename LeafValue, typename NodeValue,
+	typename Details>
 static CheckOrthtreeResult checkOrthtree(
-		Orthtree<Dim, Vector, LeafValue, NodeValue> const& orthtree,
+		Orthtree<Dim, Vector, LeafValue, NodeValue, Details> const& orthtree,
 		std::vector<LeafPair> allLeafPairs);
 
 std::string to_string(Point const& point);
 std::string to_string(LeafValue const& leafValue);
 std::string to_string(LeafPair const& pair);
 std::string to_string(Octree const& octree);
+std::string to_string(GappedOctree const& octree);
+std::string to_string(SplitOctree const& octree);
+std::string to_string(CompactOctree const& octree);
+std::string to_string(ImplicitOctree const& octree);
+std::string to_string(NarrowOctree const& octree);
+std::string to_string(ArenaOctree const& octree);
+std::string to_string(LooseOctree const& octree);
 std::string to_string(RangeIndicesPair const& pair);
+std::string to_string(Box const& box);
 std::string to_string(CheckOrthtreeResult check);
 template<typename T>
 std::string to_string(std::vector<T> vector);
@@ -118,12 +184,61 @@ struct print_log_value<Octree> {
 	}
 };
 template<>
+struct print_log_value<GappedOctree> {
+	void operator()(std::ostream& os, GappedOctree const& octree) {
+		os << to_string(octree);
+	}
+};
+template<>
+struct print_log_value<SplitOctree> {
+	void operator()(std::ostream& os, SplitOctree const& octree) {
+		os << to_string(octree);
+	}
+};
+template<>
+struct print_log_value<CompactOctree> {
+	void operator()(std::ostream& os, CompactOctree const& octree) {
+		os << to_string(octree);
+	}
+};
+template<>
+struct print_log_value<ImplicitOctree> {
+	void operator()(std::ostream& os, ImplicitOctree const& octree) {
+		os << to_string(octree);
+	}
+};
+template<>
+struct print_log_value<NarrowOctree> {
+	void operator()(std::ostream& os, NarrowOctree const& octree) {
+		os << to_string(octree);
+	}
+};
+
+template<>
+struct print_log_value<ArenaOctree> {
+	void operator()(std::ostream& os, ArenaOctree const& octree) {
+		os << to_string(octree);
+	}
+};
+template<>
+struct print_log_value<LooseOctree> {
+	void operator()(std::ostream& os, LooseOctree const& octree) {
+		os << to_string(octree);
+	}
+};
+template<>
 struct print_log_value<RangeIndicesPair> {
 	void operator()(std::ostream& os, RangeIndicesPair const& pair) {
 		os << to_string(pair);
 	}
 };
 template<>
+struct print_log_value<Box> {
+	void operator()(std::ostream& os, Box const& box) {
+		os << to_string(box);
+	}
+};
+template<>
 struct print_log_value<CheckOrthtreeResult> {
 	void operator()(std::ostream& os, CheckOrthtreeResult check) {
 		os << to_string(check);
@@ -143,10 +258,11 @@ struct print_log_value<std::vector<T> > {
 
 template<
 	typename LeafPair,
-	std::size_t Dim, typename Vector, typename LeafValue, typename NodeValue>
+	std::size_t Dim, typename Vector, typename LeafValue, typename NodeValue,
+	typename Details = OrthtreeInternalDetailsDefault>
 bool compareLeafPair(
 		LeafPair pair,
-		typename Orthtree<Dim, Vector, LeafValue, NodeValue>::Leaf leaf) {
+		typename Orthtree<Dim, Vector, LeafValue, NodeValue, Details>::Leaf leaf) {
 	return
 		leaf.position == std::get<Point>(pair) &&
 		leaf.value == std::get<LeafValue>(pair);
@@ -162,6 +278,134 @@ static auto const octreeData =
 	bdata::make(Octree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 64, 4)) +
 	bdata::make(Octree({-48.0, -32.0, -8.0}, {+64.0, +128.0, +24.0}, 3, 4));
 
+// The same octrees, but with gaps in the leaf list.
+static auto const gappedOctreeData =
+	bdata::make(GappedOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  4)) +
+	bdata::make(GappedOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  0)) +
+	bdata::make(GappedOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  1)) +
+	bdata::make(GappedOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3, 64)) +
+	bdata::make(GappedOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 1, 64)) +
+	bdata::make(GappedOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 64, 4)) +
+	bdata::make(GappedOctree(
+		{-48.0, -32.0, -8.0}, {+64.0, +128.0, +24.0}, 3, 4));
+
+// The same octrees, but storing the leaf positions in separate arrays.
+static auto const splitOctreeData =
+	bdata::make(SplitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  4)) +
+	bdata::make(SplitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  0)) +
+	bdata::make(SplitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  1)) +
+	bdata::make(SplitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3, 64)) +
+	bdata::make(SplitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 1, 64)) +
+	bdata::make(SplitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 64, 4)) +
+	bdata::make(SplitOctree(
+		{-48.0, -32.0, -8.0}, {+64.0, +128.0, +24.0}, 3, 4));
+
+// The same octrees, but with nodes that don't store their child indices.
+static auto const compactOctreeData =
+	bdata::make(CompactOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  4)) +
+	bdata::make(CompactOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  0)) +
+	bdata::make(CompactOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  1)) +
+	bdata::make(CompactOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3, 64)) +
+	bdata::make(CompactOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 1, 64)) +
+	bdata::make(CompactOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 64, 4)) +
+	bdata::make(CompactOctree(
+		{-48.0, -32.0, -8.0}, {+64.0, +128.0, +24.0}, 3, 4));
+
+// The same octrees, but with nodes that don't store their position and
+// dimensions.
+static auto const implicitOctreeData =
+	bdata::make(ImplicitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  4)) +
+	bdata::make(ImplicitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  0)) +
+	bdata::make(ImplicitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  1)) +
+	bdata::make(ImplicitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3, 64)) +
+	bdata::make(ImplicitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 1, 64)) +
+	bdata::make(ImplicitOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 64, 4)) +
+	bdata::make(ImplicitOctree(
+		{-48.0, -32.0, -8.0}, {+64.0, +128.0, +24.0}, 3, 4)) +
+	bdata::make(ImplicitOctree(
+		{-0.3, -1.1, -0.7}, {+16.9, +17.7, +17.3}, 3, 64));
+
+// The same octrees, but with 32 bit indices.
+static auto const narrowOctreeData =
+	bdata::make(NarrowOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  4)) +
+	bdata::make(NarrowOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  0)) +
+	bdata::make(NarrowOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  1)) +
+	bdata::make(NarrowOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3, 64)) +
+	bdata::make(NarrowOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 1, 64)) +
+	bdata::make(NarrowOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 64, 4)) +
+	bdata::make(NarrowOctree(
+		{-48.0, -32.0, -8.0}, {+64.0, +128.0, +24.0}, 3, 4));
+
+// A set of empty octrees that allocate their temporary buffers from an arena.
+static auto const arenaOctreeData =
+	bdata::make(ArenaOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  4)) +
+	bdata::make(ArenaOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  0)) +
+	bdata::make(ArenaOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  1)) +
+	bdata::make(ArenaOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3, 64)) +
+	bdata::make(ArenaOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 1, 64)) +
+	bdata::make(ArenaOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 64, 4)) +
+	bdata::make(ArenaOctree(
+		{-48.0, -32.0, -8.0}, {+64.0, +128.0, +24.0}, 3, 4));
+
+// A set of empty octrees that let leafs move a short distance outside of their
+// nodes.
+static auto const looseOctreeData =
+	bdata::make(LooseOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  4)) +
+	bdata::make(LooseOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  0)) +
+	bdata::make(LooseOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3,  1)) +
+	bdata::make(LooseOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 3, 64)) +
+	bdata::make(LooseOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 1, 64)) +
+	bdata::make(LooseOctree({0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}, 64, 4)) +
+	bdata::make(LooseOctree(
+		{-48.0, -32.0, -8.0}, {+64.0, +128.0, +24.0}, 3, 4));
+
+// Declares a test case named `Orthtree<Preset><name>Test` for each of the
+// presets above, which calls `check(emptyOctree)` with every empty octree of
+// that preset. Features that depend on the Details are tested this way, so
+// that each of them is checked against the same presets.
+#define ORTHTREE_PRESET_TEST_CASE(preset, data, name, check) \
+	BOOST_DATA_TEST_CASE(Orthtree##preset##name##Test, data, emptyOctree) { \
+		check(emptyOctree); \
+	}
+#define ORTHTREE_PRESET_TEST_CASES(name, check) \
+	ORTHTREE_PRESET_TEST_CASE(, octreeData, name, check) \
+	ORTHTREE_PRESET_TEST_CASE(Gapped, gappedOctreeData, name, check) \
+	ORTHTREE_PRESET_TEST_CASE(Split, splitOctreeData, name, check) \
+	ORTHTREE_PRESET_TEST_CASE(Compact, compactOctreeData, name, check) \
+	ORTHTREE_PRESET_TEST_CASE(Implicit, implicitOctreeData, name, check) \
+	ORTHTREE_PRESET_TEST_CASE(Narrow, narrowOctreeData, name, check) \
+	ORTHTREE_PRESET_TEST_CASE(Arena, arenaOctreeData, name, check) \
+	ORTHTREE_PRESET_TEST_CASE(Loose, looseOctreeData, name, check)
+
+// Picks a random point inside of the root of an orthtree.
+template<typename Orthtree>
+static Point randomPoint(Orthtree const& octree, std::mt19937& generator) {
+	std::uniform_real_distribution<Scalar> distribution(0.0, 1.0);
+	Point position = octree.root()->position;
+	Point dimensions = octree.root()->dimensions;
+	Point point;
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		point[dim] = position[dim] + distribution(generator) * dimensions[dim];
+	}
+	return point;
+}
+
+// Inserts `count` leafs at random points inside of the root of an orthtree,
+// with values counting up from zero, and returns the leafs that were inserted.
+template<typename Orthtree>
+static std::vector<LeafPair> fillRandom(
+		Orthtree& octree,
+		std::mt19937& generator,
+		std::size_t count) {
+	std::vector<LeafPair> leafPairs;
+	for (std::size_t index = 0; index < count; ++index) {
+		Point point = randomPoint(octree, generator);
+		octree.insert(LeafValue(index), point);
+		leafPairs.push_back(LeafPair {LeafValue(index), point});
+	}
+	return leafPairs;
+}
+
 // A set of leaf pair lists that can be used to construct octrees.
 static auto const leafPairsData = bdata::make(
 	std::vector<std::vector<LeafPair> > {
@@ -293,6 +537,36 @@ static auto const invalidPositionData = bdata::make([]() {
 	return result;
 }());
 
+// A list of boxes to search for leafs in.
+static auto const boxData = bdata::make(
+	std::vector<Box> {
+		{{0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}},
+		{{0.0, 0.0, 0.0}, {8.0, 16.0, 16.0}},
+		{{4.0, 4.0, 4.0}, {8.0, 8.0, 8.0}},
+		{{3.0, 1.0, 0.0}, {10.0, 5.0, 2.0}},
+		{{12.5, 0.5, 0.5}, {3.0, 15.0, 12.0}},
+		{{13.0, 13.0, 13.0}, {0.5, 0.5, 0.5}},
+		{{5.0, 5.0, 5.0}, {0.0, 0.0, 0.0}},
+		{{20.0, 20.0, 20.0}, {1.0, 1.0, 1.0}},
+		{{-100.0, -100.0, -100.0}, {200.0, 200.0, 200.0}},
+	}
+);
+
+// A list of line segments (start and end) to trace through an octree.
+static auto const segmentData = bdata::make(
+	std::vector<Box> {
+		{{-1.0, 3.1, 5.2}, {17.0, 12.3, 9.9}},
+		{{15.5, 15.5, 15.5}, {0.5, 0.5, 0.5}},
+		{{0.0, 0.0, 0.0}, {16.0, 16.0, 16.0}},
+		{{4.0, 4.0, -5.0}, {4.0, 4.0, 20.0}},
+		{{12.3, 2.0, 7.7}, {1.1, 14.5, 7.7}},
+		{{3.0, 9.0, 13.0}, {3.5, 9.2, 13.1}},
+		{{8.0, 8.0, 8.0}, {8.0, 8.0, 8.0}},
+		{{-10.0, 8.0, 8.0}, {-5.0, 8.0, 8.0}},
+		{{20.0, 20.0, 20.0}, {30.0, 30.0, 30.0}},
+	}
+);
+
 // A list of ranges (indices only).
 static auto const rangeIndicesData = bdata::make(
 	std::vector<RangeIndicesPair> {
@@ -383,6 +657,178 @@ BOOST_DATA_TEST_CASE(
 	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
 }
 
+// Constructs an orthtree from a range of many random points, and checks that
+// it has the same nodes as an orthtree which had the points inserted one at a
+// time.
+BOOST_DATA_TEST_CASE(
+		OrthtreeConstructRandomTest,
+		octreeData,
+		emptyOctree) {
+	std::mt19937 generator(2);
+	std::uniform_real_distribution<Scalar> distribution(0.0, 1.0);
+	std::vector<LeafPair> leafPairs;
+	std::vector<LeafValue> leafValues;
+	std::vector<Point> positions;
+	Octree insertedOctree = emptyOctree;
+	for (int index = 0; index < 500; ++index) {
+		Point point;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			// Round the points so that some of them lie on node boundaries.
+			point[dim] =
+				emptyOctree.root()->position[dim] +
+				std::floor(distribution(generator) * 64.0) / 64.0 *
+				emptyOctree.root()->dimensions[dim];
+		}
+		leafPairs.push_back(LeafPair {LeafValue(index), point});
+		leafValues.push_back(LeafValue(index));
+		positions.push_back(point);
+		insertedOctree.insert(LeafValue(index), point);
+	}
+	Octree octree(
+		emptyOctree.root()->position,
+		emptyOctree.root()->dimensions,
+		leafValues.begin(),
+		leafValues.end(),
+		positions.begin(),
+		positions.end(),
+		emptyOctree.nodeCapacity(),
+		emptyOctree.maxDepth());
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	BOOST_REQUIRE_EQUAL(octree.nodes().size(), insertedOctree.nodes().size());
+	auto insertedNode = insertedOctree.nodes().begin();
+	for (auto node = octree.nodes().begin(); node != octree.nodes().end(); ++node) {
+		BOOST_REQUIRE(node->position == insertedNode->position);
+		BOOST_REQUIRE(node->dimensions == insertedNode->dimensions);
+		BOOST_REQUIRE_EQUAL(node->depth, insertedNode->depth);
+		BOOST_REQUIRE_EQUAL(node->hasChildren, insertedNode->hasChildren);
+		BOOST_REQUIRE_EQUAL(node->leafs.size(), insertedNode->leafs.size());
+		++insertedNode;
+	}
+}
+
+// Constructs an orthtree from a range of points that are packed so closely
+// that the nodes go deeper than the Morton keys reach, and checks that it has
+// the same nodes as an orthtree which had the points inserted one at a time.
+BOOST_DATA_TEST_CASE(
+		OrthtreeConstructDeepTest,
+		octreeData * bdata::make({1, 3}),
+		emptyOctree,
+		threadCount) {
+	std::mt19937 generator(4);
+	std::uniform_real_distribution<Scalar> distribution(0.0, 1.0);
+	std::vector<LeafPair> leafPairs;
+	std::vector<LeafValue> leafValues;
+	std::vector<Point> positions;
+	Octree insertedOctree = emptyOctree;
+	for (int index = 0; index < 300; ++index) {
+		Point point;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			// Most of the points are in a tiny cluster, and the rest are spread
+			// around it.
+			Scalar scale = index % 3 == 0 ? 1.0 : std::ldexp(1.0, -40);
+			point[dim] =
+				emptyOctree.root()->position[dim] +
+				(Scalar(0.3) + scale * distribution(generator) / 2) *
+				emptyOctree.root()->dimensions[dim];
+		}
+		leafPairs.push_back(LeafPair {LeafValue(index), point});
+		leafValues.push_back(LeafValue(index));
+		positions.push_back(point);
+		insertedOctree.insert(LeafValue(index), point);
+	}
+	Octree octree(
+		emptyOctree.root()->position,
+		emptyOctree.root()->dimensions,
+		leafValues.begin(),
+		leafValues.end(),
+		positions.begin(),
+		positions.end(),
+		emptyOctree.nodeCapacity(),
+		emptyOctree.maxDepth(),
+		true,
+		threadCount);
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	BOOST_REQUIRE_EQUAL(octree.nodes().size(), insertedOctree.nodes().size());
+	auto insertedNode = insertedOctree.nodes().begin();
+	for (auto node = octree.nodes().begin(); node != octree.nodes().end(); ++node) {
+		BOOST_REQUIRE(node->position == insertedNode->position);
+		BOOST_REQUIRE(node->dimensions == insertedNode->dimensions);
+		BOOST_REQUIRE_EQUAL(node->depth, insertedNode->depth);
+		BOOST_REQUIRE_EQUAL(node->hasChildren, insertedNode->hasChildren);
+		BOOST_REQUIRE_EQUAL(node->leafs.size(), insertedNode->leafs.size());
+		++insertedNode;
+	}
+}
+
+// Constructs an orthtree from a range using multiple threads, and checks that
+// it is the same as the orthtree constructed with a single thread.
+BOOST_DATA_TEST_CASE(
+		OrthtreeConstructParallelTest,
+		octreeData * bdata::make({2, 3, 16}),
+		emptyOctree,
+		threadCount) {
+	std::mt19937 generator(3);
+	std::uniform_real_distribution<Scalar> distribution(0.0, 1.0);
+	std::vector<LeafPair> leafPairs;
+	std::vector<LeafValue> leafValues;
+	std::vector<Point> positions;
+	for (int index = 0; index < 600; ++index) {
+		Point point;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			// Cluster the points towards one corner so that the subtrees are
+			// different sizes.
+			Scalar x = distribution(generator);
+			point[dim] =
+				emptyOctree.root()->position[dim] +
+				x * x * x * emptyOctree.root()->dimensions[dim];
+		}
+		leafPairs.push_back(LeafPair {LeafValue(index), point});
+		leafValues.push_back(LeafValue(index));
+		positions.push_back(point);
+	}
+	Octree serialOctree(
+		emptyOctree.root()->position,
+		emptyOctree.root()->dimensions,
+		leafValues.begin(),
+		leafValues.end(),
+		positions.begin(),
+		positions.end(),
+		emptyOctree.nodeCapacity(),
+		emptyOctree.maxDepth());
+	Octree octree(
+		emptyOctree.root()->position,
+		emptyOctree.root()->dimensions,
+		leafValues.begin(),
+		leafValues.end(),
+		positions.begin(),
+		positions.end(),
+		emptyOctree.nodeCapacity(),
+		emptyOctree.maxDepth(),
+		true,
+		threadCount);
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	BOOST_REQUIRE_EQUAL(octree.nodes().size(), serialOctree.nodes().size());
+	auto serialNode = serialOctree.nodes().begin();
+	for (auto node = octree.nodes().begin(); node != octree.nodes().end(); ++node) {
+		BOOST_REQUIRE(node->position == serialNode->position);
+		BOOST_REQUIRE_EQUAL(node->depth, serialNode->depth);
+		BOOST_REQUIRE_EQUAL(node->hasChildren, serialNode->hasChildren);
+		BOOST_REQUIRE(std::equal(
+			node->leafs.begin(), node->leafs.end(),
+			serialNode->leafs.begin(), serialNode->leafs.end(),
+			[](auto const& a, auto const& b) {
+				return a.value == b.value && a.position == b.position;
+			}));
+		++serialNode;
+	}
+}
+
 // Constructs an empty orthtree, and then inserts a number of points into it.
 BOOST_DATA_TEST_CASE(
 		OrthtreeInsertManyTest,
@@ -632,12 +1078,292 @@ BOOST_DATA_TEST_CASE(
 	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
 	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
 	
+	// Also insert the points one at a time into a copy of the orthtree, and
+	// adjust it afterwards.
+	Octree expectedOctree = octree;
+	expectedOctree.autoAdjust(false);
+	for (auto it = newLeafPairs.begin(); it != newLeafPairs.end(); ++it) {
+		expectedOctree.insertTuple(*it);
+	}
+	expectedOctree.adjust();
+	
 	octree.insertTuple(newLeafPairs.begin(), newLeafPairs.end());
 	leafPairs.insert(leafPairs.end(), newLeafPairs.begin(), newLeafPairs.end());
 	BOOST_TEST_CHECKPOINT("finished inserting " + to_string(newLeafPairs));
 	
 	check = checkOrthtree(octree, leafPairs);
 	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	// The leafs should be in the same order either way.
+	BOOST_REQUIRE(octree.autoAdjust());
+	BOOST_REQUIRE_EQUAL(octree.nodes().size(), expectedOctree.nodes().size());
+	BOOST_REQUIRE_EQUAL(octree.leafs().size(), expectedOctree.leafs().size());
+	auto expectedLeaf = expectedOctree.leafs().begin();
+	for (auto leaf = octree.leafs().begin(); leaf != octree.leafs().end(); ++leaf) {
+		BOOST_REQUIRE_EQUAL(leaf->value, expectedLeaf->value);
+		BOOST_REQUIRE_EQUAL(leaf->position, expectedLeaf->position);
+		++expectedLeaf;
+	}
+}
+
+// Inserts many random points, erases every leaf that satisfies a predicate,
+// and then erases every leaf from a list of leaf iterators.
+template<typename Orthtree>
+static void checkEraseMany(Orthtree const& emptyOctree) {
+	std::mt19937 generator(17);
+	Orthtree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs = fillRandom(octree, generator, 300);
+	
+	auto isErased = [](LeafValue const& value) {
+		return value.data % 3 == 0 || value.data < 40;
+	};
+	using ConstLeafReferenceProxy = typename Orthtree::ConstLeafReferenceProxy;
+	auto count = octree.eraseIf([&](ConstLeafReferenceProxy leaf) {
+		return isErased(leaf.value);
+	});
+	auto leafPairEnd = std::remove_if(
+		leafPairs.begin(),
+		leafPairs.end(),
+		[&](LeafPair const& leafPair) {
+			return isErased(std::get<LeafValue>(leafPair));
+		});
+	BOOST_REQUIRE_EQUAL(count, leafPairs.end() - leafPairEnd);
+	leafPairs.erase(leafPairEnd, leafPairs.end());
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	// Erase every fourth leaf, and list one of them twice.
+	std::vector<typename Orthtree::LeafIterator> leafIts;
+	std::size_t leafIndex = 0;
+	for (auto leaf = octree.leafs().begin(); leaf != octree.leafs().end(); ++leaf) {
+		if (leafIndex % 4 == 1) {
+			leafIts.push_back(leaf);
+			LeafValue value = leaf->value;
+			leafPairs.erase(std::find_if(
+				leafPairs.begin(),
+				leafPairs.end(),
+				[value](LeafPair const& leafPair) {
+					return std::get<LeafValue>(leafPair) == value;
+				}));
+		}
+		++leafIndex;
+	}
+	if (!leafIts.empty()) {
+		leafIts.push_back(leafIts.front());
+	}
+	octree.eraseEach(leafIts.begin(), leafIts.end());
+	check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	octree.eraseIf([](ConstLeafReferenceProxy) {
+		return true;
+	});
+	BOOST_REQUIRE(octree.leafs().empty());
+	BOOST_REQUIRE_EQUAL(octree.nodes().size(), 1u);
+}
+
+ORTHTREE_PRESET_TEST_CASES(EraseIf, checkEraseMany)
+
+// Moves every leaf a small distance at once, over several steps, like a
+// particle simulation would.
+template<typename Orthtree>
+static void checkRebin(Orthtree const& emptyOctree) {
+	std::mt19937 generator(23);
+	std::uniform_real_distribution<Scalar> distribution(0.0, 1.0);
+	Orthtree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs = fillRandom(octree, generator, 300);
+	
+	for (int step = 0; step < 8; ++step) {
+		// Later steps move the leafs further, so that more of them change
+		// nodes. Some leafs are moved out of the orthtree, and should stay
+		// where they are.
+		Scalar scale = Scalar(0.01) * (1 << step);
+		std::vector<Point> positions;
+		for (
+				auto leaf = octree.leafs().begin();
+				leaf != octree.leafs().end();
+				++leaf) {
+			Point point = leaf->position;
+			for (std::size_t dim = 0; dim < Dimension; ++dim) {
+				point[dim] +=
+					scale *
+					(distribution(generator) - Scalar(0.5)) *
+					emptyOctree.root()->dimensions[dim];
+			}
+			positions.push_back(point);
+			if (octree.contains(octree.root(), point)) {
+				std::get<Point>(leafPairs[leaf->value.data]) = point;
+			}
+		}
+		octree.rebin(positions.begin(), positions.end());
+		BOOST_REQUIRE_EQUAL(octree.leafs().size(), leafPairs.size());
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+}
+
+ORTHTREE_PRESET_TEST_CASES(Rebin, checkRebin)
+
+// Updates the positions of every leaf, first moving them a small distance so
+// that the orthtree is updated in place, and then scattering them so that it
+// is rebuilt.
+template<typename Orthtree>
+static void checkUpdate(Orthtree const& emptyOctree) {
+	std::mt19937 generator(29);
+	Orthtree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs = fillRandom(octree, generator, 300);
+	
+	for (bool scatter : { false, true }) {
+		std::vector<Point> positions;
+		for (
+				auto leaf = octree.leafs().begin();
+				leaf != octree.leafs().end();
+				++leaf) {
+			Point point = leaf->position;
+			if (scatter) {
+				point = randomPoint(octree, generator);
+			}
+			else {
+				// Nudge the leaf towards the center of the orthtree.
+				for (std::size_t dim = 0; dim < Dimension; ++dim) {
+					Scalar center =
+						emptyOctree.root()->position[dim] +
+						emptyOctree.root()->dimensions[dim] / 2;
+					point[dim] += (center - point[dim]) / 64;
+				}
+			}
+			positions.push_back(point);
+			std::get<Point>(leafPairs[leaf->value.data]) = point;
+		}
+		std::size_t nodeCount = octree.nodes().size();
+		// Any rebuild is done with several threads.
+		auto stats = octree.update(positions.begin(), positions.end(), 3);
+		BOOST_REQUIRE_EQUAL(stats.leafCount, leafPairs.size());
+		BOOST_REQUIRE(stats.movedCount <= stats.leafCount);
+		BOOST_REQUIRE(stats.seconds >= 0);
+		// Nudging only moves a few leafs, while scattering moves most of them
+		// (unless there is only the root for them to be in), so each way of
+		// updating is taken once.
+		BOOST_REQUIRE_EQUAL(stats.rebuilt, scatter && nodeCount > 1);
+		BOOST_REQUIRE_EQUAL(
+			stats.rebuilt,
+			stats.movedCount >
+				DetailsOf<Orthtree>::type::RebuildFraction * stats.leafCount);
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+}
+
+ORTHTREE_PRESET_TEST_CASES(Update, checkUpdate)
+
+// Jitters the leafs of a loose octree back and forth, and checks that leafs
+// which stay close to their nodes aren't moved out of them, and that searches
+// still find leafs that are outside of their nodes.
+BOOST_DATA_TEST_CASE(
+		OrthtreeLooseTest,
+		looseOctreeData,
+		emptyOctree) {
+	std::mt19937 generator(31);
+	std::uniform_real_distribution<Scalar> distribution(0.0, 1.0);
+	Point rootPosition = emptyOctree.root()->position;
+	Point rootDimensions = emptyOctree.root()->dimensions;
+	LooseOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs = fillRandom(octree, generator, 300);
+	Scalar looseness = OrthtreeInternalDetailsLoose::Looseness;
+	
+	// Moving a leaf just past the edge of its node leaves it in the node.
+	auto leaf = octree.leafs().begin() + 7;
+	auto node = octree.find(leaf);
+	Point point = leaf->position;
+	point[0] = node->position[0] + node->dimensions[0] +
+		looseness * rootDimensions[0] / 2;
+	if (octree.contains(octree.root(), point)) {
+		std::size_t nodeCount = octree.nodes().size();
+		auto result = octree.move(leaf, point);
+		BOOST_REQUIRE(std::get<0>(result) == std::get<1>(result));
+		BOOST_REQUIRE(!octree.contains(std::get<1>(result), point));
+		BOOST_REQUIRE_EQUAL(octree.nodes().size(), nodeCount);
+		std::get<Point>(leafPairs[std::get<2>(result)->value.data]) = point;
+	}
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	// Then jitter all of the leafs, alternating between moving them one at a
+	// time and all at once.
+	for (int step = 0; step < 12; ++step) {
+		std::vector<Point> positions;
+		for (
+				auto leaf = octree.leafs().begin();
+				leaf != octree.leafs().end();
+				++leaf) {
+			Point point = leaf->position;
+			for (std::size_t dim = 0; dim < Dimension; ++dim) {
+				point[dim] +=
+					2 * looseness * rootDimensions[dim] *
+					(distribution(generator) - Scalar(0.5));
+			}
+			if (!octree.contains(octree.root(), point)) {
+				point = leaf->position;
+			}
+			positions.push_back(point);
+			std::get<Point>(leafPairs[leaf->value.data]) = point;
+		}
+		if (step % 2 == 0) {
+			octree.rebin(positions.begin(), positions.end());
+		}
+		else {
+			// Moving a leaf can reorder the leaf list, so the leafs are looked
+			// up by value.
+			std::vector<LeafValue> values;
+			for (
+					auto leaf = octree.leafs().begin();
+					leaf != octree.leafs().end();
+					++leaf) {
+				values.push_back(leaf->value);
+			}
+			for (LeafValue const& value : values) {
+				auto leaf = octree.leafs().begin();
+				while (leaf->value != value) {
+					++leaf;
+				}
+				octree.move(leaf, std::get<Point>(leafPairs[value.data]));
+			}
+		}
+		check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+	
+	// Searches still have to find every leaf.
+	Box box {rootPosition, rootDimensions};
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		box.first[dim] += rootDimensions[dim] / 3;
+		box.second[dim] /= 3;
+	}
+	BOOST_REQUIRE(checkQuery(octree, box, leafPairs));
+	BOOST_REQUIRE(checkPairsWithin(octree, rootDimensions[0] / 8, leafPairs));
+	Point center;
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		center[dim] = rootPosition[dim] + rootDimensions[dim] / 2;
+	}
+	auto squaredDistance = [&](Point const& position) {
+		Scalar result = 0.0;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			result +=
+				(position[dim] - center[dim]) * (position[dim] - center[dim]);
+		}
+		return result;
+	};
+	std::vector<Scalar> expected;
+	for (LeafPair const& leafPair : leafPairs) {
+		expected.push_back(squaredDistance(std::get<Point>(leafPair)));
+	}
+	std::sort(expected.begin(), expected.end());
+	expected.resize(10);
+	std::vector<Scalar> found;
+	for (auto leaf : octree.nearest(center, 10)) {
+		found.push_back(squaredDistance(leaf->position));
+	}
+	BOOST_REQUIRE(found == expected);
 }
 
 // Erases a range of leafs.
@@ -749,25 +1475,1981 @@ BOOST_DATA_TEST_CASE(
 	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
 }
 
-template<
-	typename LeafPair,
-	std::size_t Dim, typename Vector, typename LeafValue, typename NodeValue>
-CheckOrthtreeResult checkOrthtree(
-		Orthtree<Dim, Vector, LeafValue, NodeValue> const& orthtree,
-		std::vector<LeafPair> allLeafPairs) {
-	// Create a stack storing the points that belong to the current node.
-	std::vector<std::vector<LeafPair> > leafPairsStack;
-	leafPairsStack.push_back(allLeafPairs);
-	
-	// Check that the root node has no parent.
-	if (orthtree.root()->hasParent) {
-		return CheckOrthtreeResult::RootHasParent;
+// Inserts points into an orthtree with gaps one at a time, and then erases them
+// one at a time.
+BOOST_DATA_TEST_CASE(
+		OrthtreeGappedInsertEraseManyTest,
+		gappedOctreeData * leafPairsData,
+		emptyOctree,
+		initialLeafPairs) {
+	GappedOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		BOOST_TEST_CHECKPOINT("preparing to insert " + to_string(*it));
+		leafPairs.push_back(*it);
+		octree.insertTuple(*it);
+		BOOST_TEST_CHECKPOINT("finished inserting " + to_string(*it));
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+	while (!leafPairs.empty()) {
+		auto leafPairIt = leafPairs.begin();
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsGapped>,
+				*leafPairIt,
+				std::placeholders::_1));
+		LeafPair leafPair = *leafPairIt;
+		BOOST_TEST_CHECKPOINT("preparing to erase " + to_string(leafPair));
+		leafPairs.erase(leafPairIt);
+		octree.erase(octreeLeafIt);
+		BOOST_TEST_CHECKPOINT("finished erasing " + to_string(leafPair));
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+}
+
+// Moves a point within an orthtree with gaps.
+BOOST_DATA_TEST_CASE(
+		OrthtreeGappedMoveTest,
+		gappedOctreeData * leafPairsData * leafData * positionData,
+		emptyOctree,
+		initialLeafPairs,
+		moveValue,
+		movePosition) {
+	GappedOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs = initialLeafPairs;
+	for (auto it = leafPairs.begin(); it != leafPairs.end(); ++it) {
+		octree.insertTuple(*it);
 	}
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
 	
-	// Loop through all of the nodes.
-	for (
-			auto node = orthtree.root();
-			node != orthtree.nodes().end();
+	auto leafPairIt = std::find_if(
+		leafPairs.begin(),
+		leafPairs.end(),
+		[moveValue](LeafPair pair) {
+			return std::get<LeafValue>(pair) == moveValue;
+		}
+	);
+	if (leafPairIt != leafPairs.end()) {
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsGapped>,
+				*leafPairIt,
+				std::placeholders::_1));
+		auto result = octree.move(octreeLeafIt, movePosition);
+		std::get<Point>(*leafPairIt) = movePosition;
+		BOOST_REQUIRE(std::get<2>(result)->position == movePosition);
+		BOOST_REQUIRE(std::get<2>(result)->value == moveValue);
+	}
+	
+	check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+}
+
+// Constructs an orthtree with gaps from a range, and then inserts, moves, and
+// erases ranges of leafs.
+BOOST_DATA_TEST_CASE(
+		OrthtreeGappedRangeTest,
+		gappedOctreeData * leafPairsData * (rangeIndicesData ^ positionsData),
+		emptyOctree,
+		initialLeafPairs,
+		leafRangeIndices,
+		movePositions) {
+	std::vector<LeafValue> leafValues;
+	std::vector<Point> positions;
+	for (LeafPair pair : initialLeafPairs) {
+		leafValues.push_back(std::get<LeafValue>(pair));
+		positions.push_back(std::get<Point>(pair));
+	}
+	GappedOctree octree(
+		emptyOctree.root()->position,
+		emptyOctree.root()->dimensions,
+		leafValues.begin(), leafValues.end(),
+		positions.begin(), positions.end(),
+		emptyOctree.nodeCapacity(),
+		emptyOctree.maxDepth());
+	std::vector<LeafPair> leafPairs = initialLeafPairs;
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	// Insert a copy of the leafs with different values.
+	std::vector<LeafPair> newLeafPairs;
+	for (LeafPair pair : initialLeafPairs) {
+		newLeafPairs.push_back(LeafPair {
+			LeafValue(std::get<LeafValue>(pair).data + 100),
+			std::get<Point>(pair)});
+	}
+	octree.insertTuple(newLeafPairs.begin(), newLeafPairs.end());
+	leafPairs.insert(leafPairs.end(), newLeafPairs.begin(), newLeafPairs.end());
+	check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	std::size_t leafRangeIndexBegin = leafRangeIndices.first;
+	std::size_t leafRangeIndexEnd = leafRangeIndices.second;
+	if (leafRangeIndexEnd < octree.leafs().size()) {
+		// Move a range of leafs.
+		auto leafRangeBegin = octree.leafs().begin() + leafRangeIndexBegin;
+		auto leafRangeEnd = octree.leafs().begin() + leafRangeIndexEnd;
+		BOOST_REQUIRE_EQUAL(
+			leafRangeEnd - leafRangeBegin,
+			leafRangeIndexEnd - leafRangeIndexBegin);
+		auto positionIt = movePositions.begin();
+		for (auto leafIt = leafRangeBegin; leafIt != leafRangeEnd; ++leafIt) {
+			LeafValue moveValue = leafIt->value;
+			auto leafPairIt = std::find_if(
+				leafPairs.begin(),
+				leafPairs.end(),
+				[moveValue](LeafPair pair) {
+					return std::get<LeafValue>(pair) == moveValue;
+				}
+			);
+			std::get<Point>(*leafPairIt) = *positionIt;
+			++positionIt;
+		}
+		octree.move(
+			leafRangeBegin, leafRangeEnd,
+			movePositions.begin(), movePositions.end());
+		check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+		
+		// Erase a range of leafs.
+		leafRangeBegin = octree.leafs().begin() + leafRangeIndexBegin;
+		leafRangeEnd = octree.leafs().begin() + leafRangeIndexEnd;
+		for (auto leafIt = leafRangeBegin; leafIt != leafRangeEnd; ++leafIt) {
+			LeafValue eraseValue = leafIt->value;
+			auto leafPairIt = std::find_if(
+				leafPairs.begin(),
+				leafPairs.end(),
+				[eraseValue](LeafPair pair) {
+					return std::get<LeafValue>(pair) == eraseValue;
+				}
+			);
+			leafPairs.erase(leafPairIt);
+		}
+		octree.erase(leafRangeBegin, leafRangeEnd);
+		check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+}
+
+// Inserts, moves, and erases many random leafs in an orthtree with gaps, so
+// that gaps have to be borrowed from neighbouring nodes and redistributed.
+BOOST_DATA_TEST_CASE(
+		OrthtreeGappedRandomTest,
+		gappedOctreeData,
+		emptyOctree) {
+	std::mt19937 generator(1);
+	GappedOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs = fillRandom(octree, generator, 200);
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	for (int index = 0; index < 200; index += 3) {
+		auto leafPairIt = leafPairs.begin() + index;
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsGapped>,
+				*leafPairIt,
+				std::placeholders::_1));
+		Point position = randomPoint(emptyOctree, generator);
+		octree.move(octreeLeafIt, position);
+		std::get<Point>(*leafPairIt) = position;
+	}
+	check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	for (int index = 0; index < 100; ++index) {
+		auto leafPairIt = leafPairs.begin() + index;
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsGapped>,
+				*leafPairIt,
+				std::placeholders::_1));
+		octree.erase(octreeLeafIt);
+	}
+	leafPairs.erase(leafPairs.begin(), leafPairs.begin() + 100);
+	check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	// Jumping over the gaps should reach the same leafs as stepping through
+	// them one at a time, in both directions.
+	std::vector<GappedOctree::LeafIterator> forward;
+	std::vector<GappedOctree::ReverseLeafIterator> reverse;
+	for (auto it = octree.leafs().begin(); it != octree.leafs().end(); ++it) {
+		forward.push_back(it);
+	}
+	forward.push_back(octree.leafs().end());
+	for (auto it = octree.leafs().rbegin(); it != octree.leafs().rend(); ++it) {
+		reverse.push_back(it);
+	}
+	reverse.push_back(octree.leafs().rend());
+	BOOST_REQUIRE_EQUAL(forward.size(), leafPairs.size() + 1);
+	for (std::size_t i = 0; i < forward.size(); i += 7) {
+		for (std::size_t j = 0; j < forward.size(); ++j) {
+			std::ptrdiff_t n = std::ptrdiff_t(j) - std::ptrdiff_t(i);
+			BOOST_REQUIRE(forward[i] + n == forward[j]);
+			BOOST_REQUIRE(forward[j] - n == forward[i]);
+			BOOST_REQUIRE_EQUAL(forward[j] - forward[i], n);
+			BOOST_REQUIRE(reverse[i] + n == reverse[j]);
+			BOOST_REQUIRE_EQUAL(reverse[j] - reverse[i], n);
+		}
+	}
+}
+
+// Inserts points into an orthtree with split leaf storage one at a time, and
+// then erases them one at a time.
+BOOST_DATA_TEST_CASE(
+		OrthtreeSplitInsertEraseManyTest,
+		splitOctreeData * leafPairsData,
+		emptyOctree,
+		initialLeafPairs) {
+	SplitOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		leafPairs.push_back(*it);
+		octree.insertTuple(*it);
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+	// The coordinate arrays should match the positions of the leafs.
+	auto leafs = octree.leafs();
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		Scalar const* coordinate = leafs.coordinates(dim);
+		for (auto leaf = leafs.begin(); leaf != leafs.end(); ++leaf) {
+			BOOST_REQUIRE_EQUAL(*coordinate, leaf->position[dim]);
+			++coordinate;
+		}
+	}
+	while (!leafPairs.empty()) {
+		auto leafPairIt = leafPairs.begin();
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsSplit>,
+				*leafPairIt,
+				std::placeholders::_1));
+		leafPairs.erase(leafPairIt);
+		octree.erase(octreeLeafIt);
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+}
+
+// Constructs an orthtree with split leaf storage from a range of leafs, and
+// then moves and changes the values of many of them.
+BOOST_DATA_TEST_CASE(
+		OrthtreeSplitRandomTest,
+		splitOctreeData,
+		emptyOctree) {
+	std::mt19937 generator(2);
+	std::vector<LeafValue> leafValues;
+	std::vector<Point> positions;
+	std::vector<LeafPair> leafPairs;
+	for (int index = 0; index < 200; ++index) {
+		leafValues.push_back(LeafValue(index));
+		positions.push_back(randomPoint(emptyOctree, generator));
+		leafPairs.push_back(LeafPair {leafValues.back(), positions.back()});
+	}
+	SplitOctree octree(
+		emptyOctree.root()->position,
+		emptyOctree.root()->dimensions,
+		leafValues.begin(), leafValues.end(),
+		positions.begin(), positions.end(),
+		emptyOctree.nodeCapacity(),
+		emptyOctree.maxDepth());
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	for (int index = 0; index < 200; index += 3) {
+		auto leafPairIt = leafPairs.begin() + index;
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsSplit>,
+				*leafPairIt,
+				std::placeholders::_1));
+		Point position = randomPoint(emptyOctree, generator);
+		octreeLeafIt = std::get<2>(octree.move(octreeLeafIt, position));
+		octreeLeafIt->value = LeafValue(index + 1000);
+		std::get<Point>(*leafPairIt) = position;
+		std::get<LeafValue>(*leafPairIt) = LeafValue(index + 1000);
+	}
+	check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	Box box {emptyOctree.root()->position, emptyOctree.root()->dimensions};
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		box.second[dim] /= 2;
+	}
+	BOOST_REQUIRE(checkQuery(octree, box, leafPairs));
+}
+
+// Traces line segments through an octree with split leaf storage.
+BOOST_DATA_TEST_CASE(
+		OrthtreeSplitTraceTest,
+		splitOctreeData * leafPairsData * segmentData,
+		emptyOctree,
+		initialLeafPairs,
+		segment) {
+	SplitOctree octree = emptyOctree;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		octree.insertTuple(*it);
+	}
+	BOOST_REQUIRE(checkTrace(octree, segment, true));
+}
+
+// Finds every pair of leafs that are within a distance of each other in an
+// orthtree that stores coordinates separately, where the vectorized kernels are
+// used.
+BOOST_DATA_TEST_CASE(
+		OrthtreeSplitForEachPairWithinTest,
+		splitOctreeData * leafPairsData * bdata::make({0.0, 2.0, 5.0, 40.0}),
+		emptyOctree,
+		initialLeafPairs,
+		radius) {
+	SplitOctree octree = emptyOctree;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		octree.insertTuple(*it);
+	}
+	BOOST_REQUIRE(checkPairsWithin(octree, radius, initialLeafPairs));
+}
+
+// Inserts points into an orthtree with compact nodes one at a time, and then
+// erases them one at a time.
+BOOST_DATA_TEST_CASE(
+		OrthtreeCompactInsertEraseManyTest,
+		compactOctreeData * leafPairsData,
+		emptyOctree,
+		initialLeafPairs) {
+	CompactOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		leafPairs.push_back(*it);
+		octree.insertTuple(*it);
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+	while (!leafPairs.empty()) {
+		auto leafPairIt = leafPairs.begin();
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsCompact>,
+				*leafPairIt,
+				std::placeholders::_1));
+		leafPairs.erase(leafPairIt);
+		octree.erase(octreeLeafIt);
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+}
+
+// Constructs an orthtree with compact nodes from a range of leafs, moves many
+// of them, and then searches it in each of the ways that walk over children.
+BOOST_DATA_TEST_CASE(
+		OrthtreeCompactRandomTest,
+		compactOctreeData * segmentData,
+		emptyOctree,
+		segment) {
+	std::mt19937 generator(3);
+	std::vector<LeafValue> leafValues;
+	std::vector<Point> positions;
+	std::vector<LeafPair> leafPairs;
+	for (int index = 0; index < 200; ++index) {
+		leafValues.push_back(LeafValue(index));
+		positions.push_back(randomPoint(emptyOctree, generator));
+		leafPairs.push_back(LeafPair {leafValues.back(), positions.back()});
+	}
+	CompactOctree octree(
+		emptyOctree.root()->position,
+		emptyOctree.root()->dimensions,
+		leafValues.begin(), leafValues.end(),
+		positions.begin(), positions.end(),
+		emptyOctree.nodeCapacity(),
+		emptyOctree.maxDepth());
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	for (int index = 0; index < 200; index += 3) {
+		auto leafPairIt = leafPairs.begin() + index;
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsCompact>,
+				*leafPairIt,
+				std::placeholders::_1));
+		Point position = randomPoint(emptyOctree, generator);
+		octreeLeafIt = std::get<2>(octree.move(octreeLeafIt, position));
+		std::get<Point>(*leafPairIt) = position;
+	}
+	check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	Box box {emptyOctree.root()->position, emptyOctree.root()->dimensions};
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		box.second[dim] /= 2;
+	}
+	BOOST_REQUIRE(checkQuery(octree, box, leafPairs));
+	BOOST_REQUIRE(checkPairsWithin(octree, 2.0, leafPairs));
+	BOOST_REQUIRE(checkTrace(octree, segment, true));
+}
+
+// Inserts points into an orthtree with implicit node geometry one at a time,
+// and then erases them one at a time.
+BOOST_DATA_TEST_CASE(
+		OrthtreeImplicitInsertEraseManyTest,
+		implicitOctreeData * leafPairsData,
+		emptyOctree,
+		initialLeafPairs) {
+	BOOST_REQUIRE_LE(emptyOctree.maxDepth(), 32u);
+	ImplicitOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		leafPairs.push_back(*it);
+		octree.insertTuple(*it);
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+	while (!leafPairs.empty()) {
+		auto leafPairIt = leafPairs.begin();
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsImplicit>,
+				*leafPairIt,
+				std::placeholders::_1));
+		leafPairs.erase(leafPairIt);
+		octree.erase(octreeLeafIt);
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+}
+
+// Constructs an orthtree with implicit node geometry from a range of leafs,
+// moves many of them, and then searches it in each of the ways that look at
+// the geometry of the nodes.
+BOOST_DATA_TEST_CASE(
+		OrthtreeImplicitRandomTest,
+		implicitOctreeData * segmentData,
+		emptyOctree,
+		segment) {
+	std::mt19937 generator(5);
+	std::vector<LeafValue> leafValues;
+	std::vector<Point> positions;
+	std::vector<LeafPair> leafPairs;
+	for (int index = 0; index < 200; ++index) {
+		leafValues.push_back(LeafValue(index));
+		positions.push_back(randomPoint(emptyOctree, generator));
+		leafPairs.push_back(LeafPair {leafValues.back(), positions.back()});
+	}
+	ImplicitOctree octree(
+		emptyOctree.root()->position,
+		emptyOctree.root()->dimensions,
+		leafValues.begin(), leafValues.end(),
+		positions.begin(), positions.end(),
+		emptyOctree.nodeCapacity(),
+		emptyOctree.maxDepth());
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	for (int index = 0; index < 200; index += 3) {
+		auto leafPairIt = leafPairs.begin() + index;
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsImplicit>,
+				*leafPairIt,
+				std::placeholders::_1));
+		Point position = randomPoint(emptyOctree, generator);
+		octreeLeafIt = std::get<2>(octree.move(octreeLeafIt, position));
+		std::get<Point>(*leafPairIt) = position;
+	}
+	check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	Box box {emptyOctree.root()->position, emptyOctree.root()->dimensions};
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		box.second[dim] /= 2;
+	}
+	BOOST_REQUIRE(checkQuery(octree, box, leafPairs));
+	BOOST_REQUIRE(checkPairsWithin(octree, 2.0, leafPairs));
+	BOOST_REQUIRE(checkTrace(octree, segment, true));
+}
+
+// Inserts points into an orthtree with 32 bit indices one at a time, and then
+// erases them one at a time.
+BOOST_DATA_TEST_CASE(
+		OrthtreeNarrowInsertEraseManyTest,
+		narrowOctreeData * leafPairsData,
+		emptyOctree,
+		initialLeafPairs) {
+	NarrowOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		leafPairs.push_back(*it);
+		octree.insertTuple(*it);
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+	while (!leafPairs.empty()) {
+		auto leafPairIt = leafPairs.begin();
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsNarrow>,
+				*leafPairIt,
+				std::placeholders::_1));
+		leafPairs.erase(leafPairIt);
+		octree.erase(octreeLeafIt);
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+}
+
+// Constructs an orthtree with 32 bit indices from a range of leafs, moves many
+// of them, and then searches it.
+BOOST_DATA_TEST_CASE(
+		OrthtreeNarrowRandomTest,
+		narrowOctreeData * segmentData,
+		emptyOctree,
+		segment) {
+	std::mt19937 generator(7);
+	std::vector<LeafValue> leafValues;
+	std::vector<Point> positions;
+	std::vector<LeafPair> leafPairs;
+	for (int index = 0; index < 200; ++index) {
+		leafValues.push_back(LeafValue(index));
+		positions.push_back(randomPoint(emptyOctree, generator));
+		leafPairs.push_back(LeafPair {leafValues.back(), positions.back()});
+	}
+	NarrowOctree octree(
+		emptyOctree.root()->position,
+		emptyOctree.root()->dimensions,
+		leafValues.begin(), leafValues.end(),
+		positions.begin(), positions.end(),
+		emptyOctree.nodeCapacity(),
+		emptyOctree.maxDepth());
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	for (int index = 0; index < 200; index += 3) {
+		auto leafPairIt = leafPairs.begin() + index;
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsNarrow>,
+				*leafPairIt,
+				std::placeholders::_1));
+		Point position = randomPoint(emptyOctree, generator);
+		octreeLeafIt = std::get<2>(octree.move(octreeLeafIt, position));
+		std::get<Point>(*leafPairIt) = position;
+	}
+	check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	Box box {emptyOctree.root()->position, emptyOctree.root()->dimensions};
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		box.second[dim] /= 2;
+	}
+	BOOST_REQUIRE(checkQuery(octree, box, leafPairs));
+	BOOST_REQUIRE(checkPairsWithin(octree, 2.0, leafPairs));
+	BOOST_REQUIRE(checkTrace(octree, segment, true));
+}
+
+// Inserts many batches of points into an orthtree that uses a scratch arena,
+// moving and erasing some of them in between, so that the temporary buffers are
+// reused many times.
+BOOST_DATA_TEST_CASE(
+		OrthtreeArenaBatchTest,
+		arenaOctreeData * segmentData,
+		emptyOctree,
+		segment) {
+	std::mt19937 generator(11);
+	ArenaOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs;
+	int nextValue = 0;
+	for (int batch = 0; batch < 6; ++batch) {
+		std::vector<LeafPair> batchPairs;
+		for (int index = 0; index < 40; ++index) {
+			batchPairs.push_back(LeafPair {
+				LeafValue(nextValue),
+				randomPoint(emptyOctree, generator)});
+			++nextValue;
+		}
+		octree.insertTuple(batchPairs.begin(), batchPairs.end());
+		leafPairs.insert(leafPairs.end(), batchPairs.begin(), batchPairs.end());
+		CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+		
+		// Move a range of leafs all at once.
+		std::vector<Point> positions;
+		for (int index = 0; index < 10; ++index) {
+			positions.push_back(randomPoint(emptyOctree, generator));
+		}
+		auto leafBegin = octree.leafs().begin() + 5;
+		for (std::size_t index = 0; index < positions.size(); ++index) {
+			LeafValue value = (leafBegin + index)->value;
+			for (LeafPair& leafPair : leafPairs) {
+				if (std::get<LeafValue>(leafPair) == value) {
+					std::get<Point>(leafPair) = positions[index];
+				}
+			}
+		}
+		octree.move(
+			leafBegin, leafBegin + positions.size(),
+			positions.begin(), positions.end());
+		check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+		
+		for (int index = 0; index < 15; ++index) {
+			auto leafPairIt = leafPairs.begin() + (7 * index) % leafPairs.size();
+			auto octreeLeafIt = std::find_if(
+				octree.leafs().begin(),
+				octree.leafs().end(),
+				std::bind(
+					compareLeafPair<
+						LeafPair,
+						Dimension, Point, LeafValue, NodeValue,
+						OrthtreeInternalDetailsArena>,
+					*leafPairIt,
+					std::placeholders::_1));
+			leafPairs.erase(leafPairIt);
+			octree.erase(octreeLeafIt);
+		}
+		check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+	
+	Box box {emptyOctree.root()->position, emptyOctree.root()->dimensions};
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		box.second[dim] /= 2;
+	}
+	BOOST_REQUIRE(checkQuery(octree, box, leafPairs));
+	BOOST_REQUIRE(checkPairsWithin(octree, 2.0, leafPairs));
+	BOOST_REQUIRE(checkTrace(octree, segment, true));
+}
+
+// Checks that an arena stops growing once it is large enough for the buffers
+// that are allocated from it, and that rewinding gives the memory back.
+BOOST_AUTO_TEST_CASE(MonotonicArenaReuseTest) {
+	internal::MonotonicArena arena;
+	std::size_t capacity = 0;
+	for (int round = 0; round < 8; ++round) {
+		internal::ArenaScope scope(arena);
+		internal::ArenaAllocator<double> allocator(&arena);
+		std::vector<double, internal::ArenaAllocator<double> > values(
+			allocator);
+		for (int index = 0; index < 10000; ++index) {
+			values.push_back(index);
+		}
+		std::vector<char, internal::ArenaAllocator<char> > bytes(
+			300, 'a', allocator);
+		BOOST_REQUIRE_EQUAL(values[9999], 9999.0);
+		BOOST_REQUIRE_EQUAL(bytes[299], 'a');
+		if (round > 0) {
+			BOOST_REQUIRE_EQUAL(arena.capacity(), capacity);
+		}
+		capacity = arena.capacity();
+	}
+	BOOST_REQUIRE_EQUAL(arena.mark().block, 0u);
+	BOOST_REQUIRE_EQUAL(arena.mark().offset, 0u);
+}
+
+// Inserts a range of leafs into the middle of a split leaf list, both by
+// copying them and by moving them, and checks that the values are only copied
+// in the first case.
+BOOST_AUTO_TEST_CASE(SplitLeafListInsertRangeTest) {
+	struct Value {
+		int data;
+		int copies;
+		explicit Value(int data = 0) : data(data), copies(0) {
+		}
+		Value(Value const& other) : data(other.data), copies(other.copies + 1) {
+		}
+		Value(Value&& other) = default;
+		Value& operator=(Value const& other) {
+			data = other.data;
+			copies = other.copies + 1;
+			return *this;
+		}
+		Value& operator=(Value&& other) = default;
+	};
+	struct Element {
+		Point position;
+		Value value;
+		Element(Point position, Value value = Value()) :
+				position(position),
+				value(std::move(value)) {
+		}
+	};
+	using List = internal::SplitLeafList<
+		Dimension, Scalar, Point, Value, Element,
+		OrthtreeInternalDetailsSplit>;
+	auto makeElements = [](int begin, int end) {
+		std::vector<Element> elements;
+		for (int index = begin; index < end; ++index) {
+			Scalar x = index;
+			elements.push_back(Element({x, 2 * x, 3 * x}, Value(index)));
+		}
+		return elements;
+	};
+	for (bool move : { false, true }) {
+		List list;
+		std::vector<Element> outer = makeElements(0, 4);
+		list.insert(list.cbegin(), outer.begin(), outer.end());
+		std::vector<Element> inner = makeElements(10, 15);
+		if (move) {
+			list.insert(
+				list.cbegin() + 2,
+				std::make_move_iterator(inner.begin()),
+				std::make_move_iterator(inner.end()));
+		}
+		else {
+			list.insert(list.cbegin() + 2, inner.begin(), inner.end());
+		}
+		std::vector<int> expected { 0, 1, 10, 11, 12, 13, 14, 2, 3 };
+		BOOST_REQUIRE_EQUAL(list.size(), expected.size());
+		for (std::size_t index = 0; index < expected.size(); ++index) {
+			Scalar x = expected[index];
+			BOOST_REQUIRE_EQUAL(list[index].value.data, expected[index]);
+			BOOST_REQUIRE(list[index].position == (Point {x, 2 * x, 3 * x}));
+			bool isInner = index >= 2 && index < 7;
+			BOOST_REQUIRE_EQUAL(
+				list[index].value.copies,
+				isInner && move ? 0 : 1);
+		}
+	}
+}
+
+// Builds an orthtree that doesn't adjust itself, then fills up one part of it
+// and empties out another before adjusting first one of the children of the
+// root and then the whole orthtree.
+template<typename Orthtree>
+static void checkAdjust(Orthtree const& emptyOctree) {
+	using Details = typename DetailsOf<Orthtree>::type;
+	std::mt19937 generator(13);
+	Point rootPosition = emptyOctree.root()->position;
+	std::vector<LeafValue> leafValues;
+	std::vector<Point> positions;
+	std::vector<LeafPair> leafPairs;
+	for (int index = 0; index < 200; ++index) {
+		leafValues.push_back(LeafValue(index));
+		positions.push_back(randomPoint(emptyOctree, generator));
+		leafPairs.push_back(LeafPair {leafValues.back(), positions.back()});
+	}
+	Orthtree octree(
+		emptyOctree.root()->position,
+		emptyOctree.root()->dimensions,
+		leafValues.begin(), leafValues.end(),
+		positions.begin(), positions.end(),
+		emptyOctree.nodeCapacity(),
+		emptyOctree.maxDepth(),
+		false);
+	for (int index = 200; index < 300; ++index) {
+		// Only fill up the lower corner of the orthtree.
+		Point position = randomPoint(emptyOctree, generator);
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			position[dim] = (rootPosition[dim] + position[dim]) / 2;
+		}
+		octree.insert(LeafValue(index), position);
+		leafPairs.push_back(LeafPair {LeafValue(index), position});
+	}
+	for (auto it = leafPairs.begin(); it != leafPairs.end(); ) {
+		if (std::get<Point>(*it)[0] < 0.5 * (
+				2 * emptyOctree.root()->position[0] +
+				emptyOctree.root()->dimensions[0])) {
+			++it;
+			continue;
+		}
+		auto octreeLeafIt = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					Details>,
+				*it,
+				std::placeholders::_1));
+		octree.erase(octreeLeafIt);
+		it = leafPairs.erase(it);
+	}
+	if (octree.root()->hasChildren) {
+		octree.adjust(octree.root()->children[0]);
+		BOOST_REQUIRE(
+			octree.root()->children[1 << Dimension] == octree.nodes().end());
+		for (std::size_t index = 0; index < (1 << Dimension); ++index) {
+			BOOST_REQUIRE(
+				octree.root()->children[index]->parent == octree.root());
+		}
+	}
+	octree.adjust();
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	BOOST_REQUIRE(!octree.adjust());
+}
+
+ORTHTREE_PRESET_TEST_CASES(Adjust, checkAdjust)
+
+// Inserts and erases a leaf at the same place over and over in an orthtree
+// that only merges nodes once they hold half as many leafs as they can, and
+// checks that the nodes aren't split and merged every time.
+template<typename Orthtree>
+static void checkMergeCapacity(Orthtree const& emptyOctree) {
+	Orthtree octree = emptyOctree;
+	octree.mergeCapacity(octree.nodeCapacity() + 1);
+	BOOST_REQUIRE_EQUAL(octree.mergeCapacity(), octree.nodeCapacity());
+	octree.mergeCapacity(octree.nodeCapacity() / 2);
+	BOOST_REQUIRE_EQUAL(octree.mergeCapacity(), octree.nodeCapacity() / 2);
+	
+	std::mt19937 generator(12);
+	std::vector<LeafPair> leafPairs = fillRandom(octree, generator, 200);
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	
+	for (int index = 0; index < 20; ++index) {
+		Point point = randomPoint(octree, generator);
+		auto inserted = octree.insert(LeafValue(200), point);
+		std::size_t nodeCount = octree.nodes().size();
+		for (int repeat = 0; repeat < 4; ++repeat) {
+			octree.erase(std::get<1>(inserted));
+			BOOST_REQUIRE_EQUAL(octree.nodes().size(), nodeCount);
+			inserted = octree.insert(LeafValue(200), point);
+			BOOST_REQUIRE_EQUAL(octree.nodes().size(), nodeCount);
+		}
+		octree.erase(std::get<1>(inserted));
+		check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+	
+	// Erasing all of the leafs still merges all of the nodes eventually.
+	while (!leafPairs.empty()) {
+		LeafValue value = std::get<LeafValue>(leafPairs.back());
+		auto leaf = octree.leafs().begin();
+		while (leaf->value != value) {
+			++leaf;
+		}
+		octree.erase(leaf);
+		leafPairs.pop_back();
+		check = checkOrthtree(octree, leafPairs);
+		BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+	}
+	BOOST_REQUIRE(!octree.root()->hasChildren);
+}
+
+ORTHTREE_PRESET_TEST_CASES(MergeCapacity, checkMergeCapacity)
+
+// Used with Orthtree::reduce to store the sum of the leaf values below each
+// node in the node values.
+template<typename Orthtree>
+static NodeValue leafSum(typename Orthtree::ConstLeafReferenceProxy leaf) {
+	return NodeValue(static_cast<int>(leaf.value.data) + 1);
+}
+
+static NodeValue sumNodes(NodeValue const& lhs, NodeValue const& rhs) {
+	return NodeValue(static_cast<int>(lhs.data + rhs.data));
+}
+
+template<typename Orthtree>
+static void checkSums(Orthtree const& octree) {
+	for (
+			auto node = octree.nodes().begin();
+			node != octree.nodes().end();
+			++node) {
+		std::size_t sum = 0;
+		for (
+				auto leaf = node->leafs.begin();
+				leaf != node->leafs.end();
+				++leaf) {
+			sum += leaf->value.data + 1;
+		}
+		BOOST_REQUIRE_EQUAL(node->value.data, sum);
+	}
+}
+
+// Fills in the node values with the sum of the leaf values below each node,
+// both with one thread and with several, and compares them against the leafs
+// of each node.
+template<typename Orthtree>
+static void checkReduce(Orthtree const& emptyOctree) {
+	Orthtree octree = emptyOctree;
+	std::mt19937 generator(13);
+	fillRandom(octree, generator, 300);
+	for (int index = 0; index < 300; index += 3) {
+		octree.erase(octree.leafs().begin() + index / 3);
+	}
+	for (std::size_t threadCount : { 1, 3 }) {
+		octree.reduce(
+			[](typename Orthtree::ConstLeafReferenceProxy) {
+				return NodeValue();
+			},
+			sumNodes,
+			threadCount);
+		octree.reduce(leafSum<Orthtree>, sumNodes, threadCount);
+		checkSums(octree);
+	}
+}
+
+ORTHTREE_PRESET_TEST_CASES(Reduce, checkReduce)
+
+// Changes the leafs of an orthtree in various ways, and checks that only
+// refilling the node values that changed gives the same result as refilling
+// all of them.
+template<typename Orthtree>
+static void checkReduceChanged(Orthtree const& emptyOctree) {
+	Orthtree octree = emptyOctree;
+	std::mt19937 generator(14);
+	std::uniform_real_distribution<Scalar> distribution(0.0, 1.0);
+	Point rootPosition = emptyOctree.root()->position;
+	fillRandom(octree, generator, 200);
+	int nextValue = 200;
+	octree.reduce(leafSum<Orthtree>, sumNodes);
+	
+	// Refilling the values when nothing has changed doesn't visit anything.
+	std::size_t visitCount = 0;
+	octree.reduceChanged(
+		[&](typename Orthtree::ConstLeafReferenceProxy leaf) {
+			++visitCount;
+			return leafSum<Orthtree>(leaf);
+		},
+		[&](NodeValue const& lhs, NodeValue const& rhs) {
+			++visitCount;
+			return sumNodes(lhs, rhs);
+		});
+	BOOST_REQUIRE_EQUAL(visitCount, 0);
+	
+	for (int step = 0; step < 40; ++step) {
+		std::size_t leafIndex = static_cast<std::size_t>(
+			distribution(generator) * octree.leafs().size());
+		auto leaf = octree.leafs().begin() + leafIndex;
+		switch (step % 5) {
+		case 0:
+			octree.insert(
+				LeafValue(nextValue++),
+				randomPoint(octree, generator));
+			break;
+		case 1:
+			octree.erase(leaf);
+			break;
+		case 2:
+			octree.move(leaf, randomPoint(octree, generator));
+			break;
+		case 3:
+			// Moving a leaf a tiny bit keeps it in the same node, but the node
+			// is still marked as changed.
+			{
+				Point point = leaf->position;
+				point[0] = std::nextafter(point[0], rootPosition[0]);
+				octree.move(leaf, point);
+			}
+			break;
+		default:
+			{
+				std::vector<Point> positions;
+				for (std::size_t index = 0; index < 10; ++index) {
+					positions.push_back(randomPoint(octree, generator));
+				}
+				octree.move(
+					octree.root(),
+					octree.leafs().begin(),
+					octree.leafs().begin() + 10,
+					positions.begin(),
+					positions.end());
+				octree.eraseIf([](
+						typename Orthtree::ConstLeafReferenceProxy leaf) {
+					return leaf.value.data % 37 == 0;
+				});
+			}
+			break;
+		}
+		octree.reduceChanged(leafSum<Orthtree>, sumNodes);
+		checkSums(octree);
+	}
+}
+
+ORTHTREE_PRESET_TEST_CASES(ReduceChanged, checkReduceChanged)
+
+// A Barnes-Hut kernel that counts how many leafs act on each leaf, and adds up
+// the squared distances to the leafs that act on it one by one.
+struct CountKernel {
+	struct Result {
+		std::size_t leafCount;
+		std::size_t nodeLeafCount;
+		Scalar distanceSquared;
+		Result() : leafCount(0), nodeLeafCount(0), distanceSquared(0.0) {
+		}
+	};
+	void node(Result& result, Point const&, NodeValue const& value) const {
+		result.nodeLeafCount += value.data;
+	}
+	void leaf(
+			Result& result,
+			Point const& position,
+			Point const& otherPosition,
+			LeafValue const&) const {
+		result.leafCount += 1;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			Scalar delta = position[dim] - otherPosition[dim];
+			result.distanceSquared += delta * delta;
+		}
+	}
+};
+
+// Checks that every other leaf acts on each leaf exactly once in a Barnes-Hut
+// evaluation, whether directly or through a node, and that an opening angle of
+// zero gives the exact sum. Both are done with one thread and with several.
+template<typename Orthtree>
+static void checkBarnesHut(Orthtree const& emptyOctree) {
+	Orthtree octree = emptyOctree;
+	std::mt19937 generator(15);
+	std::vector<LeafPair> leafPairs = fillRandom(octree, generator, 300);
+	octree.reduce(
+		[](typename Orthtree::ConstLeafReferenceProxy) {
+			return NodeValue(1);
+		},
+		sumNodes);
+	
+	std::vector<CountKernel::Result> results(leafPairs.size());
+	auto visit = [&](
+			typename Orthtree::ConstLeafIterator leaf,
+			CountKernel::Result const& result) {
+		results[leaf->value.data] = result;
+	};
+	Orthtree const& constOctree = octree;
+	for (std::size_t threadCount : { 1, 3 }) {
+		constOctree.barnesHut(
+			CountKernel(),
+			typename Orthtree::OpeningAngle { 0.5 },
+			visit,
+			threadCount);
+		for (CountKernel::Result const& result : results) {
+			BOOST_REQUIRE_EQUAL(
+				result.leafCount + result.nodeLeafCount,
+				leafPairs.size() - 1);
+		}
+		
+		constOctree.barnesHut(
+			CountKernel(),
+			typename Orthtree::OpeningAngle { 0.0 },
+			visit,
+			threadCount);
+		for (std::size_t index = 0; index < leafPairs.size(); ++index) {
+			Point const& position = std::get<Point>(leafPairs[index]);
+			Scalar expected = 0.0;
+			for (LeafPair const& leafPair : leafPairs) {
+				for (std::size_t dim = 0; dim < Dimension; ++dim) {
+					Scalar delta =
+						position[dim] - std::get<Point>(leafPair)[dim];
+					expected += delta * delta;
+				}
+			}
+			BOOST_REQUIRE_EQUAL(results[index].nodeLeafCount, 0);
+			BOOST_REQUIRE_EQUAL(
+				results[index].leafCount,
+				leafPairs.size() - 1);
+			BOOST_REQUIRE_CLOSE(
+				results[index].distanceSquared,
+				expected,
+				1e-9);
+		}
+	}
+}
+
+ORTHTREE_PRESET_TEST_CASES(BarnesHut, checkBarnesHut)
+
+// How far the leafs of an orthtree can be outside of their nodes. This is zero
+// unless the orthtree is loose.
+template<typename Orthtree>
+static Scalar looseMargin(Orthtree const& octree) {
+	Scalar margin = 0.0;
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		margin = std::max<Scalar>(
+			margin,
+			DetailsOf<Orthtree>::type::Looseness *
+				octree.root()->dimensions[dim]);
+	}
+	return margin;
+}
+
+// The smallest squared distance between the leafs of two nodes, given that the
+// leafs can be outside of their nodes by a total of `margin` between them.
+template<typename NodeHandle>
+static Scalar nodeDistanceSquared(
+		NodeHandle node,
+		NodeHandle otherNode,
+		Scalar margin) {
+	Scalar distanceSquared = 0.0;
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		Scalar lower = node.position()[dim];
+		Scalar upper = lower + node.dimensions()[dim];
+		Scalar otherLower = otherNode.position()[dim];
+		Scalar otherUpper = otherLower + otherNode.dimensions()[dim];
+		Scalar delta = std::max<Scalar>(
+			{ 0.0, otherLower - upper - margin, lower - otherUpper - margin });
+		distanceSquared += delta * delta;
+	}
+	return distanceSquared;
+}
+
+// A dual-tree rule that counts the leafs of the other orthtree within a radius
+// of each leaf, and how many times each pair of leafs is visited. The counts
+// are kept per leaf of the first orthtree, which is only ever visited from one
+// thread at a time.
+template<typename Orthtree>
+struct RadiusRule {
+	Scalar radius;
+	Scalar margin;
+	bool prune;
+	std::size_t otherCount;
+	std::vector<std::size_t> counts;
+	std::vector<std::size_t> visits;
+	Scalar score(
+			typename Orthtree::NodeHandle node,
+			typename Orthtree::NodeHandle otherNode) const {
+		if (!prune) {
+			return 0.0;
+		}
+		Scalar distanceSquared = nodeDistanceSquared(node, otherNode, margin);
+		return distanceSquared > radius * radius ?
+			std::numeric_limits<Scalar>::infinity() :
+			distanceSquared;
+	}
+	void baseCase(
+			typename Orthtree::ConstLeafIterator leaf,
+			typename Orthtree::ConstLeafIterator otherLeaf) {
+		std::size_t index = leaf->value.data;
+		std::size_t otherIndex = otherLeaf->value.data;
+		visits[index * otherCount + otherIndex] += 1;
+		Scalar distanceSquared = 0.0;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			Scalar delta = leaf->position[dim] - otherLeaf->position[dim];
+			distanceSquared += delta * delta;
+		}
+		if (distanceSquared <= radius * radius) {
+			counts[index] += 1;
+		}
+	}
+};
+
+// A dual-tree rule that finds the nearest leaf of the other orthtree to each
+// leaf. A pair of nodes is pruned once it is further away than the furthest of
+// the nearest leafs found so far for the first node, which only tightens as the
+// traversal goes on.
+template<typename Orthtree>
+struct NearestRule {
+	Scalar margin;
+	std::vector<Scalar> distances;
+	Scalar score(
+			typename Orthtree::NodeHandle node,
+			typename Orthtree::NodeHandle otherNode) const {
+		Scalar bound = 0.0;
+		auto leafs = node.leafs();
+		for (auto leaf = leafs.begin(); leaf != leafs.end(); ++leaf) {
+			bound = std::max(bound, distances[leaf->value.data]);
+		}
+		Scalar distanceSquared = nodeDistanceSquared(node, otherNode, margin);
+		return distanceSquared > bound ?
+			std::numeric_limits<Scalar>::infinity() :
+			distanceSquared;
+	}
+	void baseCase(
+			typename Orthtree::ConstLeafIterator leaf,
+			typename Orthtree::ConstLeafIterator otherLeaf) {
+		std::size_t index = leaf->value.data;
+		Scalar distanceSquared = 0.0;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			Scalar delta = leaf->position[dim] - otherLeaf->position[dim];
+			distanceSquared += delta * delta;
+		}
+		distances[index] = std::min(distances[index], distanceSquared);
+	}
+};
+
+// Checks a dual-tree traversal between two orthtrees, and between an orthtree
+// and itself, against comparing every pair of leafs, with one thread and with
+// several. Without pruning, every pair of leafs has to be visited exactly once.
+template<typename Orthtree>
+static void checkDualTree(Orthtree const& emptyOctree) {
+	std::mt19937 generator(16);
+	Orthtree octrees[2] = { emptyOctree, emptyOctree };
+	std::vector<LeafPair> leafPairs[2] = {
+		fillRandom(octrees[0], generator, 200),
+		fillRandom(octrees[1], generator, 150) };
+	auto distanceSquared = [&](std::size_t index, LeafPair const& leafPair) {
+		Scalar result = 0.0;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			Scalar delta =
+				std::get<Point>(leafPairs[0][index])[dim] -
+				std::get<Point>(leafPair)[dim];
+			result += delta * delta;
+		}
+		return result;
+	};
+	Scalar radius = 0.1 * emptyOctree.root()->dimensions[0];
+	Scalar margin = 2 * looseMargin(emptyOctree);
+	
+	// Find the nearest leafs in an orthtree that covers a larger box than this
+	// one as well, so that the nodes being paired up aren't the same size.
+	Point largerPosition = emptyOctree.root()->position;
+	Point largerDimensions = emptyOctree.root()->dimensions;
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		largerPosition[dim] -= 0.5 * largerDimensions[dim];
+		largerDimensions[dim] *= 3.0;
+	}
+	Orthtree larger(
+		largerPosition,
+		largerDimensions,
+		emptyOctree.nodeCapacity(),
+		emptyOctree.maxDepth());
+	for (LeafPair const& leafPair : leafPairs[1]) {
+		larger.insertTuple(leafPair);
+	}
+	
+	for (std::size_t threadCount : { 1, 3 }) {
+		for (std::size_t other = 0; other < 2; ++other) {
+			std::size_t otherCount = leafPairs[other].size();
+			for (bool prune : { true, false }) {
+				RadiusRule<Orthtree> rule;
+				rule.radius = radius;
+				rule.margin = margin;
+				rule.prune = prune;
+				rule.otherCount = otherCount;
+				rule.counts.assign(leafPairs[0].size(), 0);
+				rule.visits.assign(leafPairs[0].size() * otherCount, 0);
+				if (other == 0) {
+					octrees[0].dualTree(rule, threadCount);
+				}
+				else {
+					octrees[0].dualTree(octrees[1], rule, threadCount);
+				}
+				for (
+						std::size_t index = 0;
+						index < leafPairs[0].size();
+						++index) {
+					std::size_t const* visits =
+						rule.visits.data() + index * otherCount;
+					std::size_t expected = 0;
+					for (
+							std::size_t otherIndex = 0;
+							otherIndex < otherCount;
+							++otherIndex) {
+						if (other == 0 && otherIndex == index) {
+							BOOST_REQUIRE_EQUAL(visits[otherIndex], 0);
+							continue;
+						}
+						Scalar otherDistanceSquared = distanceSquared(
+							index,
+							leafPairs[other][otherIndex]);
+						if (otherDistanceSquared <= radius * radius) {
+							expected += 1;
+						}
+						if (!prune) {
+							BOOST_REQUIRE_EQUAL(visits[otherIndex], 1);
+						}
+					}
+					BOOST_REQUIRE_EQUAL(rule.counts[index], expected);
+				}
+			}
+		}
+		
+		for (Orthtree const* other : { &octrees[1], &larger }) {
+			NearestRule<Orthtree> rule;
+			rule.margin = looseMargin(emptyOctree) + looseMargin(*other);
+			rule.distances.assign(
+				leafPairs[0].size(),
+				std::numeric_limits<Scalar>::infinity());
+			octrees[0].dualTree(*other, rule, threadCount);
+			for (std::size_t index = 0; index < leafPairs[0].size(); ++index) {
+				Scalar expected = std::numeric_limits<Scalar>::infinity();
+				for (LeafPair const& leafPair : leafPairs[1]) {
+					expected = std::min(
+						expected,
+						distanceSquared(index, leafPair));
+				}
+				BOOST_REQUIRE_EQUAL(rule.distances[index], expected);
+			}
+		}
+	}
+}
+
+ORTHTREE_PRESET_TEST_CASES(DualTree, checkDualTree)
+
+// Checks that looking at every node through a NodeHandle gives the same results
+// as dereferencing a NodeIterator.
+template<typename Orthtree>
+static void checkNodeHandle(Orthtree const& emptyOctree) {
+	Orthtree octree = emptyOctree;
+	std::mt19937 generator(17);
+	fillRandom(octree, generator, 300);
+	
+	Orthtree const& constOctree = octree;
+	auto nodes = constOctree.nodes();
+	for (auto node = nodes.begin(); node != nodes.end(); ++node) {
+		typename Orthtree::NodeHandle handle = node.handle();
+		BOOST_REQUIRE(handle == node.handle());
+		BOOST_REQUIRE(handle.iterator() == node);
+		BOOST_REQUIRE_EQUAL(handle.hasParent(), node->hasParent);
+		if (node->hasParent) {
+			BOOST_REQUIRE(handle.parent() == node->parent.handle());
+		}
+		BOOST_REQUIRE_EQUAL(handle.hasChildren(), node->hasChildren);
+		if (node->hasChildren) {
+			for (std::size_t child = 0; child < (1 << Dimension); ++child) {
+				BOOST_REQUIRE(
+					handle.child(child) == node->children[child].handle());
+				BOOST_REQUIRE(handle.child(child).parent() == handle);
+			}
+		}
+		BOOST_REQUIRE(handle.leafs().begin() == node->leafs.begin());
+		BOOST_REQUIRE(handle.leafs().end() == node->leafs.end());
+		BOOST_REQUIRE_EQUAL(handle.leafs().size(), node->leafs.size());
+		BOOST_REQUIRE_EQUAL(handle.leafCount(), node->leafs.size());
+		BOOST_REQUIRE_EQUAL(handle.depth(), node->depth);
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			BOOST_REQUIRE_EQUAL(handle.position()[dim], node->position[dim]);
+			BOOST_REQUIRE_EQUAL(
+				handle.dimensions()[dim],
+				node->dimensions[dim]);
+		}
+		BOOST_REQUIRE_EQUAL(handle.value().data, node->value.data);
+	}
+}
+
+ORTHTREE_PRESET_TEST_CASES(NodeHandle, checkNodeHandle)
+
+// Details with 8 bit indices, so that running out of indices is easy to test.
+struct OrthtreeInternalDetailsTiny : public OrthtreeInternalDetailsNarrow {
+	
+	template<typename T>
+	using SizeType = std::uint8_t;
+	
+	template<typename T>
+	using DifferenceType = std::int8_t;
+	
+};
+
+// Inserts leafs until there are too many to index, and checks that the
+// orthtree throws and is still valid afterwards.
+BOOST_DATA_TEST_CASE(
+		OrthtreeOverflowTest,
+		bdata::make({1, 4, 64}),
+		nodeCapacity) {
+	using TinyOctree = Orthtree<
+		Dimension, Point, LeafValue, NodeValue,
+		OrthtreeInternalDetailsTiny>;
+	TinyOctree octree(
+		{0.0, 0.0, 0.0}, {16.0, 16.0, 16.0},
+		nodeCapacity);
+	std::mt19937 generator(9);
+	std::uniform_real_distribution<Scalar> distribution(0.0, 16.0);
+	std::vector<LeafPair> leafPairs;
+	bool overflowed = false;
+	for (int index = 0; index < 256 && !overflowed; ++index) {
+		Point point {
+			distribution(generator),
+			distribution(generator),
+			distribution(generator)
+		};
+		try {
+			octree.insert(LeafValue(index), point);
+			leafPairs.push_back(LeafPair {LeafValue(index), point});
+		}
+		catch (std::length_error const&) {
+			overflowed = true;
+		}
+	}
+	BOOST_REQUIRE(overflowed);
+	BOOST_REQUIRE_LE(octree.leafs().size(), 127u);
+	BOOST_REQUIRE_LE(octree.nodes().size(), 127u);
+	CheckOrthtreeResult check = checkOrthtree(octree, leafPairs);
+	BOOST_REQUIRE_EQUAL(check, CheckOrthtreeResult::Success);
+}
+
+// Checks that the leaf filtering kernels give the same results with every
+// instruction set that the processor supports, for every length of block.
+template<std::size_t Dim, typename KernelScalar>
+static void checkKernels(std::size_t count) {
+	std::mt19937 generator(count);
+	std::uniform_real_distribution<KernelScalar> distribution(0.0, 1.0);
+	std::array<std::vector<KernelScalar>, Dim> coordinates;
+	std::array<KernelScalar const*, Dim> pointers;
+	for (std::size_t dim = 0; dim < Dim; ++dim) {
+		coordinates[dim].resize(count);
+		for (KernelScalar& coordinate : coordinates[dim]) {
+			coordinate = distribution(generator);
+		}
+		pointers[dim] = coordinates[dim].data();
+	}
+	std::array<KernelScalar, Dim> lower;
+	std::array<KernelScalar, Dim> dimensions;
+	lower.fill(0.25);
+	dimensions.fill(0.5);
+	KernelScalar radiusSquared = 0.2;
+	std::uint64_t expectedBox = internal::boxMask<Dim>(
+		pointers.data(), count, lower.data(), dimensions.data(),
+		internal::SimdLevel::Scalar);
+	std::uint64_t expectedBall = internal::ballMask<Dim>(
+		pointers.data(), count, lower.data(), radiusSquared,
+		internal::SimdLevel::Scalar);
+	for (
+			internal::SimdLevel level : {
+				internal::SimdLevel::Sse2,
+				internal::SimdLevel::Avx,
+				internal::SimdLevel::Avx512 }) {
+		if (level > internal::simdLevel()) {
+			continue;
+		}
+		std::uint64_t box = internal::boxMask<Dim>(
+			pointers.data(), count, lower.data(), dimensions.data(), level);
+		std::uint64_t ball = internal::ballMask<Dim>(
+			pointers.data(), count, lower.data(), radiusSquared, level);
+		BOOST_REQUIRE(box == expectedBox);
+		BOOST_REQUIRE(ball == expectedBall);
+	}
+}
+
+BOOST_DATA_TEST_CASE(
+		SimdKernelTest,
+		bdata::xrange(internal::MaskWidth + 1),
+		count) {
+	checkKernels<2, float>(count);
+	checkKernels<2, double>(count);
+	checkKernels<3, float>(count);
+	checkKernels<3, double>(count);
+}
+
+// Searches for the closest leafs to a point.
+BOOST_DATA_TEST_CASE(
+		OrthtreeNearestTest,
+		octreeData * leafPairsData * positionData * bdata::make({0, 1, 3, 100}),
+		emptyOctree,
+		initialLeafPairs,
+		point,
+		k) {
+	Octree octree = emptyOctree;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		octree.insertTuple(*it);
+	}
+	auto squaredDistance = [&](Point const& position) {
+		Scalar result = 0.0;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			result += (position[dim] - point[dim]) * (position[dim] - point[dim]);
+		}
+		return result;
+	};
+	// Find the distances to the closest leafs by checking all of them.
+	std::vector<Scalar> expected;
+	for (LeafPair const& pair : initialLeafPairs) {
+		expected.push_back(squaredDistance(std::get<Point>(pair)));
+	}
+	std::sort(expected.begin(), expected.end());
+	expected.resize(std::min<std::size_t>(expected.size(), k));
+	// Leafs that are the same distance away should come in depth-first order.
+	Octree const& constOctree = octree;
+	std::vector<std::pair<Scalar, std::size_t> > ranks;
+	std::vector<Octree::ConstLeafIterator> expectedLeafs;
+	for (
+			auto leaf = constOctree.leafs().begin();
+			leaf != constOctree.leafs().end();
+			++leaf) {
+		ranks.emplace_back(squaredDistance(leaf->position), ranks.size());
+		expectedLeafs.push_back(leaf);
+	}
+	std::sort(ranks.begin(), ranks.end());
+	ranks.resize(expected.size());
+	
+	Octree::NearestBuffer buffer;
+	std::vector<Octree::ConstLeafIterator> leafs;
+	constOctree.nearest(point, k, std::back_inserter(leafs), buffer);
+	std::vector<Scalar> found;
+	for (auto leaf : leafs) {
+		found.push_back(squaredDistance(leaf->position));
+	}
+	BOOST_REQUIRE(found == expected);
+	for (std::size_t index = 0; index < ranks.size(); ++index) {
+		BOOST_REQUIRE(leafs[index] == expectedLeafs[ranks[index].second]);
+	}
+	BOOST_REQUIRE(octree.nearest(point, k).size() == expected.size());
+}
+
+// Searches for the leafs inside of a box.
+BOOST_DATA_TEST_CASE(
+		OrthtreeQueryTest,
+		octreeData * leafPairsData * boxData,
+		emptyOctree,
+		initialLeafPairs,
+		box) {
+	Octree octree = emptyOctree;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		octree.insertTuple(*it);
+	}
+	BOOST_REQUIRE(checkQuery(octree, box, initialLeafPairs));
+}
+
+// Searches for the leafs inside of a box in an orthtree with gaps, after some of
+// the leafs have been erased.
+BOOST_DATA_TEST_CASE(
+		OrthtreeGappedQueryTest,
+		gappedOctreeData * boxData,
+		emptyOctree,
+		box) {
+	std::mt19937 generator(4);
+	std::uniform_int_distribution<int> distribution(0, 63);
+	GappedOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs;
+	for (int index = 0; index < 300; ++index) {
+		Point point;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			point[dim] =
+				emptyOctree.root()->position[dim] +
+				distribution(generator) / 64.0 *
+				emptyOctree.root()->dimensions[dim];
+		}
+		leafPairs.push_back(LeafPair {LeafValue(index), point});
+		octree.insertTuple(leafPairs.back());
+	}
+	for (int index = 0; index < 100; ++index) {
+		auto leaf = std::find_if(
+			octree.leafs().begin(),
+			octree.leafs().end(),
+			std::bind(
+				compareLeafPair<
+					LeafPair,
+					Dimension, Point, LeafValue, NodeValue,
+					OrthtreeInternalDetailsGapped>,
+				leafPairs.back(),
+				std::placeholders::_1));
+		octree.erase(leaf);
+		leafPairs.pop_back();
+	}
+	BOOST_REQUIRE(checkQuery(octree, box, leafPairs));
+}
+
+// Searches for the leafs within a distance of a point.
+BOOST_DATA_TEST_CASE(
+		OrthtreeWithinRadiusTest,
+		octreeData * leafPairsData * positionData *
+			bdata::make({0.0, 2.0, 5.0, 40.0}),
+		emptyOctree,
+		initialLeafPairs,
+		point,
+		radius) {
+	Octree octree = emptyOctree;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		octree.insertTuple(*it);
+	}
+	// Find the leafs within the radius by checking each of them.
+	std::vector<std::size_t> expected;
+	for (LeafPair const& pair : initialLeafPairs) {
+		Scalar distance = 0.0;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			Scalar delta = std::get<Point>(pair)[dim] - point[dim];
+			distance += delta * delta;
+		}
+		if (distance <= radius * radius) {
+			expected.push_back(std::get<LeafValue>(pair).data);
+		}
+	}
+	std::vector<std::size_t> found;
+	Octree const& constOctree = octree;
+	auto ranges = constOctree.withinRadius(point, radius);
+	for (auto range = ranges.begin(); range != ranges.end(); ++range) {
+		BOOST_REQUIRE(!range->empty());
+		for (auto leaf = range->begin(); leaf != range->end(); ++leaf) {
+			found.push_back(leaf->value.data);
+		}
+	}
+	std::sort(expected.begin(), expected.end());
+	std::sort(found.begin(), found.end());
+	BOOST_REQUIRE(found == expected);
+}
+
+// Finds every pair of leafs that are within a distance of each other.
+BOOST_DATA_TEST_CASE(
+		OrthtreeForEachPairWithinTest,
+		octreeData * leafPairsData * bdata::make({0.0, 2.0, 5.0, 40.0}),
+		emptyOctree,
+		initialLeafPairs,
+		radius) {
+	Octree octree = emptyOctree;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		octree.insertTuple(*it);
+	}
+	BOOST_REQUIRE(checkPairsWithin(octree, radius, initialLeafPairs));
+}
+
+// Finds every pair of leafs that are within a distance of each other in an
+// orthtree with gaps.
+BOOST_DATA_TEST_CASE(
+		OrthtreeGappedForEachPairWithinTest,
+		gappedOctreeData * bdata::make({0.0, 1.0, 4.0}),
+		emptyOctree,
+		radius) {
+	std::mt19937 generator(5);
+	std::uniform_int_distribution<int> distribution(0, 31);
+	GappedOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs;
+	for (int index = 0; index < 200; ++index) {
+		Point point;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			point[dim] =
+				emptyOctree.root()->position[dim] +
+				distribution(generator) / 32.0 *
+				emptyOctree.root()->dimensions[dim];
+		}
+		leafPairs.push_back(LeafPair {LeafValue(index), point});
+		octree.insertTuple(leafPairs.back());
+	}
+	BOOST_REQUIRE(checkPairsWithin(octree, radius, leafPairs));
+}
+
+// Traces rays and line segments through an octree.
+BOOST_DATA_TEST_CASE(
+		OrthtreeTraceTest,
+		octreeData * leafPairsData * segmentData,
+		emptyOctree,
+		initialLeafPairs,
+		segment) {
+	Octree octree = emptyOctree;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		octree.insertTuple(*it);
+	}
+	BOOST_REQUIRE(checkTrace(octree, segment, false));
+	BOOST_REQUIRE(checkTrace(octree, segment, true));
+}
+
+// Traces line segments through an octree with gaps.
+BOOST_DATA_TEST_CASE(
+		OrthtreeGappedTraceTest,
+		gappedOctreeData * leafPairsData * segmentData,
+		emptyOctree,
+		initialLeafPairs,
+		segment) {
+	GappedOctree octree = emptyOctree;
+	for (auto it = initialLeafPairs.begin(); it != initialLeafPairs.end(); ++it) {
+		octree.insertTuple(*it);
+	}
+	BOOST_REQUIRE(checkTrace(octree, segment, true));
+}
+
+// Traces rays and line segments through a loose octree whose leafs have been
+// moved outside of their nodes.
+BOOST_DATA_TEST_CASE(
+		OrthtreeLooseTraceTest,
+		looseOctreeData * segmentData,
+		emptyOctree,
+		segment) {
+	std::mt19937 generator(37);
+	std::uniform_real_distribution<Scalar> distribution(0.0, 1.0);
+	Point rootDimensions = emptyOctree.root()->dimensions;
+	LooseOctree octree = emptyOctree;
+	std::vector<LeafPair> leafPairs = fillRandom(octree, generator, 200);
+	Scalar looseness = OrthtreeInternalDetailsLoose::Looseness;
+	for (int step = 0; step < 4; ++step) {
+		std::vector<Point> positions;
+		for (
+				auto leaf = octree.leafs().begin();
+				leaf != octree.leafs().end();
+				++leaf) {
+			Point point = leaf->position;
+			for (std::size_t dim = 0; dim < Dimension; ++dim) {
+				point[dim] +=
+					2 * looseness * rootDimensions[dim] *
+					(distribution(generator) - Scalar(0.5));
+			}
+			if (!octree.contains(octree.root(), point)) {
+				point = leaf->position;
+			}
+			positions.push_back(point);
+			std::get<Point>(leafPairs[leaf->value.data]) = point;
+		}
+		octree.rebin(positions.begin(), positions.end());
+	}
+	BOOST_REQUIRE(checkTrace(octree, segment, false));
+	BOOST_REQUIRE(checkTrace(octree, segment, true));
+	
+	// A ray through the position of a leaf has to visit that leaf, even if the
+	// leaf is outside of its node.
+	for (LeafPair const& leafPair : leafPairs) {
+		Point start = std::get<Point>(leafPair);
+		start[1] = emptyOctree.root()->position[1] - 1.0;
+		Point direction {0.0, 1.0, 0.0};
+		bool found = false;
+		octree.traceRay(
+			start,
+			direction,
+			[&](LooseOctree::ConstLeafRange range, Scalar, Scalar) {
+				for (auto leaf = range.begin(); leaf != range.end(); ++leaf) {
+					found = found || leaf->value == std::get<LeafValue>(leafPair);
+				}
+				return !found;
+			});
+		BOOST_REQUIRE(found);
+	}
+}
+
+template<typename Orthtree>
+bool checkTrace(Orthtree const& orthtree, Box const& segment, bool isSegment) {
+	Point start = segment.first;
+	Point direction;
+	for (std::size_t dim = 0; dim < Dimension; ++dim) {
+		direction[dim] = segment.second[dim] - start[dim];
+	}
+	Scalar tMax = isSegment ? 1.0 : std::numeric_limits<Scalar>::max();
+	Scalar looseness = DetailsOf<Orthtree>::type::Looseness;
+	// Find the nodes crossed by the ray by checking each of them, allowing for
+	// the margin of a loose orthtree. The nodes that the ray passes through
+	// must be visited, and the nodes that it only touches may be visited.
+	std::vector<std::size_t> required;
+	std::vector<std::size_t> allowed;
+	for (
+			auto node = orthtree.nodes().begin();
+			node != orthtree.nodes().end();
+			++node) {
+		if (node->hasChildren || node->leafs.empty()) {
+			continue;
+		}
+		bool crossed = true;
+		Scalar tNear = 0.0;
+		Scalar tFar = tMax;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			Scalar margin = looseness * orthtree.root()->dimensions[dim];
+			Scalar lower = node->position[dim] - margin;
+			Scalar upper = node->position[dim] + node->dimensions[dim] + margin;
+			if (direction[dim] == 0.0) {
+				crossed = crossed && start[dim] >= lower && start[dim] < upper;
+			}
+			else {
+				Scalar tLower = (lower - start[dim]) / direction[dim];
+				Scalar tUpper = (upper - start[dim]) / direction[dim];
+				tNear = std::max(tNear, std::min(tLower, tUpper));
+				tFar = std::min(tFar, std::max(tLower, tUpper));
+			}
+		}
+		auto leafs = node->leafs;
+		for (auto leaf : leafs) {
+			if (crossed && tNear < tFar) {
+				required.push_back(leaf.value.data);
+			}
+			if (crossed && tNear <= tFar) {
+				allowed.push_back(leaf.value.data);
+			}
+		}
+	}
+	using Visit = std::function<bool(
+		typename Orthtree::ConstLeafRange,
+		Scalar,
+		Scalar)>;
+	auto trace = [&](Visit visit) {
+		return isSegment ?
+			orthtree.traceSegment(segment.first, segment.second, visit) :
+			orthtree.traceRay(start, direction, visit);
+	};
+	// The nodes should be visited in order along the ray. The nodes of a loose
+	// orthtree overlap, so they are only in order among siblings.
+	std::vector<std::size_t> found;
+	Scalar tPrevious = 0.0;
+	bool ordered = true;
+	bool finished = trace([&](
+			typename Orthtree::ConstLeafRange range,
+			Scalar tEnter,
+			Scalar tExit) {
+		ordered =
+			ordered &&
+			(looseness != 0.0 || tPrevious <= tEnter) &&
+			tEnter <= tExit;
+		tPrevious = tEnter;
+		for (auto leaf = range.begin(); leaf != range.end(); ++leaf) {
+			found.push_back(leaf->value.data);
+		}
+		return true;
+	});
+	if (!finished || !ordered) {
+		return false;
+	}
+	std::sort(required.begin(), required.end());
+	std::sort(allowed.begin(), allowed.end());
+	std::sort(found.begin(), found.end());
+	if (
+			!std::includes(
+				found.begin(), found.end(),
+				required.begin(), required.end()) ||
+			!std::includes(
+				allowed.begin(), allowed.end(),
+				found.begin(), found.end())) {
+		return false;
+	}
+	// Stopping the trace at the first node should visit only that node.
+	std::size_t visitCount = 0;
+	finished = trace([&](typename Orthtree::ConstLeafRange, Scalar, Scalar) {
+		++visitCount;
+		return false;
+	});
+	return
+		finished == found.empty() &&
+		visitCount == (found.empty() ? 0 : 1);
+}
+
+template<typename Orthtree>
+bool checkPairsWithin(
+		Orthtree const& orthtree,
+		Scalar radius,
+		std::vector<LeafPair> const& leafPairs) {
+	// Find the pairs of leafs by checking every pair.
+	std::vector<std::pair<std::size_t, std::size_t> > expected;
+	for (auto it = leafPairs.begin(); it != leafPairs.end(); ++it) {
+		for (auto otherIt = it + 1; otherIt != leafPairs.end(); ++otherIt) {
+			Scalar distance = 0.0;
+			for (std::size_t dim = 0; dim < Dimension; ++dim) {
+				Scalar delta =
+					std::get<Point>(*it)[dim] - std::get<Point>(*otherIt)[dim];
+				distance += delta * delta;
+			}
+			if (distance <= radius * radius) {
+				std::size_t first = std::get<LeafValue>(*it).data;
+				std::size_t second = std::get<LeafValue>(*otherIt).data;
+				expected.push_back(
+					std::make_pair(
+						std::min(first, second),
+						std::max(first, second)));
+			}
+		}
+	}
+	// Each pair should be found exactly once.
+	std::vector<std::pair<std::size_t, std::size_t> > found;
+	orthtree.forEachPairWithin(
+		radius,
+		[&](
+				typename Orthtree::ConstLeafIterator leaf,
+				typename Orthtree::ConstLeafIterator otherLeaf) {
+			std::size_t first = leaf->value.data;
+			std::size_t second = otherLeaf->value.data;
+			found.push_back(
+				std::make_pair(std::min(first, second), std::max(first, second)));
+		});
+	std::sort(expected.begin(), expected.end());
+	std::sort(found.begin(), found.end());
+	return expected == found;
+}
+
+template<typename Orthtree>
+bool checkQuery(
+		Orthtree const& orthtree,
+		Box const& box,
+		std::vector<LeafPair> const& leafPairs) {
+	// Find the leafs inside of the box by checking each of them.
+	std::vector<std::size_t> expected;
+	for (LeafPair const& pair : leafPairs) {
+		Point point = std::get<Point>(pair);
+		bool contained = true;
+		for (std::size_t dim = 0; dim < Dimension; ++dim) {
+			contained = contained &&
+				point[dim] >= box.first[dim] &&
+				point[dim] - box.first[dim] < box.second[dim];
+		}
+		if (contained) {
+			expected.push_back(std::get<LeafValue>(pair).data);
+		}
+	}
+	// The ranges should be non-empty, in order, and not overlap.
+	std::vector<std::size_t> found;
+	auto ranges = orthtree.query(box.first, box.second);
+	for (auto range = ranges.begin(); range != ranges.end(); ++range) {
+		if (range->empty()) {
+			return false;
+		}
+		if (
+				static_cast<std::size_t>(
+					std::distance(range->begin(), range->end())) !=
+				range->size()) {
+			return false;
+		}
+		if (range != ranges.begin() && range->begin() < (range - 1)->end()) {
+			return false;
+		}
+		for (auto leaf = range->begin(); leaf != range->end(); ++leaf) {
+			found.push_back(leaf->value.data);
+		}
+	}
+	std::sort(expected.begin(), expected.end());
+	std::sort(found.begin(), found.end());
+	return expected == found;
+}
+
+template<
+	typename LeafPair,
+	std::size_t Dim, typename Vector, typename LeafValue, typename NodeValue,
+	typename Details>
+CheckOrthtreeResult checkOrthtree(
+		Orthtree<Dim, Vector, LeafValue, NodeValue, Details> const& orthtree,
+		std::vector<LeafPair> allLeafPairs) {
+	// Create a stack storing the points that belong to the current node.
+	std::vector<std::vector<LeafPair> > leafPairsStack;
+	leafPairsStack.push_back(allLeafPairs);
+	
+	// Check that the root node has no parent.
+	if (orthtree.root()->hasParent) {
+		return CheckOrthtreeResult::RootHasParent;
+	}
+	
+	// Loop through all of the nodes.
+	for (
+			auto node = orthtree.root();
+			node != orthtree.nodes().end();
 			++node) {
 		// Check that the current node has depth of +1 from its parent.
 		if (node->depth != (node->hasParent ? node->parent->depth + 1 : 0)) {
@@ -794,17 +3476,19 @@ CheckOrthtreeResult checkOrthtree(
 				std::bind(
 					compareLeafPair<
 						LeafPair,
-						Dim, Vector, LeafValue, NodeValue>,
+						Dim, Vector, LeafValue, NodeValue, Details>,
 					leafPair,
 					std::placeholders::_1));
 			if (leaf == node->leafs.end()) {
 				return CheckOrthtreeResult::LeafMissing;
 			}
 			// Then, make sure that it is contained within the bounds of the
-			// node.
+			// node, allowing for the margin of a loose orthtree.
 			for (std::size_t dim = 0; dim < Dim; ++dim) {
-				Scalar position = node->position[dim];
-				Scalar dimensions = node->dimensions[dim];
+				Scalar margin =
+					Details::Looseness * orthtree.root()->dimensions[dim];
+				Scalar position = node->position[dim] - margin;
+				Scalar dimensions = node->dimensions[dim] + 2 * margin;
 				if (!(
 						leaf->position[dim] >= position &&
 						leaf->position[dim] - position < dimensions)) {
@@ -817,6 +3501,8 @@ CheckOrthtreeResult checkOrthtree(
 		// of the node's leafs should belong to one and only one child.
 		bool overCapacity =
 			node->leafs.size() > orthtree.nodeCapacity();
+		bool overMergeCapacity =
+			node->leafs.size() > orthtree.mergeCapacity();
 		if (!node->hasChildren) {
 			int depthSign =
 				static_cast<int>(node->depth > orthtree.maxDepth()) -
@@ -832,7 +3518,7 @@ CheckOrthtreeResult checkOrthtree(
 		}
 		else {
 			// Otherwise, make sure it doens't have too few leafs either.
-			if (!overCapacity) {
+			if (!overMergeCapacity) {
 				return CheckOrthtreeResult::NodeUnderCapacity;
 			}
 			// Iterate over every child, and add its leafs to the stack (in
@@ -861,7 +3547,7 @@ CheckOrthtreeResult checkOrthtree(
 							std::bind(
 								compareLeafPair<
 									LeafPair,
-									Dim, Vector, LeafValue, NodeValue>,
+									Dim, Vector, LeafValue, NodeValue, Details>,
 								leafPair,
 								std::placeholders::_1));
 					});
@@ -918,7 +3604,8 @@ std::string to_string(LeafPair const& pair) {
 	return os.str();
 }
 
-std::string to_string(Octree const& octree) {
+template<typename Octree>
+static std::string octreeToString(Octree const& octree) {
 	std::ostringstream os;
 	os << "Octree(";
 	os << "node capacity: " << octree.nodeCapacity() << ", ";
@@ -932,6 +3619,38 @@ std::string to_string(Octree const& octree) {
 	return os.str();
 }
 
+std::string to_string(Octree const& octree) {
+	return octreeToString(octree);
+}
+
+std::string to_string(GappedOctree const& octree) {
+	return octreeToString(octree);
+}
+
+std::string to_string(SplitOctree const& octree) {
+	return octreeToString(octree);
+}
+
+std::string to_string(CompactOctree const& octree) {
+	return octreeToString(octree);
+}
+
+std::string to_string(ImplicitOctree const& octree) {
+	return octreeToString(octree);
+}
+
+std::string to_string(NarrowOctree const& octree) {
+	return octreeToString(octree);
+}
+
+std::string to_string(ArenaOctree const& octree) {
+	return octreeToString(octree);
+}
+
+std::string to_string(LooseOctree const& octree) {
+	return octreeToString(octree);
+}
+
 std::string to_string(RangeIndicesPair const& pair) {
 	std::ostringstream os;
 	os << "Range(";
@@ -940,6 +3659,14 @@ std::string to_string(RangeIndicesPair const& pair) {
 	return os.str();
 }
 
+std::string to_string(Box const& box) {
+	std::ostringstream os;
+	os << "Box(";
+	os << to_string(box.first) << ", ";
+	os << to_string(box.second) << ")";
+	return os.str();
+}
+
 template<typename T>
 std::string to_string(std::vector<T> vector) {
 	std::ostringstream os;